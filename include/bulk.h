@@ -0,0 +1,62 @@
+#pragma once
+
+#include "globals.h"
+
+/*
+ * Bulk submission of print jobs.
+ *
+ * The bulk command queues many files at once: file names, shell patterns
+ * and @listfile arguments (a file naming one file per line) are expanded
+ * here.  Files that do not fit in the job table wait in a backlog, in order,
+ * and become jobs as finished jobs are deleted.
+ */
+
+/* Options of print and bulk that apply to each job. */
+struct print_options {
+    int chunks;           // > 1: split the job into this many chunks
+    long timeout_ms;      // > 0: longest time the job may run
+    long retention_ms;    // < 0: use the global retention
+    int copies;           // copies printed on each printer
+    int fanout;           // nonzero: print on every named printer, not any one
+    int priority;         // higher goes first, and may preempt lower
+    int global_id;        // sharded: the coordinator's id for the job, or -1
+};
+
+/**
+ * Expands a bulk argument into file names.
+ *
+ * @param arg   A file name, a shell pattern, or @ followed by the name of a
+ *              file that lists one file name per line.
+ * @param each  Called with every file name, which is only valid during the call.
+ * @param ctx   Passed to each.
+ * @return the number of file names, or -1 if the pattern matched nothing or
+ * the list could not be read.
+ */
+int bulk_expand(char *arg, void (*each)(char *file, void *ctx), void *ctx);
+
+/**
+ * Queues a file: as a job if the job table has room and the backlog is
+ * empty, else at the end of the backlog.
+ *
+ * @return 1 if a job was created, 0 if the file went to the backlog, -1 if
+ * it could not be queued at all.
+ */
+int bulk_submit(char *file, FILE_TYPE *type, unsigned int eligible,
+                const struct print_options *options);
+
+/**
+ * Moves files from the backlog into the job table while it has room.
+ *
+ * @return the number of jobs created.
+ */
+int bulk_admit(void);
+
+/**
+ * Drops a removed printer from the eligible printers of backlogged files.
+ */
+void bulk_forget_printer(int p);
+
+/**
+ * @return the number of files waiting in the backlog.
+ */
+int bulk_backlog(void);
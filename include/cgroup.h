@@ -0,0 +1,114 @@
+#pragma once
+
+#include <sys/types.h>
+
+/*
+ * Resource accounting and limits of job pipelines.
+ *
+ * Where a cgroup v2 hierarchy is mounted and writable, the spooler makes a
+ * cgroup of its own, presi.<pid>, below the one it runs in, and every job's
+ * master joins a cgroup job<id> below that before it starts its pipeline, so
+ * that all its stages are accounted to the job; stages started by the fork
+ * server join their master's cgroup.  (Persistent converters serve many jobs
+ * and stay outside.)  When the master exits, the job's CPU time is read from
+ * cpu.stat and its memory peak from memory.peak, and the cgroup is removed.
+ * Warm pipelines run in a cgroup warm<pid> that becomes the job's when a job
+ * takes the pipeline over.
+ *
+ * Caps may be set per input type: a memory limit (memory.max) and a CPU
+ * bandwidth (cpu.max), each enforced when its controller is enabled in the
+ * subtree of the cgroup the spooler runs in, as systemd does for a delegated
+ * cgroup; the spooler only changes the cgroups below its own presi.<pid>.
+ * Without cgroups, or without the memory controller, the master's resource
+ * usage as returned when it is reaped (which covers the stages it waited
+ * for) stands in, and a memory cap limits the address space of each stage.
+ */
+
+struct job;
+struct file_type;
+struct rusage;
+
+/**
+ * Sets up the spooler's cgroup on first use.  Called in the spooler before
+ * it forks a master.
+ *
+ * @return nonzero if jobs are given cgroups.
+ */
+int cgroup_available(void);
+
+/**
+ * Moves the calling process, a job's master, into a new cgroup for the job,
+ * with the caps of the job's type.  Falls back to an address space limit for
+ * a memory cap the cgroup cannot enforce.
+ */
+void cgroup_job_enter(struct job *job);
+
+/**
+ * Moves the calling process, a warm pipeline's master, into a new cgroup.
+ */
+void cgroup_warm_enter(void);
+
+/**
+ * Makes the cgroup of a warm pipeline the cgroup of the job that took it
+ * over, with the caps of the job's type.
+ *
+ * @param master  The warm pipeline's master.
+ */
+void cgroup_warm_taken(pid_t master, struct job *job);
+
+/**
+ * Removes the cgroup of a warm pipeline whose master has exited unused.  Does
+ * nothing if pid was not a warm master.
+ */
+void cgroup_warm_reaped(pid_t pid);
+
+/**
+ * Moves the calling process into the cgroup of a process group's leader.
+ * Called by the fork server in the stages it starts.
+ */
+void cgroup_join_leader(pid_t leader);
+
+/**
+ * Records what a job's pipeline used, once its master has exited, in
+ * job->cpu_us and job->mem_kb, and removes the job's cgroup.
+ *
+ * @param job  The job.
+ * @param ru   Resource usage of the master as returned by wait4(), used for
+ *             what the cgroup cannot tell.
+ */
+void cgroup_job_ended(struct job *job, const struct rusage *ru);
+
+/**
+ * Reads what a running job's pipeline has used so far.
+ *
+ * @param cpu_us  Set to its CPU time in microseconds.
+ * @param mem_kb  Set to its memory in use (its peak if known), or -1.
+ * @return 0 if successful, -1 if the job has no cgroup.
+ */
+int cgroup_job_usage(struct job *job, long long *cpu_us, long *mem_kb);
+
+/**
+ * Removes a job's cgroup if it is still there.
+ */
+void cgroup_job_remove(struct job *job);
+
+/**
+ * Sets the caps of jobs of an input type, applied from their next dispatch.
+ *
+ * @param mem_mb   Memory limit of the pipeline in MB, 0 for none.
+ * @param cpu_pct  CPU bandwidth of the pipeline in percent of one CPU, 0 for none.
+ * @return the caps that cgroups enforce: bit 0 for memory, bit 1 for CPU.
+ */
+int cgroup_set_caps(struct file_type *type, long mem_mb, int cpu_pct);
+
+/**
+ * Gets the caps of an input type.
+ */
+void cgroup_get_caps(struct file_type *type, long *mem_mb, int *cpu_pct);
+
+/**
+ * Removes the spooler's cgroup and any job cgroups left in it.  Cgroups whose
+ * pipelines are still running are removed by a child once they are empty,
+ * if that happens within CLEANUP_WAIT_S seconds.
+ */
+void cgroup_cleanup(void);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "policy.h"
+
+struct file_type;
+struct conversion;
+
+/*
+ * Spooler-side attributes of conversions.
+ *
+ * CONVERSION objects belong to the conversions module, so anything the spooler
+ * needs to know about how a conversion is run is kept here, keyed by the pair
+ * of types it converts between.  Attributes are reset whenever the conversion
+ * is redefined.
+ */
+
+struct conversion_attrs {
+    int workers;          // > 1: stage is splittable and fans out over this many processes
+    long timeout_ms;      // > 0: longest time the stage may run before the job is killed
+    int pool;             // > 0: persistent converter, with up to this many kept idle
+    long mem_mb;          // estimated memory of each process of the stage, in MB
+    struct sched_policy policy;   // scheduling of the stage's processes
+    double startup_ms;    // measured time to convert a small input
+    double rate;          // measured throughput beyond that, job input bytes per ms; 0 until measured
+};
+
+/**
+ * Returns the attributes record for a conversion between two types, creating
+ * it with default values if it does not exist yet.
+ *
+ * @return the attributes, or NULL if no more records can be allocated.
+ */
+struct conversion_attrs *define_conversion_attrs(struct file_type *from, struct file_type *to);
+
+/**
+ * Returns the attributes record for a conversion between two types, leaving
+ * its values unchanged.
+ *
+ * @return the attributes, or NULL if the conversion was not defined.
+ */
+struct conversion_attrs *find_conversion_attrs(struct file_type *from, struct file_type *to);
+
+/**
+ * Looks up the attributes of a conversion.
+ *
+ * @return the attributes of conv, or a record of default values if none were
+ * declared.  The result must not be modified.
+ */
+const struct conversion_attrs *conversion_attrs(struct conversion *conv);
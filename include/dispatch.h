@@ -3,9 +3,65 @@
 #include <stdio.h>
 #include <time.h>
 
+#include "presi.h"
+
 void dispatch_jobs(void);
 void reap_finished_jobs(void);
-void delete_expired_jobs_if_needed(void);
+
+/**
+ * Sets the policy for jobs whose printer drops the connection mid-job.
+ *
+ * @param max         Number of times such a job is requeued before it is aborted.
+ * @param backoff_ms  Delay before the first requeue; doubled for each further one.
+ * @param checkpoint  If nonzero, a requeued job resumes after the converted output
+ *                    that was already delivered instead of starting over.
+ */
+void set_retry_policy(int max, long backoff_ms, int checkpoint);
+
+/**
+ * Sets when a queued job may preempt a running one to get its printer.  The
+ * running job is stopped, its master giving up the printer connection, and
+ * resumes on a new connection once the urgent job is done.
+ *
+ * @param min_gap      How much higher the queued job's priority must be; 0
+ *                     turns preemption off.
+ * @param min_run_ms   How long a job runs before it may be preempted.
+ * @param max_per_job  How many times one job may be preempted.
+ */
+void set_preempt_policy(int min_gap, long min_run_ms, int max_per_job);
+
+/**
+ * Sets how often running jobs report their progress, as lines
+ * "JOB[<id>]: progress, ..." with the fields of job_progress_eta().  A job
+ * reports only if its pipeline moved data since its last report.
+ *
+ * @param ms  Interval in milliseconds; 0 turns the reports off.
+ */
+void set_progress_interval(long ms);
+
+/**
+ * Sets how long finished and aborted jobs are kept before they are deleted,
+ * for jobs that do not set their own retention.
+ *
+ * @param ms  Retention in milliseconds.
+ */
+void set_job_retention(long ms);
+
+/**
+ * Sets the budget within which queued jobs are dispatched.  A job whose
+ * pipeline does not fit in what running jobs leave of it waits in the queue.
+ *
+ * @param procs   Conversion processes that may run at once, 0 for one per online CPU.
+ * @param mem_mb  Total declared memory of the running pipelines, 0 for no limit.
+ */
+void set_resource_limits(int procs, long mem_mb);
+
+/**
+ * Prints the resources held by dispatched jobs against the current limits.
+ *
+ * @param out  Output stream.
+ */
+void print_resource_usage(FILE *out);
 
 char *format_time(time_t t, char *buf, size_t buf_size);
 
@@ -13,3 +69,87 @@ char *format_time(time_t t, char *buf, size_t buf_size);
 struct job;
 
 void print_job_debug(struct job *job, const char *printer_name);
+
+/**
+ * Looks up a job by its id.
+ *
+ * @param id  The job id assigned by the print command.
+ * @return the job, or NULL if there is no job with that id.
+ */
+struct job *find_job(int id);
+
+/**
+ * Changes the status of jobs[j], keeping the statistics up to date.  All
+ * status changes after a job is created go through here.
+ */
+void set_job_status(int j, JOB_STATUS status);
+
+/**
+ * Looks up a printer by name.
+ *
+ * @param name  The name given to the printer command.
+ * @return the printer's index in printers[], or -1 if there is no such printer.
+ */
+int find_printer(const char *name);
+
+struct file_type;
+
+/**
+ * Defines a printer, disabled, in the first free slot of printers[].  Slots
+ * of removed printers are reused, so printers are never renumbered.
+ *
+ * @param name  Name of the printer.
+ * @param type  Type of file it prints.
+ * @return the printer's index, or -1 if the name is taken or there is no
+ * free slot.
+ */
+int define_printer(char *name, struct file_type *type);
+
+/**
+ * Removes a printer that is not printing.  Queued jobs lose it from their
+ * eligible printers, and its slot becomes free (its name is NULL).
+ *
+ * @param p  Index of the printer.
+ * @return 0 if successful, -1 if the printer is still printing a job.
+ */
+int remove_printer(int p);
+
+/**
+ * Schedules deletion of a job that has just finished or been aborted, after
+ * its own retention or the global one.  A deletion already scheduled for the
+ * job is replaced.
+ *
+ * @param job  The job.
+ */
+void schedule_job_deletion(struct job *job);
+
+/**
+ * Works out the expected run time of every job in milliseconds: for a
+ * dispatched job, as predicted when it was dispatched, for a queued one, on
+ * the fastest eligible printer, enabled or not; -1 if there is no estimate.
+ *
+ * @param est_ms  Set to the run times, indexed like jobs[].
+ */
+void expected_jobs_ms(long long *est_ms);
+
+/**
+ * Reports how far a dispatched job has got.
+ *
+ * @param consumed   Set to the bytes of its input its pipeline has read.
+ * @param delivered  Set to the converted bytes written to its printer.
+ * @return the expected time until it finishes in milliseconds, from the
+ * rate at which its input is consumed, or from the estimate made at dispatch
+ * while that is unknown; -1 if there is neither.
+ */
+long long job_progress_eta(struct job *job, long long *consumed, long long *delivered);
+
+/**
+ * Adds a job to the queue, with default options, and reports it.  The job
+ * is not dispatched.
+ *
+ * @param file      The file to print.
+ * @param type      Its type.
+ * @param eligible  Bitmap of the printers that may print it.
+ * @return the job, or NULL if the job table is full or memory ran out.
+ */
+struct job *create_job(char *file, struct file_type *type, unsigned int eligible);
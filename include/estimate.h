@@ -0,0 +1,50 @@
+#pragma once
+
+#include "globals.h"
+
+struct conversion;
+
+/*
+ * Run-time estimates of jobs.
+ *
+ * A job's run time on a printer is predicted as the printer's set-up time
+ * plus the time its data takes to flow through the conversion path and into
+ * the printer.  Each stage, and the printer itself, is modelled by a
+ * start-up time, learned from small inputs, and a throughput, learned from
+ * larger ones; since they all run concurrently, the job takes as long as the
+ * slowest of them.  All of these are learned from the jobs that finish, as
+ * exponentially weighted moving averages; until a conversion or printer has
+ * been measured, a default set-up time and throughput are assumed.
+ */
+
+/**
+ * @return the size in bytes of a job's input: its byte range, or its file.
+ */
+off_t job_input_bytes(struct job *job);
+
+/**
+ * Predicts how long a job would run on a printer.
+ *
+ * @param job   The job.
+ * @param p     The printer.
+ * @param path  NULL-terminated conversion path from the job's type to the
+ *              printer's type.
+ * @return the expected run time in milliseconds.
+ */
+long long estimate_job_ms(struct job *job, int p, struct conversion **path);
+
+/**
+ * Updates the stage and printer estimates from a job that finished.
+ *
+ * @param job     The job; its progress record holds the exit times of its
+ *                stages and the bytes sent to the printer.
+ * @param p       The printer that printed it.
+ * @param path    Its conversion path.
+ * @param run_ms  How long it ran, not counting pauses.
+ */
+void learn_job_ms(struct job *job, int p, struct conversion **path, long long run_ms);
+
+/**
+ * Forgets what was learned about a removed printer.
+ */
+void estimate_forget_printer(int p);
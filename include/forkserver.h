@@ -0,0 +1,51 @@
+#pragma once
+
+#include <unistd.h>
+
+struct sched_policy;
+
+/*
+ * Fork server for conversion stages.
+ *
+ * When PRESI_FORKSERVER is set in the environment, a helper process is
+ * forked at start-up, while the spooler's address space is still small, and
+ * job masters ask it to start their conversion stages instead of forking
+ * themselves.  A spawned stage joins the job's process group, so pausing and
+ * cancelling a job works as before, but it is a child of the fork server;
+ * the server reports its pid and, later, its exit status back to the master.
+ *
+ * The fork server also keeps the pools of long-lived converters used by
+ * persistent conversions (see run_persistent_stage()): a persistent stage is
+ * a small adapter process connected to an idle converter of the pool, and
+ * the converter is returned to the pool when the adapter succeeds.
+ */
+
+/**
+ * Starts the fork server if PRESI_FORKSERVER is set.  Must be called once,
+ * before any jobs are dispatched.
+ */
+void forkserver_init(void);
+
+/**
+ * @return nonzero if stages are started through the fork server.
+ */
+int forkserver_enabled(void);
+
+/**
+ * Asks the fork server to start a conversion stage.
+ *
+ * @param cmd_and_args  NULL-terminated command of the conversion.
+ * @param workers       Fan-out of a splittable stage, 1 otherwise.
+ * @param pool          For a persistent conversion, the number of idle
+ *                      converters to keep; 0 otherwise.
+ * @param policy        Scheduling policy of the stage.
+ * @param pgid          Process group the stage joins.
+ * @param in_fd         The stage's standard input.
+ * @param out_fd        The stage's standard output.
+ * @param status_fd     Set to a descriptor from which the stage's wait status
+ *                      (an int) can be read once it has exited.
+ * @return the pid of the stage, or -1 if it could not be started.
+ */
+pid_t forkserver_spawn(char **cmd_and_args, int workers, int pool,
+                       const struct sched_policy *policy, pid_t pgid,
+                       int in_fd, int out_fd, int *status_fd);
@@ -5,22 +5,66 @@
 
 struct file_type;
 typedef struct file_type FILE_TYPE;
+struct job_progress;
+struct timer;
 
 struct printer {
-    char *name;
+    char *name;          // interned
     FILE_TYPE *type;
     PRINTER_STATUS status;
     pid_t current_pid;
+    int connect_flags;   // PRINTER_DELAYS, PRINTER_FLAKY: faults injected by the daemon
+};
+
+/*
+ * What the scheduler tests for every queued job on every pass is not part of
+ * struct job: a job's status, eligible printers and process group, and the
+ * few fields of struct job_sched that pick and order the candidates, live in
+ * the parallel arrays below, indexed like jobs[].  The rest of a job is in
+ * struct job, ordered from the fields that dispatch reads once it has chosen
+ * a job to the ones only used while the job runs.
+ */
+struct job_sched {
+    long long queued_ms;          // monotonic time the job was last queued
+    struct timer *retry_timer;    // pending backoff before the job may be dispatched
+    int chunks_left;              // for a split job: chunks that have not completed
+    int priority;                 // higher goes first, and may preempt lower
+    unsigned int fanout;          // printers that all take the job, 0: any eligible one
 };
 
 struct job {
     int id;
-    char *file;
     FILE_TYPE *type;
-    JOB_STATUS status;
-    char **pipeline;
-    pid_t pgid;
-    unsigned int eligible;
+    unsigned int failed_printers;     // printers that dropped this job
+    int copies;                       // copies printed on each of the job's printers
+    int preemptions;                  // times the job gave its printer to a more urgent one
+    int preempted_on;                 // printer the job is stopped to make way on, or -1
+    off_t input_bytes;                // size of the input, 0 until known
+    long long est_ms;                 // expected run time on the printer it was dispatched to
+    int procs;                        // conversion processes admitted at dispatch
+    long mem_mb;                      // pipeline memory admitted at dispatch
+    long long cpu_us;                 // CPU time its pipelines used, -1 until one has ended
+    long mem_kb;                      // largest memory peak of its pipelines, or -1
+    int parent;          // id of the split job this chunk belongs to, or -1
+    int global_id;       // sharded: the coordinator's id for the job (or its parent), or -1
+    int chunks_failed;   // for a split job: chunks that were aborted
+    char *file;          // interned
+    off_t offset;        // byte range of file to print; length < 0 means to EOF
+    off_t length;
+    int owns_file;       // file is a splitter output, unlinked with the job
+    int retries;         // times the job was requeued after a printer disconnect
+    off_t checkpoint;    // converted output already delivered before the last disconnect
+    FILE_TYPE *checkpoint_type;       // type of the printer that output was converted for
+    struct job_progress *progress;    // shared with the job's master process
+    long long reported_bytes;         // consumed + delivered at the last progress event
+    long timeout_ms;                  // > 0: longest time the job may run
+    struct timer *watchdog;           // next runtime check of a running job
+    int terminating;                  // watchdog sent SIGTERM; SIGKILL follows
+    long long started_ms;             // monotonic time of dispatch
+    long long paused_at_ms;           // start of the current pause, 0 if not paused
+    long long paused_total_ms;        // time spent paused since dispatch
+    long retention_ms;                // < 0: use the global retention
+    struct timer *expiry;             // pending deletion of a finished or aborted job
     time_t status_changed_at;
 };
 
@@ -30,4 +74,13 @@ extern int num_printers;
 extern struct job jobs[MAX_JOBS];
 extern int num_jobs;
 
+extern JOB_STATUS job_status[MAX_JOBS];
+extern unsigned int job_eligible[MAX_JOBS];
+extern pid_t job_pgid[MAX_JOBS];
+extern struct job_sched job_sched[MAX_JOBS];
+
+static inline int job_index(const struct job *job) {
+    return job - jobs;
+}
+
 extern int next_job_id;
@@ -0,0 +1,59 @@
+#pragma once
+
+struct file_type;
+struct conversion;
+
+/*
+ * Registry of the conversion graph and cache of conversion paths.
+ *
+ * The conversions module cannot enumerate the types and conversions it
+ * holds, so the spooler records each one it defines here (which is what
+ * lets it save them in a snapshot).  Paths between types are searched for
+ * once and cached; defining a conversion clears the cache.
+ */
+
+/**
+ * Records a newly defined type.
+ */
+void graph_add_type(struct file_type *type);
+
+/**
+ * Looks up a recorded type by name, through a hash index.
+ *
+ * @return the type, or NULL if no type of that name was recorded.
+ */
+struct file_type *graph_find_type(const char *name);
+
+/**
+ * Records a newly defined conversion, replacing any earlier one between the
+ * same types, and clears the path cache.
+ */
+void graph_add_conversion(struct conversion *conv);
+
+/**
+ * @param types  Set to the recorded types, in order of definition.
+ * @return the number of types.
+ */
+int graph_types(struct file_type ***types);
+
+/**
+ * @param convs  Set to the recorded conversions, in order of definition.
+ * @return the number of conversions.
+ */
+int graph_conversions(struct conversion ***convs);
+
+/**
+ * Finds a conversion path, like find_conversion_path(), but from the cache
+ * when possible.
+ *
+ * @return a NULL-terminated array the caller must free, or NULL if there
+ * is no path.
+ */
+struct conversion **find_route(struct file_type *from, struct file_type *to);
+
+/**
+ * Fills the cache entry for a pair of types with a path known in advance.
+ *
+ * @param path  NULL-terminated path, or NULL if there is none; it is copied.
+ */
+void set_route(struct file_type *from, struct file_type *to, struct conversion **path);
@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * Interned strings.
+ *
+ * Printer names and job file names are stored once, however many printers
+ * or jobs refer to them, and two interned strings are equal exactly when
+ * their pointers are.  Strings are reference counted: every intern() is
+ * matched by an intern_release().  Interned strings must not be modified.
+ */
+
+/**
+ * @param s  String to intern.
+ * @return the interned copy of s, or NULL if out of memory.
+ */
+char *intern(const char *s);
+
+/**
+ * Looks up a string without interning it.
+ *
+ * @param s  String to look up.
+ * @return the interned copy of s, or NULL if s is not interned.
+ */
+char *intern_lookup(const char *s);
+
+/**
+ * Drops a reference to an interned string, freeing it with the last one.
+ *
+ * @param s  An interned string, or NULL.
+ */
+void intern_release(char *s);
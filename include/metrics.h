@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * Export of the statistics (see stats.h) in the Prometheus text format.
+ *
+ * Metrics can be served on a Unix domain socket, answering each connection
+ * with an HTTP/1.0 response holding the current metrics and closing it, and
+ * can be written periodically to a file (replaced atomically, as the node
+ * exporter's textfile collector expects).  The socket raises SIGIO, and
+ * connections are answered from the signal hook, between commands.
+ */
+
+/**
+ * Serves metrics on a Unix domain socket, replacing any socket already served.
+ *
+ * @param path  Path of the socket; a stale socket file there is removed.
+ * @return 0 if successful, -1 otherwise.
+ */
+int metrics_serve(const char *path);
+
+/**
+ * Writes metrics to a file now and then every interval_ms, replacing any
+ * file already being written.
+ *
+ * @return 0 if the first write succeeded, -1 otherwise.
+ */
+int metrics_write_file(const char *path, long interval_ms);
+
+/**
+ * Answers pending connections on the metrics socket.  Called on SIGIO.
+ */
+void metrics_poll(void);
+
+/**
+ * Stops serving and writing metrics, removing the socket file.
+ */
+void metrics_stop(void);
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "globals.h"
+
+struct conversion;
+struct sched_policy;
+
+/* Exit status of a master whose printer connection failed while printing. */
+#define PIPELINE_DISCONNECTED 3
+
+/*
+ * Counters shared (through an anonymous shared mapping) between the spooler
+ * and a job's master process.
+ */
+struct job_progress {
+    volatile long long delivered;   // offset in the converted output written to the printer
+    volatile long long consumed;    // bytes of the job's input read by the pipeline
+    volatile unsigned int stages_done;   // bit i set once conversion stage i has exited
+    volatile long long stage_done_ms[32];   // monotonic time at which stage i exited
+    volatile unsigned int dests_failed;   // copies and fan-out: printers whose connection failed
+    volatile int copies_done[32];   // copies and fan-out: copies delivered to printer i
+};
+
+/**
+ * Allocates the shared progress record for a job.
+ *
+ * @return the record, or NULL if the mapping failed.
+ */
+struct job_progress *job_progress_alloc(void);
+
+/**
+ * Releases a progress record.  Does nothing if p is NULL.
+ */
+void job_progress_free(struct job_progress *p);
+
+/**
+ * Runs a job's conversion pipeline.  Called in the job's master process right
+ * after it has made itself the leader of a new process group; it never returns.
+ *
+ * The master forks one process per conversion stage (or a fan of worker
+ * processes for stages declared splittable) and connects them with pipes from
+ * the job's file.  The master itself relays the final output to the printer,
+ * skipping the first job->checkpoint bytes and counting delivered bytes in
+ * job->progress, along with the input bytes the first stage has consumed.  It exits with status 0 if every stage succeeded,
+ * PIPELINE_DISCONNECTED if writing to the printer failed, 1 otherwise.
+ *
+ * On SIGTSTP (the job is preempted) the master closes the printer connection
+ * and stops; once continued, it reconnects and relays the rest of the output.
+ *
+ * @param job         The job being printed.
+ * @param path        NULL-terminated conversion path from the job's type to the
+ *                    printer's type.
+ * @param printer_fd  Connection to the printer.
+ * @param p           Index of the printer, to reconnect to after a preemption.
+ * @param policy      Scheduling policy of the printer, merged with that of each
+ *                    conversion for its stage.
+ */
+void run_pipeline(struct job *job, struct conversion **path, int printer_fd, int p,
+                  const struct sched_policy *policy);
+
+/**
+ * Runs the pipeline of a job with copies or fan-out, like run_pipeline() but
+ * converting the file once for every copy on every destination printer.
+ *
+ * The master writes each block of the converted output to all destinations
+ * in turn, dropping any whose connection fails, and keeps it in a temporary
+ * file when more than one copy is wanted.  Once the output is complete, one
+ * process per destination reconnects for each further copy and sends it from
+ * that file.  Copies delivered and failed destinations are recorded in
+ * job->progress.  The master exits with status 0 if every copy reached every
+ * destination, 1 otherwise; the job is not requeued.
+ *
+ * @param job          The job being printed; job->copies copies go to each
+ *                     destination.
+ * @param path         NULL-terminated conversion path to the printers' type,
+ *                     which all destinations share.
+ * @param printer_fds  Connections to the destination printers.
+ * @param dests        Index in printers[] of each destination.
+ * @param num_dests    Number of destinations.
+ * @param policy       Scheduling policy of the first destination.
+ */
+void run_fanout_pipeline(struct job *job, struct conversion **path, const int *printer_fds,
+                         const int *dests, int num_dests, const struct sched_policy *policy);
+
+/**
+ * Selects how job files are read into the first stage of their pipelines.
+ * By default the first stage reads the file itself; with io_uring, a feeder
+ * process reads it with several large reads in flight (falling back to plain
+ * reads where io_uring is not available) and writes it into a pipe.
+ *
+ * @param uring  Nonzero to feed input through io_uring.
+ */
+void set_input_feeder(int uring);
+
+/**
+ * @return nonzero if input is fed through io_uring.
+ */
+int input_feeder_uses_uring(void);
+
+/**
+ * Runs a pre-started ("warm") pipeline.  Called in a master process that has
+ * made itself the leader of a new process group; it never returns.
+ *
+ * The master connects to the printer (starting its daemon if necessary) and
+ * forks the conversion stages of path, which then wait for input.  It then
+ * blocks until send_pipeline_order() names the job to print, feeds the job's
+ * file to the first stage and finishes like run_pipeline().  A job of another
+ * type keeps the connection but gets its own stages.  If order_fd is closed
+ * without an order, the pipeline is torn down and the master exits with
+ * status 0.
+ *
+ * @param type_name     Input type the pipeline is prepared for.
+ * @param path          NULL-terminated conversion path from that type to the
+ *                      printer's type.
+ * @param printer_name  Printer to connect to.
+ * @param printer_type  The printer's file type.
+ * @param connect_flags Flags for presi_connect_to_printer().
+ * @param order_fd      Read end of the pipe the order arrives on.
+ * @param progress      Progress record of the job that will be printed.
+ * @param policy        Scheduling policy of the printer.
+ */
+void run_warm_pipeline(char *type_name, struct conversion **path, char *printer_name,
+                       char *printer_type, int connect_flags, int order_fd,
+                       struct job_progress *progress, const struct sched_policy *policy);
+
+/**
+ * Hands a job to a warm pipeline.
+ *
+ * @param order_fd  Write end of the warm pipeline's order pipe.
+ * @param job       The job to print; its file, byte range and checkpoint are sent.
+ * @return 0 on success, -1 if the order could not be sent.
+ */
+int send_pipeline_order(int order_fd, struct job *job);
+
+/**
+ * Runs a splittable conversion stage over standard input and output by
+ * fanning it out across up to `workers` processes.  Input is consumed in
+ * rounds, cut on line boundaries so that no worker sees a partial line, and
+ * the outputs are written in input order.  Never returns.
+ *
+ * @param cmd_and_args  NULL-terminated command of the conversion.
+ * @param workers       Maximum number of worker processes per round.
+ */
+void run_fanned_stage(char **cmd_and_args, int workers);
+
+/**
+ * Runs a persistent conversion stage: copies standard input to a long-lived
+ * converter and the converted document back to standard output.
+ *
+ * A persistent converter handles one document after another.  Both ways,
+ * a document travels as frames, each a decimal length on a line of its own
+ * followed by that many bytes, and ends with a frame of length 0.
+ *
+ * @param to_conv    The converter's standard input.
+ * @param from_conv  The converter's standard output.
+ * @return 0 if the whole document was converted and the converter is ready
+ * for the next one, -1 otherwise.
+ */
+int run_persistent_stage(int to_conv, int from_conv);
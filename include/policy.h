@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ * Scheduling policies of conversion stages.
+ *
+ * A policy may restrict the CPUs a stage runs on, lower (or, with privileges,
+ * raise) its nice value and set its I/O priority.  Policies are declared per
+ * printer, for every stage of the jobs it prints, and per conversion; for
+ * each attribute, the conversion's setting wins over the printer's.  They are
+ * applied in each stage process before the converter is executed, and are
+ * inherited by the workers of a fanned stage.  Attributes that cannot be
+ * applied (e.g. a negative nice value without privileges) are ignored.
+ */
+
+#define POLICY_CPUS    0x1
+#define POLICY_NICE    0x2
+#define POLICY_IOPRIO  0x4
+
+struct sched_policy {
+    int set;                   // POLICY_* attributes that are declared
+    unsigned long long cpus;   // CPUs the stage may run on, one bit per CPU
+    int nice;                  // increment of the nice value
+    int ioprio;                // I/O priority, encoded as for ioprio_set(2)
+};
+
+/**
+ * Parses a policy option into a policy.
+ *
+ * @param policy  The policy to update.
+ * @param option  "-c" with a CPU list such as "0-3,6", "-n" with a nice
+ *                increment, or "-i" with an I/O class ("rt", "be" or
+ *                "idle") optionally followed by ":<level>" (0 to 7).
+ * @param value   The option's value.
+ * @return 0 if successful, -1 if the option or its value is invalid.
+ */
+int parse_policy_option(struct sched_policy *policy, const char *option, const char *value);
+
+/**
+ * @return the policy declared for printer p; it may be modified.
+ */
+struct sched_policy *printer_policy(int p);
+
+/**
+ * Combines a printer policy with a conversion policy.
+ *
+ * @param printer     Policy of the printer, or NULL.
+ * @param conversion  Policy of the conversion, or NULL.
+ * @return the attributes of both, the conversion's taking precedence.
+ */
+struct sched_policy merge_policies(const struct sched_policy *printer,
+                                   const struct sched_policy *conversion);
+
+/**
+ * Applies a policy to the calling process.
+ *
+ * @param policy  The policy.
+ */
+void apply_policy(const struct sched_policy *policy);
+
+/**
+ * Formats the declared attributes of a policy, e.g. "cpus=0-1, nice=5".
+ *
+ * @return buf, which holds an empty string if nothing is declared.
+ */
+char *format_policy(const struct sched_policy *policy, char *buf, int buf_size);
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Hash indexes from names to small integers, used to find printers and
+ * types by name in constant time.
+ *
+ * An index does not copy the names: each name must stay valid, unchanged,
+ * for as long as it is in the index (printer names are interned, type names
+ * belong to the conversions module).
+ */
+
+struct registry;
+
+/**
+ * @return a new, empty index, or NULL if out of memory.
+ */
+struct registry *registry_new(void);
+
+/**
+ * Frees an index (but not the names in it).
+ */
+void registry_free(struct registry *reg);
+
+/**
+ * Adds a name, or changes the value of a name already in the index.
+ *
+ * @return 0 if successful, -1 if out of memory.
+ */
+int registry_put(struct registry *reg, const char *name, int value);
+
+/**
+ * @return the value of a name, or -1 if the name is not in the index.
+ */
+int registry_get(const struct registry *reg, const char *name);
+
+/**
+ * Removes a name, if it is in the index.
+ */
+void registry_remove(struct registry *reg, const char *name);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdio.h>
+
+/*
+ * Sharded deployment mode.
+ *
+ * When the environment variable PRESI_SHARDS is set to n > 1, the first call to
+ * run_cli() turns this process into a coordinator and forks n shard instances of
+ * the spooler, each connected to the coordinator by a Unix-domain socket pair.
+ * Every shard owns a partition of the printers and runs its own dispatch loop.
+ * The coordinator replicates type and conversion definitions to all shards and
+ * routes each "print" command to the least loaded shard that owns an eligible
+ * printer.  Shards push their load (number of unfinished jobs) back over the
+ * same socket.
+ */
+
+#define MAX_SHARDS 16
+
+/**
+ * Starts the shards requested through PRESI_SHARDS.
+ *
+ * In the coordinator this returns the number of shards started (0 if sharding
+ * is not enabled).  In a shard this never returns: the shard serves commands
+ * from the coordinator until it is told to quit, then exits.
+ *
+ * @param out  The output stream handed to run_cli().
+ */
+int shard_init(FILE *out);
+
+/**
+ * @return nonzero if this process is a coordinator with running shards.
+ */
+int shard_is_coordinator(void);
+
+/**
+ * Handles a command line in the coordinator: definitions are replicated,
+ * printers are assigned to shards, and job commands are routed.
+ *
+ * @param line  The raw input line from the user.
+ * @param out   Output stream for user-visible responses.
+ */
+void handle_coordinator_command(char *line, FILE *out);
+
+/**
+ * Drains pending load reports from the shards.  Called from the signal hook
+ * when SIGIO indicates that a shard socket is readable.
+ */
+void shard_poll(void);
+
+/**
+ * Tells every shard to quit and waits for them to exit.
+ */
+void shard_fini(void);
@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * Binary snapshots of the spooler's configuration.
+ *
+ * A snapshot holds the file types, the conversions with their attributes
+ * (including the throughputs measured so far), the printers with their
+ * policies and whether they are enabled, and the conversion path from every
+ * type to every printer's type.  Loading one maps the file and defines
+ * everything directly, without parsing commands or searching for paths.
+ * Snapshots are specific to the machine and build that wrote them.
+ */
+
+/**
+ * Writes a snapshot of the current configuration.
+ *
+ * @param path  File to write; it is replaced atomically.
+ * @return 0 if successful, -1 otherwise.
+ */
+int save_snapshot(const char *path);
+
+/**
+ * Loads a snapshot.  Types and conversions are defined (conversions replace
+ * existing ones), and printers are added unless one with the same name
+ * already exists.
+ *
+ * @param path  File to load.
+ * @return 0 if successful, -1 if the file could not be read or is not a
+ * valid snapshot, in which case nothing was defined.
+ */
+int load_snapshot(const char *path);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "globals.h"
+
+/*
+ * Splitting of large jobs into chunks that print in parallel.
+ *
+ * A job printed with "print -c <n>" becomes a parent job whose work is done by
+ * up to n chunk jobs.  Chunks are ordinary jobs (so any idle eligible printer
+ * can take them) that print either a byte range of the parent's file or, when
+ * a splitter is declared for the file's type, one of the documents produced by
+ * the splitter.  The parent finishes when all of its chunks have finished, and
+ * is aborted if any chunk is aborted.
+ */
+
+/**
+ * Declares a splitter command for a file type.
+ *
+ * The splitter reads the document on standard input and is invoked with two
+ * extra arguments, the requested number of chunks n and an output prefix in a
+ * directory of its own.  It must write up to n standalone documents of the
+ * same type to the files <prefix>.0, <prefix>.1, ...  and exit with status 0.
+ *
+ * @param type_name     The file type the splitter applies to.
+ * @param cmd_and_args  NULL-terminated command, or NULL to remove the splitter.
+ * @return 0 if successful, -1 otherwise.
+ */
+int define_splitter(char *type_name, char **cmd_and_args);
+
+/**
+ * Splits a freshly created job into chunk jobs.  With a splitter, the chunks
+ * are created once it exits, and the job is not dispatched until then; if
+ * the splitter fails, the job is split by byte ranges instead.
+ *
+ * @param parent  The job to split; it must still be in the JOB_CREATED state.
+ * @param chunks  The requested number of chunks.
+ * @return the number of chunk jobs created, 0 if a splitter is producing them,
+ * or -1 if the job could not be split (in which case it is left to print as a
+ * single job).
+ */
+int split_job(struct job *parent, int chunks);
+
+/**
+ * Creates the chunks of a job from the output of its splitter, once the
+ * splitter has exited.
+ *
+ * @param pid     A child that was reaped.
+ * @param status  Its wait status.
+ * @return nonzero if pid was a splitter.
+ */
+int split_reaped(pid_t pid, int status);
+
+/**
+ * Removes a chunk's splitter output, and the splitter's directory with the
+ * last one.
+ */
+void split_remove_output(struct job *chunk);
+
+/**
+ * Records that a chunk job has started running on a printer.
+ */
+void split_chunk_started(struct job *chunk);
+
+/**
+ * Records that a chunk job has reached a final state, completing its parent
+ * once every chunk is done.
+ */
+void split_chunk_done(struct job *chunk);
+
+/**
+ * Cancels every unfinished chunk of a split job.
+ */
+void split_cancel(struct job *parent);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdio.h>
+
+/*
+ * Utilization statistics for the top command and the metrics export.
+ *
+ * Everything here is kept up to date as jobs and printers change state, so
+ * that a report never rescans the job table:
+ *
+ *   - how long each printer was busy, in 5-second buckets covering the last
+ *     15 minutes, from which utilization over 1, 5 and 15 minutes follows;
+ *   - the number of jobs in each status, and of queued jobs per input type;
+ *   - histograms of how long jobs waited in the queue and how long they ran;
+ *   - the conversion processes admitted for dispatched jobs;
+ *   - totals of jobs created, finished and aborted, and of printer busy
+ *     time, and per-conversion histograms of stage run times;
+ *   - the CPU time and largest memory peak of ended jobs per input type.
+ *
+ * Updates and reports all happen on the main thread, between commands or
+ * from the signal hook, so none of this needs locking.
+ */
+
+struct file_type;
+struct conversion;
+
+/**
+ * Records a change of a job's status.  A new job changes from JOB_DELETED,
+ * and a job being deleted changes to it.
+ */
+void stats_job_status(struct file_type *type, int from, int to);
+
+/**
+ * Records what an ended job's pipelines used: cpu_us microseconds of CPU
+ * time and a memory peak of mem_kb, each negative if unknown.
+ */
+void stats_job_resources(struct file_type *type, long long cpu_us, long mem_kb);
+
+/**
+ * Records that a printer was defined, forgetting what was recorded for an
+ * earlier printer in the same slot.
+ */
+void stats_printer_defined(int p);
+
+/**
+ * Records that a printer started (busy nonzero) or stopped printing a job.
+ */
+void stats_printer_busy(int p, int busy);
+
+/**
+ * Records that a job was dispatched after waiting wait_ms in the queue, and
+ * admitted with procs conversion processes.
+ */
+void stats_job_started(long long wait_ms, int procs);
+
+/**
+ * Records that a dispatched job's processes are gone; run_ms is how long it
+ * ran if it finished, or -1 if it did not.
+ */
+void stats_job_ended(long long run_ms, int procs);
+
+/**
+ * Records how long after its job started a conversion stage exited.
+ */
+void stats_conversion_ms(struct conversion *conv, long long ms);
+
+/**
+ * Writes the report shown by the top command.
+ */
+void stats_report(FILE *out);
+
+/**
+ * Writes the statistics in the Prometheus text exposition format.
+ */
+void stats_export(FILE *out);
@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+ * One-shot timers driven from the event loop.
+ *
+ * sf_readline() only waits on standard input, so timers cannot be delivered
+ * through a descriptor.  Instead the interval timer (ITIMER_REAL) is armed for
+ * the earliest deadline; SIGALRM just sets a flag, and the signal hook calls
+ * timers_run() to invoke the callbacks that are due, outside of signal context.
+ */
+
+struct timer;
+
+/*
+ * Type of a timer callback.  The argument is the value given to timer_add(),
+ * typically a job id, since job table entries move when jobs are deleted.
+ */
+typedef void timer_func_t(int arg);
+
+/**
+ * Schedules a callback.
+ *
+ * @param ms    Delay in milliseconds from now.
+ * @param func  Function to call when the timer expires.
+ * @param arg   Argument passed to func.
+ * @return a handle that can be passed to timer_cancel() until the timer has
+ * fired (it is invalid once func has been called), or NULL if the timer could
+ * not be allocated.
+ */
+struct timer *timer_add(long ms, timer_func_t *func, int arg);
+
+/**
+ * Cancels a pending timer.  Does nothing if t is NULL.
+ */
+void timer_cancel(struct timer *t);
+
+/**
+ * Runs the callbacks of all expired timers and re-arms the interval timer for
+ * the next pending one.
+ */
+void timers_run(void);
+
+/**
+ * @return the current time of the monotonic clock in milliseconds.
+ */
+long long timers_now_ms(void);
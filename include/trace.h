@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+ * Trace of job lifecycles in the Chrome trace-event format (a JSON array, as
+ * read by chrome://tracing and Perfetto).
+ *
+ * While a trace is being recorded, every dispatched job appears as a process
+ * named after the job, with these spans (timestamps in microseconds of the
+ * monotonic clock):
+ *
+ *   - "queued", from when the job was queued to its dispatch, and "connect",
+ *     the connection to the printer (absent when a warm pipeline took it);
+ *   - one row per conversion stage, from dispatch until the stage exited;
+ *   - "write", the master relaying output to the printer, until it exited;
+ *   - "reap", an instant event when the spooler collected the master, with
+ *     how the job ended.
+ *
+ * Events are kept in memory as they happen and written out from a timer,
+ * between commands, so that recording one costs no I/O.
+ */
+
+struct job;
+
+/**
+ * Starts recording a trace to a file, ending any trace already recorded.
+ *
+ * @return 0 if successful, -1 if the file cannot be created.
+ */
+int trace_start(const char *path);
+
+/**
+ * Writes out the events recorded so far and closes the trace file.  Does
+ * nothing if no trace is being recorded.
+ */
+void trace_stop(void);
+
+/**
+ * @return nonzero if a trace is being recorded.
+ */
+int trace_active(void);
+
+/**
+ * @return the monotonic time in microseconds, the clock of trace events.
+ */
+long long trace_now_us(void);
+
+/**
+ * Records the dispatch of a job.  connect_us and connected_us bound the
+ * connection to the printer, both 0 if a warm pipeline took it.
+ */
+void trace_job_started(struct job *job, long long connect_us, long long connected_us);
+
+/**
+ * Records the end of a job's master on printer p, with its wait status.
+ * Called before the printer is released.
+ */
+void trace_job_ended(struct job *job, int p, int status);
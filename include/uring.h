@@ -0,0 +1,31 @@
+#pragma once
+
+#include <sys/types.h>
+
+/*
+ * Reading job files through io_uring.
+ *
+ * The ring is driven with the raw io_uring_setup(2) and io_uring_enter(2)
+ * system calls, so no library is needed.  Several large reads are kept in
+ * flight at once, which lets the block layer merge and schedule them while
+ * the pipeline consumes the data already read, instead of issuing one small
+ * blocking read at a time.
+ */
+
+/* Returned by uring_copy() when no data was moved and plain reads should be used. */
+#define URING_UNAVAILABLE (-2)
+
+/**
+ * Copies part of a file to a descriptor, reading through an io_uring.
+ *
+ * @param in_fd   The file, which must support positioned reads.
+ * @param offset  Where to start reading.
+ * @param length  How many bytes to copy, or -1 to copy up to the end of file.
+ * @param out_fd  Where the data is written, in order.
+ * @param copied  If not NULL, kept up to date with the bytes written so far.
+ * @return 0 on success, URING_UNAVAILABLE if io_uring cannot be used (e.g.
+ * the kernel does not support it or it is disabled) and nothing was written,
+ * -1 on any other error.
+ */
+int uring_copy(int in_fd, off_t offset, off_t length, int out_fd,
+               volatile long long *copied);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <unistd.h>
+
+#include "globals.h"
+
+/*
+ * Pre-started pipelines.
+ *
+ * A printer can hold one warm pipeline: a master process that has already
+ * connected to the printer (starting its daemon if needed) and started the
+ * conversion stages for one input type, waiting to be told which job to
+ * print.  The next job dispatched to the printer takes it over instead of
+ * paying for the connection and, if it has that input type, the process
+ * start-up.  Printers that are kept warm (with the warm command) get a new
+ * warm pipeline, for their most frequently printed input type, whenever they
+ * are left idle.
+ */
+
+/**
+ * Starts a warm pipeline for a printer, replacing any it already has.
+ *
+ * @param p     Index of the printer.
+ * @param type  Input type to prepare the conversion path for, or NULL for the
+ *              type most often printed on the printer so far (the printer's
+ *              own type if it has no history).
+ * @return 0 if successful, -1 if there is no conversion path or the master
+ * could not be started.
+ */
+int warm_printer(int p, FILE_TYPE *type);
+
+/**
+ * Discards a printer's warm pipeline, if it has one, so that its connection
+ * is given up; a printer kept warm gets a new one once it is idle again.
+ */
+void warm_discard(int p);
+
+/**
+ * Discards a removed printer's warm pipeline and what was learned about it.
+ */
+void warm_forget_printer(int p);
+
+/**
+ * Sets whether a printer is re-warmed whenever it is left idle.  Turning it
+ * off discards the printer's warm pipeline.
+ *
+ * @param p   Index of the printer.
+ * @param on  Nonzero to keep the printer warm.
+ */
+void warm_keep(int p, int on);
+
+/**
+ * @return nonzero if the printer is re-warmed whenever it is left idle.
+ */
+int warm_kept(int p);
+
+/**
+ * Hands a job to the printer's warm pipeline, if it has one.  A pipeline
+ * prepared for another input type restarts its stages for the job's type but
+ * keeps its printer connection.
+ *
+ * @param p    Index of the printer the job is dispatched to.
+ * @param job  The job; on success its progress record is replaced by the
+ *             one the warm pipeline reports to.
+ * @return the pid (and process group) of the master now running the job, or
+ * 0 if the job must be started the normal way.
+ */
+pid_t warm_take(int p, struct job *job);
+
+/**
+ * Records that a job of the given type was dispatched to a printer.
+ */
+void warm_note(int p, FILE_TYPE *type);
+
+/**
+ * Starts warm pipelines on idle printers that are kept warm and have none.
+ */
+void warm_idle_printers(void);
+
+/**
+ * Forgets a warm pipeline whose master has exited.
+ *
+ * @param pid  Process that was reaped.
+ * @return 1 if pid was a warm master, 0 otherwise.
+ */
+int warm_reaped(pid_t pid);
+
+/**
+ * Closes the warm pipelines' order pipes in a newly forked process that does
+ * not exec, so that discarding a warm pipeline is not delayed by it.
+ */
+void warm_close_inherited(void);
@@ -0,0 +1,276 @@
+/*
+ * Printer simulator: a stand-in for util/printer that speaks the same
+ * protocol, with a configurable speed and failure rate.
+ *
+ * Like util/printer, it runs as a daemon serving one printer: it listens on
+ * spool/<name>.sock, writes its pid to spool/<name>.pid and logs to
+ * spool/<name>.log.  Each connection carries one job: a line naming the
+ * file type, then the data until end of file, saved to
+ * spool/<name>_<type>_<sec>.<usec>.  Connections are served one at a time,
+ * the others waiting in the listen queue, as on a real printer.
+ *
+ * presi only starts util/printer when a printer's socket does not exist, so
+ * a simulator started first takes the printer's place:
+ *
+ *     bin/printer_sim -b 1m -s 200 -n p1 ps
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define SPOOL_DIR "spool"
+#define CHUNK (64 * 1024)
+
+static char *name;
+static char *type;
+static char pid_path[256], sock_path[256];
+
+static long bandwidth = 0;       // bytes per second, 0: unlimited
+static long latency_ms = 0;      // before each chunk is taken
+static long setup_ms = 0;        // per job, before its data is taken
+static int fail_pct = 0;         // jobs dropped part way through
+static int discard = 0;          // count the data but do not save it
+static int delays = 0;           // -d: random delays, as util/printer
+static int flaky = 0;            // -f: random disconnects, as util/printer
+
+static void log_msg(const char *fmt, ...) {
+    char stamp[64];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%d %b %Y %T", localtime(&now));
+    printf("%s: ", stamp);
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+    fflush(stdout);
+}
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_us(long long us) {
+    if (us <= 0)
+        return;
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+static void terminate(int sig) {
+    (void)sig;
+    log_msg("Unlink PID file: %s", pid_path);
+    unlink(pid_path);
+    log_msg("Unlink socket: %s", sock_path);
+    unlink(sock_path);
+    log_msg("Terminating");
+    _exit(0);
+}
+
+/*
+ * Parses a size such as 512, 64k or 10m (powers of 1024).
+ */
+static long parse_size(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (*end == 'k' || *end == 'K') v *= 1024, end++;
+    else if (*end == 'm' || *end == 'M') v *= 1024 * 1024, end++;
+    else if (*end == 'g' || *end == 'G') v *= 1024 * 1024 * 1024, end++;
+    return *end == '\0' && v >= 0 ? (long)v : -1;
+}
+
+/*
+ * Reads the file type line, one byte at a time so that none of the data
+ * behind it is consumed.
+ */
+static int read_type(int fd, char *buf, size_t size) {
+    size_t len = 0;
+    char c;
+    while (read(fd, &c, 1) == 1) {
+        if (c == '\n') {
+            buf[len] = '\0';
+            return 0;
+        }
+        if (len + 1 < size)
+            buf[len++] = c;
+    }
+    return -1;
+}
+
+static void serve(int fd) {
+    if (setup_ms > 0)
+        sleep_us(setup_ms * 1000LL);
+    if (delays && random() % 4 == 0) {
+        long sec = 1 + random() % 5;
+        log_msg("Delaying for %ld sec", sec);
+        sleep(sec);
+    }
+
+    char job_type[128];
+    if (read_type(fd, job_type, sizeof(job_type)) < 0) {
+        log_msg("Error receiving file type");
+        return;
+    }
+    log_msg("File type is '%s'", job_type);
+    if (strcmp(job_type, type) != 0) {
+        log_msg("Wrong file type for this printer (received %s, require %s)", job_type, type);
+        return;
+    }
+
+    FILE *out = NULL;
+    if (!discard) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s_%s_%ld.%06ld", SPOOL_DIR, name, type,
+                 (long)tv.tv_sec, (long)tv.tv_usec);
+        log_msg("Saving data to file %s", path);
+        if ((out = fopen(path, "w")) == NULL) {
+            log_msg("Error saving data");
+            return;
+        }
+    }
+
+    // A failing job is dropped after a random part of its first megabyte.
+    long long drop_at = -1;
+    if ((fail_pct > 0 && random() % 100 < fail_pct) || (flaky && random() % 4 == 0))
+        drop_at = random() % (1024 * 1024);
+
+    static char buf[CHUNK];
+    long long total = 0;
+    long long start = now_us();
+    ssize_t n;
+    for (;;) {
+        if (latency_ms > 0)
+            sleep_us(latency_ms * 1000LL);
+        size_t want = sizeof(buf);
+        if (drop_at >= 0 && drop_at - total < (long long)want)
+            want = drop_at - total;
+        if (want == 0) {
+            log_msg("Dropping connection");
+            break;
+        }
+        if ((n = read(fd, buf, want)) <= 0)
+            break;
+        if (out != NULL && fwrite(buf, 1, n, out) != (size_t)n) {
+            log_msg("Error saving data");
+            break;
+        }
+        total += n;
+        // Hold the data back until the printer would have taken it.
+        if (bandwidth > 0)
+            sleep_us(start + total * 1000000 / bandwidth - now_us());
+    }
+    if (out != NULL)
+        fclose(out);
+    log_msg("Bytes received: %lld", total);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d] [-f] [-b <bytes/s>] [-l <ms>] [-s <ms>] [-F <pct>] [-n] <name> <type>\n"
+                    "  -d  random delays, -f  random disconnects (as util/printer)\n"
+                    "  -b  bandwidth, e.g. 512k or 10m (default unlimited)\n"
+                    "  -l  latency before each 64k chunk is taken\n"
+                    "  -s  setup time per job\n"
+                    "  -F  percentage of jobs dropped part way through\n"
+                    "  -n  discard the data instead of writing spool files\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "dfb:l:s:F:n")) != -1) {
+        switch (opt) {
+        case 'd': delays = 1; break;
+        case 'f': flaky = 1; break;
+        case 'b': if ((bandwidth = parse_size(optarg)) < 0) usage(argv[0]); break;
+        case 'l': latency_ms = atol(optarg); break;
+        case 's': setup_ms = atol(optarg); break;
+        case 'F': fail_pct = atoi(optarg); break;
+        case 'n': discard = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2)
+        usage(argv[0]);
+    name = argv[optind];
+    type = argv[optind + 1];
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(sock_path, sizeof(sock_path), "%s/%s.sock", SPOOL_DIR, name);
+    snprintf(pid_path, sizeof(pid_path), "%s/%s.pid", SPOOL_DIR, name);
+    if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Printer name too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, sock_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(sock_path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 16) < 0) {
+        perror("Unable to set up server socket");
+        return 1;
+    }
+
+    char log_path[256];
+    snprintf(log_path, sizeof(log_path), "%s/%s.log", SPOOL_DIR, name);
+    if (freopen(log_path, "a", stdout) == NULL) {
+        perror("Unable to create log file");
+        return 1;
+    }
+    if (daemon(1, 1) < 0) {
+        perror("Unable to become a daemon");
+        return 1;
+    }
+    dup2(fileno(stdout), STDERR_FILENO);
+    if (freopen("/dev/null", "r", stdin) == NULL)
+        return 1;
+    log_msg("Successfully forked as daemon");
+
+    FILE *pid_file = fopen(pid_path, "w");
+    if (pid_file == NULL) {
+        log_msg("Unable to create PID file");
+        return 1;
+    }
+    fprintf(pid_file, "%d\n", getpid());
+    fclose(pid_file);
+    log_msg("PID file: %s", pid_path);
+
+    signal(SIGTERM, terminate);
+    signal(SIGINT, terminate);
+    signal(SIGHUP, terminate);
+    signal(SIGPIPE, SIG_IGN);
+    srandom(getpid() ^ time(NULL));
+
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR)
+                log_msg("Error in accept: %s", strerror(errno));
+            continue;
+        }
+        log_msg("Accepted connection, fd = %d", fd);
+        if (flaky && random() % 10 == 0) {
+            log_msg("Dropping connection");
+        } else {
+            serve(fd);
+        }
+        close(fd);
+        log_msg("Connection terminated");
+    }
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+
+#include "bulk.h"
+#include "dispatch.h"
+#include "split.h"
+#include "presi.h"
+#include "conversions.h"
+#include "intern.h"
+
+struct pending {
+    char *file;
+    FILE_TYPE *type;
+    unsigned int eligible;
+    struct print_options options;
+};
+
+static struct pending *backlog;
+static int backlog_head = 0, backlog_len = 0, backlog_cap = 0;   // circular
+
+static int has_pattern(const char *s) {
+    return strpbrk(s, "*?[") != NULL;
+}
+
+int bulk_expand(char *arg, void (*each)(char *file, void *ctx), void *ctx) {
+    if (arg[0] == '@') {
+        FILE *list = fopen(arg + 1, "r");
+        if (list == NULL)
+            return -1;
+        char buf[1024];
+        int count = 0;
+        while (fgets(buf, sizeof(buf), list) != NULL) {
+            buf[strcspn(buf, "\r\n")] = '\0';
+            if (buf[0] == '\0' || buf[0] == '#')
+                continue;
+            each(buf, ctx);
+            count++;
+        }
+        fclose(list);
+        return count;
+    }
+
+    if (!has_pattern(arg)) {
+        each(arg, ctx);
+        return 1;
+    }
+
+    glob_t g;
+    if (glob(arg, 0, NULL, &g) != 0) {
+        globfree(&g);
+        return -1;
+    }
+    for (size_t i = 0; i < g.gl_pathc; i++)
+        each(g.gl_pathv[i], ctx);
+    int count = g.gl_pathc;
+    globfree(&g);
+    return count;
+}
+
+/* Creates a job for a file.  Returns 0 if successful. */
+static int start(char *file, FILE_TYPE *type, unsigned int eligible,
+                 const struct print_options *options) {
+    struct job *job = create_job(file, type, eligible);
+    if (job == NULL)
+        return -1;
+    job->timeout_ms = options->timeout_ms;
+    job->retention_ms = options->retention_ms;
+    job->copies = options->copies;
+    job_sched[job_index(job)].priority = options->priority;
+    job->global_id = options->global_id;
+    if (options->chunks > 1)
+        split_job(job, options->chunks);
+    return 0;
+}
+
+int bulk_submit(char *file, FILE_TYPE *type, unsigned int eligible,
+                const struct print_options *options) {
+    if (backlog_len == 0 && num_jobs < MAX_JOBS)
+        return start(file, type, eligible, options) == 0 ? 1 : -1;
+
+    if (backlog_len == backlog_cap) {
+        int cap = backlog_cap ? backlog_cap * 2 : 64;
+        struct pending *grown = malloc(cap * sizeof(*grown));
+        if (grown == NULL)
+            return -1;
+        for (int i = 0; i < backlog_len; i++)
+            grown[i] = backlog[(backlog_head + i) % backlog_cap];
+        free(backlog);
+        backlog = grown;
+        backlog_cap = cap;
+        backlog_head = 0;
+    }
+
+    char *copy = intern(file);
+    if (copy == NULL)
+        return -1;
+    backlog[(backlog_head + backlog_len) % backlog_cap] =
+        (struct pending){ copy, type, eligible, *options };
+    backlog_len++;
+    return 0;
+}
+
+int bulk_admit(void) {
+    int admitted = 0;
+    while (backlog_len > 0 && num_jobs < MAX_JOBS) {
+        struct pending *p = &backlog[backlog_head];
+        if (start(p->file, p->type, p->eligible, &p->options) == 0)
+            admitted++;
+        intern_release(p->file);
+        backlog_head = (backlog_head + 1) % backlog_cap;
+        backlog_len--;
+    }
+    return admitted;
+}
+
+void bulk_forget_printer(int p) {
+    for (int i = 0; i < backlog_len; i++)
+        backlog[(backlog_head + i) % backlog_cap].eligible &= ~(1U << p);
+}
+
+int bulk_backlog(void) {
+    return backlog_len;
+}
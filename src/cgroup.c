@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "cgroup.h"
+#include "globals.h"
+#include "presi.h"
+#include "conversions.h"
+
+#define CAPS_MEMORY 0x1
+#define CAPS_CPU 0x2
+#define CPU_PERIOD_US 100000
+#define CLEANUP_WAIT_S 600          // longest the cleanup child waits for pipelines
+
+/* Where a cgroup v2 hierarchy is looked for, alone or beside v1 ones. */
+static const char *mounts[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified" };
+
+static int state = 0;               // 1: jobs get cgroups, -1: they do not, 0: not set up
+static char mount_dir[64];
+static char base[512];              // the spooler's cgroup
+static int controllers;             // CAPS_* whose controllers job cgroups have
+
+struct caps {
+    long mem_mb;
+    int cpu_pct;
+};
+
+static struct caps *caps_by_type;   // indexed by type index
+static int caps_types_cap = 0;
+
+static int write_file(const char *path, const char *value) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n == (ssize_t)strlen(value) ? 0 : -1;
+}
+
+static int read_file(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return 0;
+}
+
+/* A single number such as memory.peak, or -1 if it is absent or "max". */
+static long long read_value(const char *path) {
+    char buf[64];
+    if (read_file(path, buf, sizeof(buf)) < 0 || buf[0] < '0' || buf[0] > '9')
+        return -1;
+    return atoll(buf);
+}
+
+/* A value of a flat keyed file such as cpu.stat, or -1. */
+static long long read_key(const char *path, const char *key) {
+    char buf[1024];
+    if (read_file(path, buf, sizeof(buf)) < 0)
+        return -1;
+    size_t len = strlen(key);
+    for (char *line = buf; line != NULL && *line != '\0'; ) {
+        if (strncmp(line, key, len) == 0 && line[len] == ' ')
+            return atoll(line + len + 1);
+        if ((line = strchr(line, '\n')) != NULL)
+            line++;
+    }
+    return -1;
+}
+
+static int find_mount(void) {
+    if (mount_dir[0] != '\0')
+        return 0;
+    for (size_t i = 0; i < sizeof(mounts) / sizeof(mounts[0]); i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/cgroup.controllers", mounts[i]);
+        if (access(path, R_OK) == 0) {
+            snprintf(mount_dir, sizeof(mount_dir), "%s", mounts[i]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Directory of the cgroup v2 a process is in (0: the calling process), from
+ * its "0::" line in /proc.
+ */
+static int process_cgroup(pid_t pid, char *buf, size_t size) {
+    char path[64], lines[4096];
+    if (pid == 0)
+        snprintf(path, sizeof(path), "/proc/self/cgroup");
+    else
+        snprintf(path, sizeof(path), "/proc/%d/cgroup", (int)pid);
+    if (find_mount() < 0 || read_file(path, lines, sizeof(lines)) < 0)
+        return -1;
+    for (char *line = lines; line != NULL && *line != '\0'; ) {
+        if (strncmp(line, "0::", 3) == 0) {
+            int len = strcspn(line + 3, "\n");
+            if (len == 1 && line[3] == '/')
+                len = 0;   // the root
+            snprintf(buf, size, "%s%.*s", mount_dir, len, line + 3);
+            return 0;
+        }
+        if ((line = strchr(line, '\n')) != NULL)
+            line++;
+    }
+    return -1;
+}
+
+int cgroup_available(void) {
+    if (state != 0)
+        return state > 0;
+    state = -1;
+
+    char own[400], path[600];
+    if (process_cgroup(0, own, sizeof(own)) < 0)
+        return 0;
+    snprintf(base, sizeof(base), "%s/presi.%d", own, (int)getpid());
+    if (mkdir(base, 0755) < 0 && errno != EEXIST)
+        return 0;
+
+    // Only presi.<pid> is ours to change.  Controllers reach job cgroups if
+    // whoever manages the spooler's cgroup has already delegated them to it.
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", base);
+    controllers = 0;
+    if (write_file(path, "+memory") == 0)
+        controllers |= CAPS_MEMORY;
+    if (write_file(path, "+cpu") == 0)
+        controllers |= CAPS_CPU;
+    state = 1;
+    return 1;
+}
+
+static struct caps *caps_slot(FILE_TYPE *type, int grow) {
+    if (type == NULL || type->index < 0)
+        return NULL;
+    if (type->index >= caps_types_cap) {
+        if (!grow)
+            return NULL;
+        int cap = caps_types_cap ? caps_types_cap : 16;
+        while (cap <= type->index)
+            cap *= 2;
+        struct caps *grown = realloc(caps_by_type, cap * sizeof(*grown));
+        if (grown == NULL)
+            return NULL;
+        memset(&grown[caps_types_cap], 0, (cap - caps_types_cap) * sizeof(*grown));
+        caps_by_type = grown;
+        caps_types_cap = cap;
+    }
+    return &caps_by_type[type->index];
+}
+
+void cgroup_get_caps(FILE_TYPE *type, long *mem_mb, int *cpu_pct) {
+    struct caps *c = caps_slot(type, 0);
+    *mem_mb = c ? c->mem_mb : 0;
+    *cpu_pct = c ? c->cpu_pct : 0;
+}
+
+int cgroup_set_caps(FILE_TYPE *type, long mem_mb, int cpu_pct) {
+    struct caps *c = caps_slot(type, 1);
+    if (c == NULL)
+        return 0;
+    c->mem_mb = mem_mb;
+    c->cpu_pct = cpu_pct;
+    if (!cgroup_available())
+        return 0;
+    return (mem_mb > 0 && (controllers & CAPS_MEMORY) ? CAPS_MEMORY : 0) |
+           (cpu_pct > 0 && (controllers & CAPS_CPU) ? CAPS_CPU : 0);
+}
+
+/* Writes the caps of a type to a job cgroup; no caps means no limits. */
+static void apply_caps(const char *dir, FILE_TYPE *type) {
+    long mem_mb;
+    int cpu_pct;
+    cgroup_get_caps(type, &mem_mb, &cpu_pct);
+    char path[600], value[64];
+    if (controllers & CAPS_MEMORY) {
+        snprintf(path, sizeof(path), "%s/memory.max", dir);
+        if (mem_mb > 0)
+            snprintf(value, sizeof(value), "%lld", (long long)mem_mb << 20);
+        else
+            snprintf(value, sizeof(value), "max");
+        write_file(path, value);
+    }
+    if (controllers & CAPS_CPU) {
+        snprintf(path, sizeof(path), "%s/cpu.max", dir);
+        if (cpu_pct > 0)
+            snprintf(value, sizeof(value), "%lld %d",
+                     (long long)cpu_pct * CPU_PERIOD_US / 100, CPU_PERIOD_US);
+        else
+            snprintf(value, sizeof(value), "max %d", CPU_PERIOD_US);
+        write_file(path, value);
+    }
+}
+
+static void job_dir(struct job *job, char *buf, size_t size) {
+    snprintf(buf, size, "%s/job%d", base, job->id);
+}
+
+/* Moves the calling process into a cgroup.  Returns 0 if successful. */
+static int join(const char *dir) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+    return write_file(path, "0");
+}
+
+void cgroup_job_enter(struct job *job) {
+    int memory_enforced = 0;
+    if (state > 0) {
+        char dir[600];
+        job_dir(job, dir, sizeof(dir));
+        if ((mkdir(dir, 0755) == 0 || errno == EEXIST)) {
+            apply_caps(dir, job->type);
+            memory_enforced = join(dir) == 0 && (controllers & CAPS_MEMORY);
+        }
+    }
+
+    long mem_mb;
+    int cpu_pct;
+    cgroup_get_caps(job->type, &mem_mb, &cpu_pct);
+    if (mem_mb > 0 && !memory_enforced) {
+        // Per process rather than for the whole pipeline, but it still
+        // stops a runaway stage.
+        struct rlimit rl;
+        rl.rlim_cur = rl.rlim_max = (rlim_t)mem_mb << 20;
+        setrlimit(RLIMIT_AS, &rl);
+    }
+}
+
+void cgroup_warm_enter(void) {
+    if (state <= 0)
+        return;
+    char dir[600];
+    snprintf(dir, sizeof(dir), "%s/warm%d", base, (int)getpid());
+    if (mkdir(dir, 0755) == 0)
+        join(dir);
+}
+
+void cgroup_warm_taken(pid_t master, struct job *job) {
+    if (state <= 0)
+        return;
+    char from[600], to[600];
+    snprintf(from, sizeof(from), "%s/warm%d", base, (int)master);
+    job_dir(job, to, sizeof(to));
+    rmdir(to);   // left over from an earlier attempt
+    if (rename(from, to) == 0)
+        apply_caps(to, job->type);
+}
+
+void cgroup_warm_reaped(pid_t pid) {
+    if (state <= 0)
+        return;
+    char dir[600];
+    snprintf(dir, sizeof(dir), "%s/warm%d", base, (int)pid);
+    rmdir(dir);
+}
+
+void cgroup_join_leader(pid_t leader) {
+    char dir[512];
+    if (process_cgroup(leader, dir, sizeof(dir)) == 0)
+        join(dir);
+
+    // The fallback memory cap is per process, so it is copied from the
+    // leader too.
+    char path[64], limits[4096];
+    snprintf(path, sizeof(path), "/proc/%d/limits", (int)leader);
+    if (read_file(path, limits, sizeof(limits)) < 0)
+        return;
+    char *line = strstr(limits, "Max address space");
+    if (line == NULL)
+        return;
+    line += strlen("Max address space");
+    line += strspn(line, " ");
+    if (*line >= '0' && *line <= '9') {
+        struct rlimit rl;
+        rl.rlim_cur = rl.rlim_max = (rlim_t)atoll(line);
+        setrlimit(RLIMIT_AS, &rl);
+    }
+}
+
+int cgroup_job_usage(struct job *job, long long *cpu_us, long *mem_kb) {
+    if (state <= 0)
+        return -1;
+    char dir[600], path[640];
+    job_dir(job, dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s/cpu.stat", dir);
+    if ((*cpu_us = read_key(path, "usage_usec")) < 0)
+        return -1;
+    snprintf(path, sizeof(path), "%s/memory.peak", dir);
+    long long bytes = read_value(path);
+    if (bytes < 0) {
+        snprintf(path, sizeof(path), "%s/memory.current", dir);
+        bytes = read_value(path);
+    }
+    *mem_kb = bytes < 0 ? -1 : bytes / 1024;
+    return 0;
+}
+
+void cgroup_job_ended(struct job *job, const struct rusage *ru) {
+    long long cpu_us = -1;
+    long mem_kb = -1;
+    if (cgroup_job_usage(job, &cpu_us, &mem_kb) == 0)
+        cgroup_job_remove(job);
+    if (cpu_us < 0)
+        cpu_us = (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000LL +
+                 ru->ru_utime.tv_usec + ru->ru_stime.tv_usec;
+    if (mem_kb < 0 || (mem_kb == 0 && !(controllers & CAPS_MEMORY)))
+        mem_kb = ru->ru_maxrss;
+
+    // A requeued job adds up its attempts.
+    job->cpu_us = (job->cpu_us > 0 ? job->cpu_us : 0) + cpu_us;
+    if (mem_kb > job->mem_kb)
+        job->mem_kb = mem_kb;
+}
+
+void cgroup_job_remove(struct job *job) {
+    if (state <= 0)
+        return;
+    char dir[600];
+    job_dir(job, dir, sizeof(dir));
+    rmdir(dir);
+}
+
+/* Removes the job and warm cgroups that are empty, then the spooler's. */
+static int remove_all(void) {
+    DIR *d = opendir(base);
+    if (d != NULL) {
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL) {
+            if (strncmp(e->d_name, "job", 3) == 0 || strncmp(e->d_name, "warm", 4) == 0) {
+                char dir[900];
+                snprintf(dir, sizeof(dir), "%s/%s", base, e->d_name);
+                rmdir(dir);
+            }
+        }
+        closedir(d);
+    }
+    return rmdir(base);
+}
+
+/* Closes every descriptor, so that no pipeline waits on one held here. */
+static void close_all_fds(void) {
+    DIR *d = opendir("/proc/self/fd");
+    if (d == NULL)
+        return;
+    int keep = dirfd(d);
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        int fd = atoi(e->d_name);
+        if (e->d_name[0] != '.' && fd != keep)
+            close(fd);
+    }
+    closedir(d);
+}
+
+void cgroup_cleanup(void) {
+    if (state <= 0)
+        return;
+    state = 0;
+    if (remove_all() == 0 || errno != EBUSY)
+        return;
+
+    // Pipelines are still running, warm ones until the spooler has exited.
+    // A cgroup can only be removed once empty, so a child waits for them,
+    // but not forever: a paused job stays stopped after the spooler quits.
+    fflush(stdout);
+    if (fork() == 0) {
+        setpgid(0, 0);
+        close_all_fds();
+        for (int i = 0; i < CLEANUP_WAIT_S && remove_all() < 0 && errno == EBUSY; i++)
+            sleep(1);
+        _exit(0);
+    }
+}
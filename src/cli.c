@@ -12,8 +12,18 @@
 #include "presi.h"
 #include "globals.h"
 #include "dispatch.h"
+#include "shard.h"
+#include "timers.h"
+#include "forkserver.h"
+#include "pipeline.h"
+#include "snapshot.h"
+#include "metrics.h"
+#include "trace.h"
+#include "cgroup.h"
 
 static volatile sig_atomic_t got_sigchld = 0;
+static volatile sig_atomic_t got_sigio = 0;
+static volatile sig_atomic_t got_sigalrm = 0;
 
 void sigchld_handler(int sig) {
     got_sigchld = 1;
@@ -21,7 +31,24 @@ void sigchld_handler(int sig) {
 
 }
 
+void sigio_handler(int sig) {
+    got_sigio = 1;
+}
+
+void sigalrm_handler(int sig) {
+    got_sigalrm = 1;
+}
+
 void signal_hook(void) {
+    if (got_sigalrm) {
+        got_sigalrm = 0;
+        timers_run();
+    }
+    if (got_sigio) {
+        got_sigio = 0;
+        shard_poll();
+        metrics_poll();
+    }
     if (got_sigchld) {
         got_sigchld = 0;
         reap_finished_jobs();
@@ -37,8 +64,23 @@ int run_cli(FILE *in, FILE *out) {
         sigemptyset(&sa.sa_mask);
         sa.sa_flags = SA_RESTART;
         sigaction(SIGCHLD, &sa, NULL);
+        sa.sa_handler = sigio_handler;
+        sigaction(SIGIO, &sa, NULL);
+        sa.sa_handler = sigalrm_handler;
+        sigaction(SIGALRM, &sa, NULL);
         sf_set_readline_signal_hook(signal_hook);
         initialized = 1;
+        set_input_feeder(getenv("PRESI_URING") != NULL);
+        forkserver_init();
+        int sharded = shard_init(out) > 0;
+        char *snapshot = getenv("PRESI_SNAPSHOT");
+        if (snapshot != NULL && sharded)
+            fprintf(stderr, "Snapshots are not supported in sharded mode, %s not loaded\n", snapshot);
+        else if (snapshot != NULL && load_snapshot(snapshot) < 0)
+            fprintf(stderr, "Failed to load snapshot %s\n", snapshot);
+        char *metrics = getenv("PRESI_METRICS");
+        if (metrics != NULL && !sharded && metrics_serve(metrics) < 0)
+            fprintf(stderr, "Failed to serve metrics on %s\n", metrics);
     }
 
     char prompt_buffer[1024];
@@ -64,19 +106,30 @@ int run_cli(FILE *in, FILE *out) {
         if (strncmp(line, "quit", 4) == 0) {
             sf_cmd_ok();
             free(line);
+            metrics_stop();
+            trace_stop();
+            cgroup_cleanup();
+            if (shard_is_coordinator())
+                shard_fini();
             return -1;
         }
 
-        handle_user_command(line, out);
+        if (shard_is_coordinator())
+            handle_coordinator_command(line, out);
+        else
+            handle_user_command(line, out);
 
         if (in != stdin) {
             signal_hook();          // ✅ force signal handling
             usleep(1000);           // ✅ 1ms buffer to let SIGCHLD land
         }
 
-        delete_expired_jobs_if_needed();
         free(line);
     }
 
+    trace_stop();
+    cgroup_cleanup();
+    if (in == stdin && shard_is_coordinator())
+        shard_fini();
     return (in == stdin) ? -1 : 0;
 }
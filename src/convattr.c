@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "convattr.h"
+#include "conversions.h"
+
+struct conversion_attrs_entry {
+    FILE_TYPE *from;
+    FILE_TYPE *to;
+    struct conversion_attrs attrs;
+};
+
+static const struct conversion_attrs default_attrs = {
+    .workers = 1,
+    .timeout_ms = 0,
+    .pool = 0,
+    .mem_mb = 0,
+    .policy = { 0, 0, 0, 0 },
+    .startup_ms = 0,
+    .rate = 0,
+};
+
+static struct conversion_attrs_entry *entries = NULL;
+static int num_entries = 0;
+static int entries_cap = 0;
+
+struct conversion_attrs *define_conversion_attrs(FILE_TYPE *from, FILE_TYPE *to) {
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].from == from && entries[i].to == to) {
+            entries[i].attrs = default_attrs;
+            return &entries[i].attrs;
+        }
+    }
+
+    if (num_entries == entries_cap) {
+        int cap = entries_cap ? entries_cap * 2 : 16;
+        struct conversion_attrs_entry *grown = realloc(entries, cap * sizeof(*grown));
+        if (grown == NULL)
+            return NULL;
+        entries = grown;
+        entries_cap = cap;
+    }
+
+    struct conversion_attrs_entry *e = &entries[num_entries++];
+    e->from = from;
+    e->to = to;
+    e->attrs = default_attrs;
+    return &e->attrs;
+}
+
+struct conversion_attrs *find_conversion_attrs(FILE_TYPE *from, FILE_TYPE *to) {
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].from == from && entries[i].to == to)
+            return &entries[i].attrs;
+    }
+    return NULL;
+}
+
+const struct conversion_attrs *conversion_attrs(CONVERSION *conv) {
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].from == conv->from && entries[i].to == conv->to)
+            return &entries[i].attrs;
+    }
+    return &default_attrs;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <time.h>
@@ -11,14 +12,54 @@
 #include "globals.h"
 #include "presi.h"
 #include "conversions.h"
+#include "graph.h"
+#include "split.h"
+#include "pipeline.h"
+#include "timers.h"
+#include "convattr.h"
+#include "warm.h"
+#include "policy.h"
+#include "estimate.h"
+#include "bulk.h"
+#include "intern.h"
+#include "registry.h"
+#include "stats.h"
+#include "trace.h"
+#include "cgroup.h"
+
+#define RETRY_BACKOFF_MAX_MS 30000
+#define WATCHDOG_GRACE_MS 2000        // between SIGTERM and SIGKILL of a timed-out job
+#define STARVATION_MS 60000           // queued jobs older than this go first
+#define START_RETRY_MS 1000           // before dispatching again after a job failed to start
+
+static int retry_max = 0;             // requeues allowed after a printer disconnect
+static long retry_backoff_ms = 500;   // delay before the first requeue, doubled after each
+static int retry_checkpoint = 0;      // resume from the delivered byte offset
+static long retention_ms = 10000;     // how long finished and aborted jobs stay listed
+static int proc_limit = 0;            // concurrent conversion processes, 0: online CPUs
+static long mem_limit_mb = 0;         // memory of running pipelines, 0: unlimited
+static struct registry *printer_names;   // printer name -> index in printers[]
+static struct timer *start_retry;     // pending dispatch after a job failed to start
+static int preempt_gap = 0;           // priority margin needed to preempt, 0: never preempt
+static long preempt_min_run_ms = 2000;   // run time before a job may be preempted
+static int preempt_max = 1;           // times one job may be preempted
+static long progress_interval_ms = 0; // between progress events, 0: none
+static struct timer *progress_timer;
 
 char *format_time(time_t t, char *buf, size_t buf_size) {
-    struct tm *tm_info = localtime(&t);
-    strftime(buf, buf_size, "%d %b %H:%M:%S", tm_info);
+    // Listings format the same few seconds over and over.
+    static time_t last = -1;
+    static char last_buf[32];
+    if (t != last) {
+        strftime(last_buf, sizeof(last_buf), "%d %b %H:%M:%S", localtime(&t));
+        last = t;
+    }
+    snprintf(buf, buf_size, "%s", last_buf);
     return buf;
 }
 
 void print_job_debug(struct job *job, const char *printer_name) {
+    int j = job_index(job);
     time_t now = time(NULL);
     char time_buf[32];
     strftime(time_buf, sizeof(time_buf), "%d Apr %H:%M:%S", localtime(&now));
@@ -27,8 +68,8 @@ void print_job_debug(struct job *job, const char *printer_name) {
         "created", "running", "paused", "aborted", "finished", "deleted"
     };
 
-    const char *status_str = job->status >= 0 && job->status <= 5
-                             ? status_names[job->status]
+    const char *status_str = job_status[j] >= 0 && job_status[j] <= 5
+                             ? status_names[job_status[j]]
                              : "unknown";
 
     fprintf(stderr,
@@ -38,219 +79,1042 @@ void print_job_debug(struct job *job, const char *printer_name) {
         time_buf,
         time_buf,
         status_str,
-        job->eligible,
+        job_eligible[j],
         job->file ? job->file : "(null)",
-        job->pgid,
+        job_pgid[j],
         printer_name ? printer_name : "(none)"
     );
 }
 
 int job_for_pgid(pid_t pgid) {
     for (int i = 0; i < num_jobs; i++) {
-        if (jobs[i].pgid == pgid)
+        if (job_pgid[i] == pgid)
             return i;
     }
     return -1;
 }
 
+struct job *find_job(int id) {
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i].id == id)
+            return &jobs[i];
+    }
+    return NULL;
+}
 
-void dispatch_jobs(void) {
-    int dispatched;
-    do {
-        dispatched = 0;
+void set_job_status(int j, JOB_STATUS status) {
+    stats_job_status(jobs[j].type, job_status[j], status);
+    job_status[j] = status;
+}
 
-        for (int j = 0; j < num_jobs; j++) {
-            if (jobs[j].status != JOB_CREATED)
+int find_printer(const char *name) {
+    return printer_names ? registry_get(printer_names, name) : -1;
+}
+
+int define_printer(char *name, FILE_TYPE *type) {
+    if (printer_names == NULL && (printer_names = registry_new()) == NULL)
+        return -1;
+    if (find_printer(name) >= 0)
+        return -1;
+
+    // Reuse the slot of a removed printer before growing the table.
+    int p = 0;
+    while (p < num_printers && printers[p].name != NULL)
+        p++;
+    if (p == MAX_PRINTERS)
+        return -1;
+
+    char *interned = intern(name);
+    if (interned == NULL || registry_put(printer_names, interned, p) < 0) {
+        intern_release(interned);
+        return -1;
+    }
+    printers[p].name = interned;
+    printers[p].type = type;
+    printers[p].status = PRINTER_DISABLED;
+    printers[p].current_pid = 0;
+    printers[p].connect_flags = PRINTER_NORMAL;
+    if (p == num_printers)
+        num_printers++;
+    stats_printer_defined(p);
+    return p;
+}
+
+int remove_printer(int p) {
+    if (printers[p].current_pid != 0)
+        return -1;
+    for (int j = 0; j < num_jobs; j++) {
+        if (jobs[j].preempted_on == p)
+            return -1;   // the job is waiting to get the printer back
+    }
+
+    // Queued jobs that named the printer no longer do, so that a printer
+    // defined later in the same slot does not inherit them.
+    unsigned int bit = 1U << p;
+    for (int j = 0; j < num_jobs; j++) {
+        job_eligible[j] &= ~bit;
+        jobs[j].failed_printers &= ~bit;
+        job_sched[j].fanout &= ~bit;
+    }
+    bulk_forget_printer(p);
+    warm_forget_printer(p);
+    estimate_forget_printer(p);
+    memset(printer_policy(p), 0, sizeof(struct sched_policy));
+
+    registry_remove(printer_names, printers[p].name);
+    intern_release(printers[p].name);
+    printers[p].name = NULL;
+    printers[p].type = NULL;
+    printers[p].status = PRINTER_DISABLED;
+    while (num_printers > 0 && printers[num_printers - 1].name == NULL)
+        num_printers--;
+    return 0;
+}
+
+/*
+ * Reports how many copies of a job with copies or fan-out each of its
+ * printers took, as recorded by its master.
+ */
+static void report_destinations(struct job *job, pid_t master) {
+    struct job_progress *progress = job->progress;
+    for (int p = 0; p < num_printers; p++) {
+        if (printers[p].current_pid != master)
+            continue;
+        int done = progress != NULL ? progress->copies_done[p] : 0;
+        int failed = progress == NULL || (progress->dests_failed & (1U << p)) ||
+                     done < job->copies;
+        printf("JOB[%d]: printer=%s, copies=%d/%d, %s\n", job->id, printers[p].name,
+               done, job->copies, failed ? "failed" : "done");
+    }
+}
+
+/* Frees a printer whose job is over; a printer disabled meanwhile stays disabled. */
+static void release_printer(int p) {
+    printers[p].current_pid = 0;
+    stats_printer_busy(p, 0);
+    if (printers[p].status == PRINTER_DISABLED)
+        return;
+    printers[p].status = PRINTER_IDLE;
+    sf_printer_status(printers[p].name, PRINTER_IDLE);
+}
+
+struct job *create_job(char *file, FILE_TYPE *type, unsigned int eligible) {
+    if (num_jobs >= MAX_JOBS)
+        return NULL;
+    char *interned = intern(file);
+    if (interned == NULL)
+        return NULL;
+
+    int job_id = next_job_id++;
+    int j = num_jobs++;
+    JOB *job = &jobs[j];
+    memset(job, 0, sizeof(*job));
+    memset(&job_sched[j], 0, sizeof(job_sched[j]));
+    job->id = job_id;
+    job->file = interned;
+    job->type = type;
+    job_status[j] = JOB_CREATED;
+    stats_job_status(type, JOB_DELETED, JOB_CREATED);
+    job_eligible[j] = eligible;
+    job_pgid[j] = -1;
+    job->status_changed_at = time(NULL);
+    job->parent = -1;
+    job->global_id = -1;
+    job->length = -1;
+    job->retention_ms = -1;
+    job->copies = 1;
+    job->preempted_on = -1;
+    job->cpu_us = -1;
+    job->mem_kb = -1;
+    job_sched[j].queued_ms = timers_now_ms();
+
+    sf_job_created(job_id, file, type->name);
+
+    char created_str[64], status_str[64];
+    format_time(job->status_changed_at, created_str, sizeof(created_str));
+    format_time(job->status_changed_at, status_str, sizeof(status_str));
+    printf("JOB[%d]: type=%s, creation(%s), status(%s)=%s, eligible=%08x, file=%s\n",
+           job_id,
+           type->name,
+           created_str,
+           status_str,
+           job_status_names[JOB_CREATED],
+           eligible,
+           file);
+    return job;
+}
+
+void set_retry_policy(int max, long backoff_ms, int checkpoint) {
+    retry_max = max;
+    retry_backoff_ms = backoff_ms;
+    retry_checkpoint = checkpoint;
+}
+
+void set_preempt_policy(int min_gap, long min_run_ms, int max_per_job) {
+    preempt_gap = min_gap;
+    preempt_min_run_ms = min_run_ms;
+    preempt_max = max_per_job;
+}
+
+static void retry_ready(int job_id) {
+    struct job *job = find_job(job_id);
+    if (job == NULL)
+        return;
+    job_sched[job_index(job)].retry_timer = NULL;
+    dispatch_jobs();
+}
+
+/*
+ * Puts a job whose printer dropped the connection back in the queue, to be
+ * dispatched (preferably to another printer) after an exponential backoff.
+ * Returns 0 if the retry policy does not allow another attempt.
+ */
+static int requeue_job(struct job *job, pid_t master) {
+    int j = job_index(job);
+    if (job_status[j] != JOB_RUNNING || job->retries >= retry_max)
+        return 0;
+
+    job->checkpoint_type = NULL;
+    for (int p = 0; p < num_printers; p++) {
+        if (printers[p].current_pid == master) {
+            job->failed_printers |= 1U << p;
+            job->checkpoint_type = printers[p].type;
+        }
+    }
+
+    long delay = retry_backoff_ms;
+    for (int i = 0; i < job->retries && delay < RETRY_BACKOFF_MAX_MS; i++)
+        delay *= 2;
+    if (delay > RETRY_BACKOFF_MAX_MS)
+        delay = RETRY_BACKOFF_MAX_MS;
+
+    job->retries++;
+    job->checkpoint = retry_checkpoint && job->progress ? job->progress->delivered : 0;
+    job_pgid[j] = -1;
+    set_job_status(j, JOB_CREATED);
+    job->status_changed_at = time(NULL);
+    job_sched[j].queued_ms = timers_now_ms() + delay;
+    job_sched[j].retry_timer = timer_add(delay, retry_ready, job->id);
+    sf_job_status(job->id, JOB_CREATED);
+
+    printf("JOB[%d]: printer disconnected, retry %d in %ld ms from byte %lld\n",
+           job->id, job->retries, delay, (long long)job->checkpoint);
+    return 1;
+}
+
+static void watchdog_check(int job_id);
+
+static long long job_runtime_ms(struct job *job) {
+    long long now = timers_now_ms();
+    long long paused = job->paused_total_ms;
+    if (job->paused_at_ms > 0)
+        paused += now - job->paused_at_ms;
+    return now - job->started_ms - paused;
+}
+
+long long job_progress_eta(struct job *job, long long *consumed, long long *delivered) {
+    *consumed = job->progress ? job->progress->consumed : 0;
+    *delivered = job->progress ? job->progress->delivered : 0;
+    long long runtime = job_runtime_ms(job);
+    off_t total = job_input_bytes(job);
+
+    // The pipes hold little, so the input is consumed about as fast as the
+    // printer takes the output; until it flows, and once it is all read, the
+    // estimate made at dispatch is the better guide.
+    if (*consumed > 0 && *consumed < total && runtime > 0)
+        return (long long)((double)runtime * (total - *consumed) / *consumed);
+    if (job->est_ms > 0)
+        return job->est_ms > runtime ? job->est_ms - runtime : 0;
+    return -1;
+}
+
+/*
+ * Reports the running jobs whose pipelines moved data since their last
+ * report, then rearms itself.  One round per interval bounds the output
+ * however fast the data moves.
+ */
+static void progress_tick(int arg) {
+    (void)arg;
+    progress_timer = NULL;
+    for (int j = 0; j < num_jobs; j++) {
+        struct job *job = &jobs[j];
+        if (job_status[j] != JOB_RUNNING || job->progress == NULL)
+            continue;
+        long long consumed, delivered;
+        long long eta = job_progress_eta(job, &consumed, &delivered);
+        if (consumed + delivered == job->reported_bytes)
+            continue;
+        job->reported_bytes = consumed + delivered;
+        printf("JOB[%d]: progress, delivered=%lld, consumed=%lld/%lld", job->id, delivered,
+               consumed, (long long)job_input_bytes(job));
+        if (eta >= 0)
+            printf(", eta=%.1fs", eta / 1000.0);
+        printf("\n");
+    }
+    if (progress_interval_ms > 0)
+        progress_timer = timer_add(progress_interval_ms, progress_tick, 0);
+}
+
+void set_progress_interval(long ms) {
+    progress_interval_ms = ms;
+    timer_cancel(progress_timer);
+    progress_timer = ms > 0 ? timer_add(ms, progress_tick, 0) : NULL;
+}
+
+/*
+ * Checks a running job against its own timeout and the timeouts of the
+ * conversion stages that are still running.  A job over its budget gets
+ * SIGTERM, and SIGKILL after a grace period; reap_finished_jobs() then
+ * aborts it and releases the printer.  Otherwise the check is rescheduled
+ * for the nearest remaining deadline.
+ */
+static void watchdog_schedule(struct job *job, CONVERSION **path) {
+    int j = job_index(job);
+    long long runtime = job_runtime_ms(job);
+    long long next = -1;
+    int expired = 0;
+
+    if (job->timeout_ms > 0) {
+        if (runtime >= job->timeout_ms) expired = 1;
+        else next = job->timeout_ms - runtime;
+    }
+    for (int i = 0; path != NULL && path[i] != NULL; i++) {
+        long timeout = conversion_attrs(path[i])->timeout_ms;
+        if (timeout <= 0 || (i < 32 && job->progress && (job->progress->stages_done & (1U << i))))
+            continue;
+        if (runtime >= timeout) expired = 1;
+        else if (next < 0 || timeout - runtime < next) next = timeout - runtime;
+    }
+
+    if (expired) {
+        printf("JOB[%d]: watchdog timeout after %lld ms, terminating\n", job->id, runtime);
+        kill(-job_pgid[j], SIGTERM);
+        kill(-job_pgid[j], SIGCONT);
+        job->terminating = 1;
+        job->watchdog = timer_add(WATCHDOG_GRACE_MS, watchdog_check, job->id);
+    } else if (next >= 0) {
+        job->watchdog = timer_add(next, watchdog_check, job->id);
+    }
+}
+
+static void watchdog_check(int job_id) {
+    struct job *job = find_job(job_id);
+    if (job == NULL)
+        return;
+    int j = job_index(job);
+    job->watchdog = NULL;
+    if (job_pgid[j] <= 0)
+        return;
+
+    // The master dies of SIGTERM at once and is reaped before the grace
+    // period ends; stages that ignore SIGTERM are still in its group.
+    if (job->terminating) {
+        kill(-job_pgid[j], SIGKILL);
+        job->terminating = 0;
+        return;
+    }
+    if (job_status[j] != JOB_RUNNING && job_status[j] != JOB_PAUSED)
+        return;
+
+    CONVERSION **path = NULL;
+    for (int p = 0; p < num_printers; p++) {
+        if (printers[p].current_pid == job_pgid[j])
+            path = find_route(job->type, printers[p].type);
+    }
+    watchdog_schedule(job, path);
+    free(path);
+}
+
+/*
+ * Resources a pipeline is expected to use: its conversion processes (a fanned
+ * stage counts once per worker) and their declared memory.
+ */
+struct pipeline_cost {
+    int procs;
+    long mem_mb;
+};
+
+static struct pipeline_cost path_cost(CONVERSION **path) {
+    struct pipeline_cost cost = {0, 0};
+    for (int i = 0; path[i] != NULL; i++) {
+        const struct conversion_attrs *attrs = conversion_attrs(path[i]);
+        cost.procs += attrs->workers;
+        cost.mem_mb += attrs->workers * attrs->mem_mb;
+    }
+    return cost;
+}
+
+static int cost_less(struct pipeline_cost a, struct pipeline_cost b) {
+    return a.procs < b.procs || (a.procs == b.procs && a.mem_mb < b.mem_mb);
+}
+
+static int proc_budget(void) {
+    if (proc_limit > 0)
+        return proc_limit;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? cpus : 1;
+}
+
+/*
+ * Sums the costs admitted for dispatched jobs.  A paused job holds on to its
+ * memory but not to the CPUs.  Returns the number of such jobs.
+ */
+static int resources_in_use(struct pipeline_cost *used) {
+    int active = 0;
+    used->procs = 0;
+    used->mem_mb = 0;
+    for (int j = 0; j < num_jobs; j++) {
+        if (job_pgid[j] <= 0 || (job_status[j] != JOB_RUNNING && job_status[j] != JOB_PAUSED))
+            continue;
+        if (job_status[j] == JOB_RUNNING)
+            used->procs += jobs[j].procs;
+        used->mem_mb += jobs[j].mem_mb;
+        active++;
+    }
+    return active;
+}
+
+void set_resource_limits(int procs, long mem_mb) {
+    proc_limit = procs;
+    mem_limit_mb = mem_mb;
+}
+
+void print_resource_usage(FILE *out) {
+    struct pipeline_cost used;
+    int active = resources_in_use(&used);
+    int queued = 0;
+    for (int j = 0; j < num_jobs; j++) {
+        if (job_status[j] == JOB_CREATED && job_sched[j].chunks_left == 0)
+            queued++;
+    }
+    fprintf(out, "LIMITS: procs=%d/%d, mem=%ld/", used.procs, proc_budget(), used.mem_mb);
+    if (mem_limit_mb > 0)
+        fprintf(out, "%ld MB", mem_limit_mb);
+    else
+        fprintf(out, "unlimited");
+    fprintf(out, ", active=%d, queued=%d\n", active, queued);
+}
+
+/*
+ * Connects to a printer, with the faults set for it.  A flaky daemon may hang
+ * up during the handshake: that must fail the connection, not kill the
+ * spooler, so SIGPIPE is blocked and any it raised is discarded.  (Ignoring
+ * it would not do: from the signal hook, where it is blocked anyway, it would
+ * stay pending.)
+ */
+static int connect_printer(int p) {
+    sigset_t pipe_set, old_mask, pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipe_set, &old_mask);
+    int fd = presi_connect_to_printer(printers[p].name, printers[p].type->name,
+                                      printers[p].connect_flags);
+    sigpending(&pending);
+    if (sigismember(&pending, SIGPIPE)) {
+        struct timespec zero = { 0, 0 };
+        sigtimedwait(&pipe_set, NULL, &zero);
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return fd;
+}
+
+/*
+ * Starts a job on an idle printer: hands it to the printer's warm pipeline
+ * if there is one, else connects to the printer and forks a master.
+ * Returns -1 if the job could not be started, with *unreachable set to the
+ * printer that could not be connected to, or -1 for any other failure.
+ */
+static int start_job(struct job *job, int p, CONVERSION **path, struct pipeline_cost cost,
+                     int *unreachable) {
+    *unreachable = -1;
+    // The checkpoint is an offset in the output converted for one printer
+    // type; failing over to another type means printing from the start.
+    if (job->checkpoint > 0 && job->checkpoint_type != printers[p].type)
+        job->checkpoint = 0;
+    int j = job_index(job);
+    if (job->progress == NULL)
+        job->progress = job_progress_alloc();
+
+    // Copies and fan-out need a master of their own, on every destination.
+    int fanned = job_sched[j].fanout != 0 || job->copies > 1;
+    unsigned int dests = job_sched[j].fanout != 0 ? job_sched[j].fanout : 1U << p;
+
+    long long connect_us = 0, connected_us = 0;
+    pid_t master = fanned ? 0 : warm_take(p, job);
+    if (master > 0)
+        cgroup_warm_taken(master, job);
+    if (master == 0) {
+        int fds[MAX_PRINTERS], dest[MAX_PRINTERS], n = 0;
+        connect_us = trace_now_us();
+        for (int q = 0; q < num_printers; q++) {
+            if (!(dests & (1U << q)))
                 continue;
+            if (fanned)
+                warm_discard(q);
+            if ((fds[n] = connect_printer(q)) < 0) {
+                while (n > 0)
+                    close(fds[--n]);
+                *unreachable = q;
+                return -1;
+            }
+            dest[n++] = q;
+        }
+        connected_us = trace_now_us();
+        if (job->progress != NULL) {
+            job->progress->stages_done = 0;   // left over from an earlier attempt
+            job->progress->delivered = job->checkpoint;   // already on paper
+            job->progress->consumed = 0;
+            job->progress->dests_failed = 0;
+            memset((void *)job->progress->copies_done, 0, sizeof(job->progress->copies_done));
+        }
 
-            for (int p = 0; p < num_printers; p++) {
-                if (printers[p].status != PRINTER_IDLE)
-                    continue;
+        cgroup_available();
+        fflush(stdout);  // the master must not inherit buffered output
+        master = fork();
+        if (master < 0) {
+            for (int i = 0; i < n; i++)
+                close(fds[i]);
+            return -1;
+        }
 
-                if (!(jobs[j].eligible & (1U << p)))
-                    continue;
+        if (master == 0) {
+            setpgid(0, 0);  // Master creates its own process group
+            warm_close_inherited();
+            cgroup_job_enter(job);
+            if (fanned)
+                run_fanout_pipeline(job, path, fds, dest, n, printer_policy(p));
+            run_pipeline(job, path, fds[0], p, printer_policy(p));
+        }
 
-                CONVERSION **path = find_conversion_path(jobs[j].type->name, printers[p].type->name);
-                if (!path) continue;
+        for (int i = 0; i < n; i++)
+            close(fds[i]);
+        setpgid(master, master); // Parent sets pgid for master too
+    }
+    warm_note(p, job->type);
+    job_pgid[j] = master;   // ✅ Track pgid in parent
+    job->procs = cost.procs;
+    job->mem_mb = cost.mem_mb;
+    job->reported_bytes = 0;
 
-                int printer_fd = presi_connect_to_printer(printers[p].name, printers[p].type->name, PRINTER_NORMAL);
-                if (printer_fd < 0) {
-                    free(path);
-                    continue;
-                }
+    set_job_status(j, JOB_RUNNING);
+    sf_job_status(job->id, JOB_RUNNING);
+
+    job->started_ms = timers_now_ms();
+    job->paused_at_ms = 0;
+    job->paused_total_ms = 0;
+    job->terminating = 0;
+    watchdog_schedule(job, path);
+    trace_job_started(job, connect_us, connected_us);
+
+    for (int q = 0; q < num_printers; q++) {
+        if (!(dests & (1U << q)))
+            continue;
+        printers[q].status = PRINTER_BUSY;
+        printers[q].current_pid = master;
+        stats_printer_busy(q, 1);
+        sf_printer_status(printers[q].name, PRINTER_BUSY);
+    }
+    stats_job_started(timers_now_ms() - job_sched[j].queued_ms, cost.procs);
+
+    int path_len = 0;
+    while (path[path_len]) path_len++;
+
+    char *commands[path_len + 1];
+    for (int i = 0; i < path_len; i++)
+        commands[i] = path[i]->cmd_and_args[0];
+    commands[path_len] = NULL;
+
+    sf_job_started(job->id, printers[p].name, master, commands);
+    if (job->parent >= 0)
+        split_chunk_started(job);
+    print_job_debug(job, printers[p].name);
+    sf_cmd_ok();
+    return 0;
+}
 
-                pid_t master = fork();
-                if (master < 0) {
-                    close(printer_fd);
-                    free(path);
+/*
+ * Finds the idle printer on which a job is expected to finish first, the
+ * cheaper pipeline breaking ties, among those not in skip.  Returns the
+ * printer, with its conversion path, cost and expected run time, or -1 if
+ * none can take the job.
+ */
+static int best_printer(struct job *job, unsigned int skip, CONVERSION ***path,
+                        struct pipeline_cost *cost, long long *est_ms) {
+    int j = job_index(job);
+    // A fan-out job takes all its printers at once, named after the first.
+    if (job_sched[j].fanout != 0) {
+        int first = -1;
+        for (int p = 0; p < num_printers; p++) {
+            if (!(job_sched[j].fanout & (1U << p)))
+                continue;
+            if (printers[p].status != PRINTER_IDLE || (skip & (1U << p)))
+                return -1;
+            if (first < 0)
+                first = p;
+        }
+        if (first < 0 || (*path = find_route(job->type, printers[first].type)) == NULL)
+            return -1;
+        *cost = path_cost(*path);
+        *est_ms = estimate_job_ms(job, first, *path);
+        return first;
+    }
+
+    // Fail over: avoid printers that dropped this job, unless no other
+    // eligible printer is available.
+    unsigned int avoid = job->failed_printers;
+    int alternative = 0;
+    for (int p = 0; p < num_printers; p++) {
+        if ((job_eligible[j] & ~avoid & (1U << p)) && printers[p].status != PRINTER_DISABLED)
+            alternative = 1;
+    }
+    if (!alternative)
+        avoid = 0;
+
+    int best = -1;
+    *path = NULL;
+    for (int p = 0; p < num_printers; p++) {
+        if (printers[p].status != PRINTER_IDLE || (skip & (1U << p)))
+            continue;
+
+        if (!(job_eligible[j] & ~avoid & (1U << p)))
+            continue;
+
+        CONVERSION **candidate = find_route(job->type, printers[p].type);
+        if (!candidate) continue;
+
+        struct pipeline_cost c = path_cost(candidate);
+        long long est = estimate_job_ms(job, p, candidate);
+        if (best < 0 || est < *est_ms || (est == *est_ms && cost_less(c, *cost))) {
+            free(*path);
+            *path = candidate;
+            *cost = c;
+            *est_ms = est;
+            best = p;
+        } else {
+            free(candidate);
+        }
+    }
+    return best;
+}
+
+void expected_jobs_ms(long long *est_ms) {
+    for (int j = 0; j < num_jobs; j++) {
+        int dispatched = job_pgid[j] > 0 &&
+                         (job_status[j] == JOB_RUNNING || job_status[j] == JOB_PAUSED);
+        est_ms[j] = dispatched ? jobs[j].est_ms : -1;
+    }
+
+    // Queued jobs are estimated a type at a time, so that the paths from the
+    // type to the printers are looked up once.
+    FILE_TYPE *done[MAX_JOBS];
+    int num_done = 0;
+    for (int j = 0; j < num_jobs; j++) {
+        if (job_status[j] != JOB_CREATED)
+            continue;
+        FILE_TYPE *type = jobs[j].type;
+        int seen = 0;
+        for (int t = 0; t < num_done; t++)
+            seen |= done[t] == type;
+        if (seen)
+            continue;
+        done[num_done++] = type;
+
+        CONVERSION **paths[MAX_PRINTERS];
+        for (int p = 0; p < num_printers; p++)
+            paths[p] = printers[p].name != NULL ? find_route(type, printers[p].type) : NULL;
+        for (int k = j; k < num_jobs; k++) {
+            if (job_status[k] != JOB_CREATED || jobs[k].type != type)
+                continue;
+            for (int p = 0; p < num_printers; p++) {
+                if (!(job_eligible[k] & (1U << p)) || paths[p] == NULL)
                     continue;
-                }
+                long long est = estimate_job_ms(&jobs[k], p, paths[p]);
+                if (est_ms[k] < 0 || est < est_ms[k])
+                    est_ms[k] = est;
+            }
+        }
+        for (int p = 0; p < num_printers; p++)
+            free(paths[p]);
+    }
+}
 
-                if (master == 0) {
-                    setpgid(0, 0);  // Master creates its own process group
-                    pid_t pgid = getpid();  // This will be used for all children
+/* A queued job that could be started on an idle printer. */
+struct candidate {
+    int job;
+    int printer;
+    CONVERSION **path;
+    struct pipeline_cost cost;
+    long long est_ms;
+    int starving;      // queued for longer than STARVATION_MS
+    int fits;          // within what is left of the budget
+};
 
-                    int in_fd = open(jobs[j].file, O_RDONLY);
-                    if (in_fd < 0) exit(1);
+static int candidate_better(struct candidate *a, struct candidate *b, int held) {
+    if (job_sched[a->job].priority != job_sched[b->job].priority)
+        return job_sched[a->job].priority > job_sched[b->job].priority;
+    if (a->starving != b->starving)
+        return a->starving;
+    if (a->starving)
+        return 0;  // queue order
+    if (held && (cost_less(a->cost, b->cost) || cost_less(b->cost, a->cost)))
+        return cost_less(a->cost, b->cost);
+    return a->est_ms < b->est_ms;
+}
 
-                    int path_len = 0;
-                    while (path[path_len]) path_len++;
+/* The printers a candidate would take. */
+static unsigned int candidate_printers(struct candidate *c) {
+    return job_sched[c->job].fanout != 0 ? job_sched[c->job].fanout : 1U << c->printer;
+}
 
-                    if (path_len == 0) {
-                        dup2(in_fd, STDIN_FILENO);
-                        dup2(printer_fd, STDOUT_FILENO);
-                        close(in_fd); close(printer_fd);
-                        //fprintf(stderr, "[DEBUG] cat printing process (no conversion), pid=%d\n", getpid());
-                        execlp("cat", "cat", NULL);
-                        exit(1);
-                    }
+/*
+ * Fan-out jobs that have starved: a fan-out job needs all its printers idle
+ * at once, which may never happen while other jobs take them as they come
+ * free, so once it starves its printers are held for it against the jobs it
+ * goes before.  Returns their number, with their indexes in starved.
+ */
+static int starving_fanouts(int *starved, long long now) {
+    int num_starved = 0;
+    for (int j = 0; j < num_jobs; j++) {
+        if (job_status[j] == JOB_CREATED && job_sched[j].fanout != 0 &&
+            job_sched[j].retry_timer == NULL && now - job_sched[j].queued_ms > STARVATION_MS)
+            starved[num_starved++] = j;
+    }
+    return num_starved;
+}
 
-                    int pipes[path_len - 1][2];
-                    for (int i = 0; i < path_len - 1; i++) {
-                        if (pipe(pipes[i]) < 0) exit(1);
-                    }
+/*
+ * Works out whether queued job j could start now, and where: its best idle
+ * printer outside skip and the printers held for the starving fan-out jobs
+ * that go before it.  Sets c->printer to -1 if it cannot start.
+ */
+static void find_candidate(int j, unsigned int skip, const int *starved, int num_starved,
+                           long long now, struct candidate *c) {
+    c->job = j;
+    c->printer = -1;
+    c->path = NULL;
+    if (job_status[j] != JOB_CREATED || job_sched[j].chunks_left > 0 || job_sched[j].retry_timer != NULL)
+        return;
 
-                    pid_t pids[path_len];
-                    for (int i = 0; i < path_len; i++) {
-                        pids[i] = fork();
-                        if (pids[i] < 0) exit(1);
-
-                        if (pids[i] == 0) {
-                            setpgid(0, pgid);  // ✅ join master's process group
-
-                            if (i == 0)
-                                dup2(in_fd, STDIN_FILENO);
-                            else
-                                dup2(pipes[i - 1][0], STDIN_FILENO);
-
-                            if (i == path_len - 1)
-                                dup2(printer_fd, STDOUT_FILENO);
-                            else
-                                dup2(pipes[i][1], STDOUT_FILENO);
-
-                            for (int k = 0; k < path_len - 1; k++) {
-                                close(pipes[k][0]);
-                                close(pipes[k][1]);
-                            }
-
-                            close(in_fd);
-                            close(printer_fd);
-                            execvp(path[i]->cmd_and_args[0], path[i]->cmd_and_args);
-                            exit(1);
-                        }
-                    }
+    c->starving = now - job_sched[j].queued_ms > STARVATION_MS;
+    for (int k = 0; k < num_starved; k++) {
+        int f = starved[k];
+        if (f != j && (job_sched[f].priority > job_sched[j].priority ||
+                       (job_sched[f].priority == job_sched[j].priority && (!c->starving || f < j))))
+            skip |= job_sched[f].fanout;
+    }
+    c->printer = best_printer(&jobs[j], skip, &c->path, &c->cost, &c->est_ms);
+}
 
-                    for (int i = 0; i < path_len - 1; i++) {
-                        close(pipes[i][0]);
-                        close(pipes[i][1]);
-                    }
+static void free_candidates(struct candidate *candidates) {
+    for (int j = 0; j < num_jobs; j++) {
+        if (candidates[j].printer >= 0)
+            free(candidates[j].path);
+        candidates[j].printer = -1;
+    }
+}
 
-                    close(in_fd);
-                    close(printer_fd);
+static void start_retry_ready(int arg) {
+    (void)arg;
+    start_retry = NULL;
+    dispatch_jobs();
+}
 
-                    int status, exit_status = 0;
-                    for (int i = 0; i < path_len; i++) {
-                        waitpid(pids[i], &status, 0);
-                        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
-                            exit_status = 1;
-                    }
+/*
+ * Gives preempted jobs their printers back as soon as these are idle again,
+ * before any queued job can take them.  A job is only continued once it has
+ * stopped: continuing it earlier would discard the pending stop.
+ */
+static void resume_preempted(void) {
+    for (int j = 0; j < num_jobs; j++) {
+        int p = jobs[j].preempted_on;
+        if (p < 0 || printers[p].status != PRINTER_IDLE || job_status[j] != JOB_PAUSED)
+            continue;
+        jobs[j].preempted_on = -1;
+        printers[p].status = PRINTER_BUSY;
+        printers[p].current_pid = job_pgid[j];
+        stats_printer_busy(p, 1);
+        sf_printer_status(printers[p].name, PRINTER_BUSY);
+        // The master reconnects to the printer and carries on where it stopped.
+        kill(-job_pgid[j], SIGCONT);
+        printf("JOB[%d]: resumed on printer=%s\n", jobs[j].id, printers[p].name);
+    }
+}
 
-                    exit(exit_status);
-                }
+/*
+ * Makes way for the most urgent queued job when no printer it may use is
+ * idle: a running job whose priority is at least preempt_gap lower is
+ * stopped and its printer handed over.  To keep jobs from thrashing, only a
+ * job that has run for preempt_min_run_ms and been preempted fewer than
+ * preempt_max times is a victim, the lowest priority first, and a printer
+ * makes way for one job at a time.  Returns 1 if a printer was freed.
+ */
+static int preempt_for_urgent(void) {
+    if (preempt_gap <= 0)
+        return 0;
+
+    int u = -1;
+    for (int j = 0; j < num_jobs; j++) {
+        if (job_status[j] != JOB_CREATED || job_sched[j].chunks_left > 0 ||
+            job_sched[j].retry_timer != NULL || job_sched[j].fanout != 0)
+            continue;
+        if (u < 0 || job_sched[j].priority > job_sched[u].priority)
+            u = j;
+    }
+    if (u < 0)
+        return 0;
+    for (int p = 0; p < num_printers; p++) {
+        if ((job_eligible[u] & (1U << p)) && printers[p].status == PRINTER_IDLE)
+            return 0;   // held back by the budget, which preempting would not free
+    }
+
+    int victim = -1, victim_printer = -1;
+    for (int p = 0; p < num_printers; p++) {
+        if (printers[p].status != PRINTER_BUSY || !(job_eligible[u] & (1U << p)))
+            continue;
+        int r = job_for_pgid(printers[p].current_pid);
+        if (r < 0 || job_status[r] != JOB_RUNNING || job_sched[r].fanout != 0 || jobs[r].copies > 1)
+            continue;
+        if (job_sched[u].priority < job_sched[r].priority + preempt_gap || jobs[r].preemptions >= preempt_max ||
+            job_runtime_ms(&jobs[r]) < preempt_min_run_ms)
+            continue;
+        int holding = 0;
+        for (int j = 0; j < num_jobs; j++)
+            holding |= jobs[j].preempted_on == p;
+        if (holding)
+            continue;
+        CONVERSION **path = find_route(jobs[u].type, printers[p].type);
+        if (path == NULL)
+            continue;
+        free(path);
+        if (victim < 0 || job_sched[r].priority < job_sched[victim].priority) {
+            victim = r;
+            victim_printer = p;
+        }
+    }
+    if (victim < 0)
+        return 0;
 
-                close(printer_fd);
-                setpgid(master, master); // Parent sets pgid for master too
-                jobs[j].pgid = master;   // ✅ Track pgid in parent
+    // The master gives up its connection and stops, with the rest of its
+    // group; reap_finished_jobs() sees it paused.
+    kill(-job_pgid[victim], SIGTSTP);
+    jobs[victim].preemptions++;
+    jobs[victim].preempted_on = victim_printer;
+    printf("JOB[%d]: preempted on printer=%s for job %d\n", jobs[victim].id,
+           printers[victim_printer].name, jobs[u].id);
+    release_printer(victim_printer);
+    return 1;
+}
 
-                jobs[j].status = JOB_RUNNING;
-                sf_job_status(jobs[j].id, JOB_RUNNING);
+/*
+ * Starts queued jobs on idle printers, within the limits on conversion
+ * processes and pipeline memory.  Higher priorities go first.  Within a
+ * priority, the job expected to finish first goes first (shortest expected
+ * processing time), on the printer where it is expected to finish first,
+ * which minimises the mean completion time.  While some job does not fit in
+ * what is left of the budget, the cheapest pipeline that fits goes first
+ * instead.  Jobs queued for longer than STARVATION_MS go before the others
+ * of their priority, in queue order, and a starving fan-out job has its
+ * printers held for it as they come free.  A job is always admitted when nothing
+ * else is running, so a pipeline larger than the whole budget does not wait
+ * forever.  When nothing can start, a more urgent job may preempt a running
+ * one.
+ */
+void dispatch_jobs(void) {
+    unsigned int unreachable = 0;   // printers that could not be connected to in this pass
+    resume_preempted();
 
-                printers[p].status = PRINTER_BUSY;
-                printers[p].current_pid = master;
-                sf_printer_status(printers[p].name, PRINTER_BUSY);
+    // The candidates are worked out once; starting a job only changes those
+    // that wanted one of the printers it took.
+    struct candidate candidates[MAX_JOBS];   // by job index; printer < 0: none
+    int starved[MAX_JOBS], num_starved = 0;
+    long long now = 0;
+    int rebuild = 1;
+    unsigned int taken = 0;   // printers taken since the candidates were worked out
+    for (;;) {
+        if (rebuild) {
+            now = timers_now_ms();
+            num_starved = starving_fanouts(starved, now);
+            for (int j = 0; j < num_jobs; j++)
+                find_candidate(j, unreachable, starved, num_starved, now, &candidates[j]);
+            rebuild = 0;
+        } else if (taken != 0) {
+            for (int j = 0; j < num_jobs; j++) {
+                struct candidate *c = &candidates[j];
+                if (c->printer < 0 || !(candidate_printers(c) & taken))
+                    continue;
+                free(c->path);
+                find_candidate(j, unreachable, starved, num_starved, now, c);
+            }
+        }
+        taken = 0;
 
-                int path_len = 0;
-                while (path[path_len]) path_len++;
+        // What fits changes with every job started.
+        struct pipeline_cost used;
+        int active = resources_in_use(&used);
+        int held = 0;
+        for (int j = 0; j < num_jobs; j++) {
+            struct candidate *c = &candidates[j];
+            if (c->printer < 0)
+                continue;
+            c->fits = active == 0 || (used.procs + c->cost.procs <= proc_budget() &&
+                                      (mem_limit_mb <= 0 || used.mem_mb + c->cost.mem_mb <= mem_limit_mb));
+            held |= !c->fits;
+        }
 
-                char *commands[path_len + 1];
-                for (int i = 0; i < path_len; i++)
-                    commands[i] = path[i]->cmd_and_args[0];
-                commands[path_len] = NULL;
+        struct candidate *best = NULL;
+        for (int j = 0; j < num_jobs; j++) {
+            struct candidate *c = &candidates[j];
+            if (c->printer >= 0 && c->fits && (best == NULL || candidate_better(c, best, held)))
+                best = c;
+        }
 
-                sf_job_started(jobs[j].id, printers[p].name, master, commands);
-                print_job_debug(&jobs[j], printers[p].name);
-                sf_cmd_ok();
-                free(path);
-                dispatched = 1;
-                break;
+        if (best == NULL) {
+            if (preempt_for_urgent()) {
+                free_candidates(candidates);
+                rebuild = 1;
+                continue;
             }
-            if (dispatched) break;
+            break;
         }
-    } while (dispatched);
+
+        struct job *job = &jobs[best->job];
+        job->est_ms = best->est_ms;
+        int failed_printer;
+        int started = start_job(job, best->printer, best->path, best->cost, &failed_printer);
+        taken = candidate_printers(best);
+        free(best->path);
+        best->printer = -1;
+        if (started < 0) {
+            // Nothing else may happen to dispatch the job again, so try
+            // later.  Meanwhile the other printers go on without the one
+            // that could not be reached.
+            if (start_retry == NULL)
+                start_retry = timer_add(START_RETRY_MS, start_retry_ready, 0);
+            if (failed_printer < 0)
+                break;
+            unreachable |= 1U << failed_printer;
+            taken = 1U << failed_printer;
+            find_candidate(best->job, unreachable, starved, num_starved, now, best);
+        }
+    }
+    free_candidates(candidates);
+
+    warm_idle_printers();
 }
 
 
+static void learn_from_job(struct job *job, pid_t master) {
+    if (job->copies > 1)
+        return;   // the estimates are for a single copy
+    for (int p = 0; p < num_printers; p++) {
+        if (printers[p].current_pid != master)
+            continue;
+        CONVERSION **path = find_route(job->type, printers[p].type);
+        if (path != NULL)
+            learn_job_ms(job, p, path, job_runtime_ms(job));
+        free(path);
+    }
+}
+
 void reap_finished_jobs(void) {
     int status;
     pid_t pid;
+    struct rusage ru;
 
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
         printf("[DEBUG] waitpid caught pid=%d, status=0x%x\n", pid, status);
+        if ((WIFEXITED(status) || WIFSIGNALED(status)) && warm_reaped(pid)) {
+            cgroup_warm_reaped(pid);
+            continue;
+        }
+        if ((WIFEXITED(status) || WIFSIGNALED(status)) && split_reaped(pid, status))
+            continue;
 
         for (int j = 0; j < num_jobs; j++) {
-            if (jobs[j].pgid == pid) {
+            if (job_pgid[j] == pid) {
                 printf("[DEBUG] Matched job[%d] with pgid=%d\n", j, pid);
 
+                if (WIFEXITED(status) || WIFSIGNALED(status)) {
+                    if (!jobs[j].terminating) {
+                        timer_cancel(jobs[j].watchdog);   // else SIGKILL is still due
+                        jobs[j].watchdog = NULL;
+                    }
+                    int finished = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                    stats_job_ended(finished ? job_runtime_ms(&jobs[j]) : -1, jobs[j].procs);
+                    for (int p = 0; p < num_printers; p++)
+                        if (printers[p].current_pid == pid)
+                            trace_job_ended(&jobs[j], p, status);
+                    if (job_sched[j].fanout != 0 || jobs[j].copies > 1)
+                        report_destinations(&jobs[j], pid);
+                    jobs[j].preempted_on = -1;
+                    cgroup_job_ended(&jobs[j], &ru);
+                }
+
                 if (WIFEXITED(status)) {
                     printf("[DEBUG] WIFEXITED with status=%d\n", WEXITSTATUS(status));
-                    if (WEXITSTATUS(status) == 0) {
-                        jobs[j].status = JOB_FINISHED;
+                    int requeued = WEXITSTATUS(status) == PIPELINE_DISCONNECTED &&
+                                   requeue_job(&jobs[j], pid);
+                    if (requeued) {
+                        // Back in the queue; only the printer is released below.
+                    } else if (WEXITSTATUS(status) == 0) {
+                        learn_from_job(&jobs[j], pid);
+                        set_job_status(j, JOB_FINISHED);
                         sf_job_status(jobs[j].id, JOB_FINISHED);
                         sf_job_finished(jobs[j].id, status);
                     } else {
-                        jobs[j].status = JOB_ABORTED;
+                        set_job_status(j, JOB_ABORTED);
                         sf_job_status(jobs[j].id, JOB_ABORTED);
                         sf_job_aborted(jobs[j].id, status);
                     }
-                    jobs[j].status_changed_at = time(NULL);
+                    if (!requeued) {
+                        stats_job_resources(jobs[j].type, jobs[j].cpu_us, jobs[j].mem_kb);
+                        jobs[j].status_changed_at = time(NULL);
+                        schedule_job_deletion(&jobs[j]);
+                        if (jobs[j].parent >= 0)
+                            split_chunk_done(&jobs[j]);
+                    }
 
                     for (int p = 0; p < num_printers; p++) {
                         if (printers[p].current_pid == pid) {
                             printf("[DEBUG] Releasing printer[%d] (%s) from job[%d]\n", p, printers[p].name, j);
-                            printers[p].status = PRINTER_IDLE;
-                            printers[p].current_pid = 0;
-                            sf_printer_status(printers[p].name, PRINTER_IDLE);
-                            break;
+                            release_printer(p);
                         }
                     }
 
                 } else if (WIFSIGNALED(status)) {
                     printf("[DEBUG] WIFSIGNALED for job[%d]\n", j);
-                    jobs[j].status = JOB_ABORTED;
+                    stats_job_resources(jobs[j].type, jobs[j].cpu_us, jobs[j].mem_kb);
+                    set_job_status(j, JOB_ABORTED);
                     jobs[j].status_changed_at = time(NULL);
                     sf_job_status(jobs[j].id, JOB_ABORTED);
                     sf_job_aborted(jobs[j].id, status);
+                    schedule_job_deletion(&jobs[j]);
+                    if (jobs[j].parent >= 0)
+                        split_chunk_done(&jobs[j]);
 
                     for (int p = 0; p < num_printers; p++) {
                         if (printers[p].current_pid == pid) {
                             printf("[DEBUG] Resetting printer[%d] (%s) after abort\n", p, printers[p].name);
-                            printers[p].status = PRINTER_IDLE;
-                            printers[p].current_pid = 0;
-                            sf_printer_status(printers[p].name, PRINTER_IDLE);
-                            break;
+                            release_printer(p);
                         }
                     }
 
                 } else if (WIFSTOPPED(status)) {
                     //printf("[DEBUG] WIFSTOPPED: job[%d] is now paused\n", j);
-                    jobs[j].status = JOB_PAUSED;
+                    set_job_status(j, JOB_PAUSED);
                     jobs[j].status_changed_at = time(NULL);
+                    if (jobs[j].paused_at_ms == 0)
+                        jobs[j].paused_at_ms = timers_now_ms();
                     //sf_job_status(jobs[j].id, JOB_PAUSED);
 
                 } else if (WIFCONTINUED(status)) {
                     //printf("[DEBUG] WIFCONTINUED: job[%d] is now running again\n", j);
-                    jobs[j].status = JOB_RUNNING;
+                    set_job_status(j, JOB_RUNNING);
                     jobs[j].status_changed_at = time(NULL);
+                    if (jobs[j].paused_at_ms > 0) {
+                        jobs[j].paused_total_ms += timers_now_ms() - jobs[j].paused_at_ms;
+                        jobs[j].paused_at_ms = 0;
+                    }
                     //sf_job_status(jobs[j].id, JOB_RUNNING);
                 }
 
@@ -262,21 +1126,52 @@ void reap_finished_jobs(void) {
 
 
 
-void delete_expired_jobs_if_needed(void) {
-    time_t now = time(NULL);
-    for (int i = 0; i < num_jobs;) {
-        if ((jobs[i].status == JOB_FINISHED || jobs[i].status == JOB_ABORTED) &&
-            difftime(now, jobs[i].status_changed_at) >= 10.0) {
+void set_job_retention(long ms) {
+    retention_ms = ms;
+}
+
+static void delete_job(int job_id) {
+    struct job *job = find_job(job_id);
+    if (job == NULL)
+        return;
+    job->expiry = NULL;
 
-            sf_job_deleted(jobs[i].id);
-            free(jobs[i].file);
+    // A cancelled job is kept until its processes have been reaped, which
+    // reschedules its deletion.
+    int i = job_index(job);
+    for (int p = 0; p < num_printers; p++) {
+        if (job_pgid[i] > 0 && printers[p].current_pid == job_pgid[i])
+            return;
+    }
 
-            for (int j = i + 1; j < num_jobs; j++)
-                jobs[j - 1] = jobs[j];
+    stats_job_status(job->type, job_status[i], JOB_DELETED);
+    sf_job_deleted(job->id);
+    if (job->owns_file)
+        split_remove_output(job);
+    timer_cancel(job_sched[i].retry_timer);
+    timer_cancel(job->watchdog);
+    if (job->terminating && job_pgid[i] > 0)
+        kill(-job_pgid[i], SIGKILL);   // its grace period is cut short
+    job_progress_free(job->progress);
+    cgroup_job_remove(job);
+    intern_release(job->file);
 
-            num_jobs--;
-        } else {
-            i++;
-        }
+    for (int j = i + 1; j < num_jobs; j++) {
+        jobs[j - 1] = jobs[j];
+        job_status[j - 1] = job_status[j];
+        job_eligible[j - 1] = job_eligible[j];
+        job_pgid[j - 1] = job_pgid[j];
+        job_sched[j - 1] = job_sched[j];
     }
+    num_jobs--;
+
+    // The freed slot goes to the oldest file waiting in the bulk backlog.
+    if (bulk_admit() > 0)
+        dispatch_jobs();
+}
+
+void schedule_job_deletion(struct job *job) {
+    timer_cancel(job->expiry);
+    job->expiry = timer_add(job->retention_ms >= 0 ? job->retention_ms : retention_ms,
+                            delete_job, job->id);
 }
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "estimate.h"
+#include "convattr.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "presi.h"
+#include "conversions.h"
+
+#define DEFAULT_RATE 1000.0    // assumed throughput of an unmeasured stage or printer, bytes per ms
+#define DEFAULT_SETUP_MS 200.0 // assumed set-up time of an unmeasured printer
+#define EWMA_WEIGHT 0.3        // weight of the newest sample
+#define SMALL_INPUT 65536      // inputs below this measure a start-up time
+
+static double printer_setup_ms[MAX_PRINTERS];   // 0 until measured
+static double printer_rate[MAX_PRINTERS];       // bytes per ms taken by the printer, 0 until measured
+
+static double ewma(double average, double sample, int first) {
+    return first ? sample : average + EWMA_WEIGHT * (sample - average);
+}
+
+off_t job_input_bytes(struct job *job) {
+    if (job->input_bytes > 0)
+        return job->input_bytes;
+    if (job->length >= 0) {
+        job->input_bytes = job->length;
+    } else {
+        struct stat st;
+        if (stat(job->file, &st) == 0)
+            job->input_bytes = st.st_size - job->offset;
+    }
+    return job->input_bytes;
+}
+
+static double stage_ms(const struct conversion_attrs *attrs, double bytes) {
+    return attrs->startup_ms + bytes / (attrs->rate > 0 ? attrs->rate : DEFAULT_RATE);
+}
+
+long long estimate_job_ms(struct job *job, int p, CONVERSION **path) {
+    double bytes = job_input_bytes(job);
+    double ms = 0;
+    for (int i = 0; path[i] != NULL; i++) {
+        double stage = stage_ms(conversion_attrs(path[i]), bytes);
+        if (stage > ms)
+            ms = stage;
+    }
+    // The printer takes the output while the stages still produce it, so
+    // the slower of the two sets the pace.
+    double relay = bytes / (printer_rate[p] > 0 ? printer_rate[p] : DEFAULT_RATE);
+    if (relay > ms)
+        ms = relay;
+    return (long long)((printer_setup_ms[p] > 0 ? printer_setup_ms[p] : DEFAULT_SETUP_MS) + ms);
+}
+
+void learn_job_ms(struct job *job, int p, CONVERSION **path, long long run_ms) {
+    double bytes = job_input_bytes(job);
+
+    for (int i = 0; i < 32 && path[i] != NULL; i++) {
+        if (job->progress == NULL || !(job->progress->stages_done & (1U << i)))
+            continue;
+        long long done = job->progress->stage_done_ms[i] - job->started_ms - job->paused_total_ms;
+        if (done < 1)
+            done = 1;
+        stats_conversion_ms(path[i], done);
+
+        struct conversion_attrs *attrs = find_conversion_attrs(path[i]->from, path[i]->to);
+        if (attrs == NULL)
+            continue;
+        if (bytes < SMALL_INPUT) {
+            attrs->startup_ms = ewma(attrs->startup_ms, done, attrs->startup_ms <= 0);
+        } else {
+            double busy = done - attrs->startup_ms;
+            attrs->rate = ewma(attrs->rate, bytes / (busy > 1 ? busy : 1), attrs->rate <= 0);
+        }
+    }
+
+    // The printer is measured like a stage, on the bytes it was sent: the
+    // converted output, less what a resumed job had delivered before.
+    if (job->progress == NULL)
+        return;
+    double sent = job->progress->delivered - job->checkpoint;
+    double relay = run_ms > 1 ? run_ms : 1;
+    if (sent < SMALL_INPUT) {
+        printer_setup_ms[p] = ewma(printer_setup_ms[p], relay, printer_setup_ms[p] <= 0);
+    } else {
+        double busy = relay - (printer_setup_ms[p] > 0 ? printer_setup_ms[p] : DEFAULT_SETUP_MS);
+        printer_rate[p] = ewma(printer_rate[p], sent / (busy > 1 ? busy : 1), printer_rate[p] <= 0);
+    }
+}
+
+void estimate_forget_printer(int p) {
+    printer_setup_ms[p] = 0;
+    printer_rate[p] = 0;
+}
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "forkserver.h"
+#include "pipeline.h"
+#include "policy.h"
+#include "cgroup.h"
+
+#define REQUEST_MAX 4096   // largest spawn request, command included
+
+/* Fixed part of a spawn request; the command follows as NUL-terminated strings. */
+struct spawn_request {
+    pid_t pgid;
+    int workers;
+    int pool;
+    struct sched_policy policy;
+    int argc;
+};
+
+/* A long-lived converter of a persistent conversion. */
+struct converter {
+    char *key;          // the command, NUL-separated, identifying the pool
+    size_t key_len;
+    pid_t pid;
+    int to_fd;          // its standard input
+    int from_fd;        // its standard output
+    int busy;           // lent to a running stage
+    int pool;           // idle converters of this command to keep
+};
+
+/* A stage started by the server, until its status is reported. */
+struct spawned {
+    pid_t pid;
+    int status_fd;
+    struct converter *conv;
+};
+
+static int server_fd = -1;   // spooler side; inherited by job masters
+
+static struct spawned *spawned;
+static int num_spawned = 0, spawned_cap = 0;
+static struct converter **converters;
+static int num_converters = 0, converters_cap = 0;
+static volatile sig_atomic_t got_sigchld = 0;
+
+static void server_sigchld(int sig) {
+    got_sigchld = 1;
+}
+
+// In a newly forked process: undoes the server's signal set-up, since ignored
+// signals and the mask survive execvp and a stage must die of SIGPIPE or ^C.
+static void reset_server_signals(void) {
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGIO, SIG_DFL);
+    signal(SIGALRM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+// In a newly forked process: drops every descriptor that belongs to the server.
+static void close_server_fds(struct converter *keep) {
+    close(server_fd);
+    for (int i = 0; i < num_spawned; i++)
+        close(spawned[i].status_fd);
+    for (int i = 0; i < num_converters; i++) {
+        if (converters[i] != keep) {
+            close(converters[i]->to_fd);
+            close(converters[i]->from_fd);
+        }
+    }
+}
+
+static void drop_converter(struct converter *c) {
+    close(c->to_fd);   // an idle converter exits at end of input
+    close(c->from_fd);
+    if (c->pid > 0)
+        kill(c->pid, SIGTERM);
+    for (int i = 0; i < num_converters; i++) {
+        if (converters[i] == c) {
+            converters[i] = converters[--num_converters];
+            break;
+        }
+    }
+    free(c->key);
+    free(c);
+}
+
+/*
+ * Starts a converter for a pool.  It keeps the scheduling policy of the stage
+ * that needed it for its whole life, even when later lent to other printers.
+ */
+static struct converter *start_converter(char **argv, char *key, size_t key_len,
+                                         const struct sched_policy *policy) {
+    if (num_converters == converters_cap) {
+        int cap = converters_cap ? converters_cap * 2 : 8;
+        struct converter **grown = realloc(converters, cap * sizeof(*grown));
+        if (grown == NULL) return NULL;
+        converters = grown;
+        converters_cap = cap;
+    }
+
+    int to[2], from[2];
+    if (pipe(to) < 0) return NULL;
+    if (pipe(from) < 0) {
+        close(to[0]); close(to[1]);
+        return NULL;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(to[0]); close(to[1]); close(from[0]); close(from[1]);
+        return NULL;
+    }
+    if (pid == 0) {
+        close_server_fds(NULL);
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+        close(to[0]); close(to[1]); close(from[0]); close(from[1]);
+        reset_server_signals();
+        apply_policy(policy);
+        execvp(argv[0], argv);
+        _exit(1);
+    }
+    close(to[0]);
+    close(from[1]);
+
+    struct converter *c = calloc(1, sizeof(*c));
+    c->key = malloc(key_len);
+    memcpy(c->key, key, key_len);
+    c->key_len = key_len;
+    c->pid = pid;
+    c->to_fd = to[1];
+    c->from_fd = from[0];
+    converters[num_converters++] = c;
+    return c;
+}
+
+static struct converter *borrow_converter(char **argv, char *key, size_t key_len,
+                                          const struct sched_policy *policy) {
+    for (int i = 0; i < num_converters; i++) {
+        struct converter *c = converters[i];
+        if (!c->busy && c->key_len == key_len && memcmp(c->key, key, key_len) == 0) {
+            c->busy = 1;
+            return c;
+        }
+    }
+    struct converter *c = start_converter(argv, key, key_len, policy);
+    if (c != NULL)
+        c->busy = 1;
+    return c;
+}
+
+static void return_converter(struct converter *c, int ok) {
+    int idle = 0;
+    for (int i = 0; i < num_converters; i++) {
+        if (!converters[i]->busy && converters[i]->key_len == c->key_len &&
+            memcmp(converters[i]->key, c->key, c->key_len) == 0)
+            idle++;
+    }
+    if (!ok || idle >= c->pool)
+        drop_converter(c);
+    else
+        c->busy = 0;
+}
+
+static void handle_request(char *buf, size_t len, int fds[3]) {
+    struct spawn_request req;
+    memcpy(&req, buf, sizeof(req));
+    char *key = buf + sizeof(req);
+    size_t key_len = len - sizeof(req);
+
+    char *argv[req.argc + 1];
+    char *p = key;
+    for (int i = 0; i < req.argc; i++) {
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+    argv[req.argc] = NULL;
+
+    struct converter *conv = NULL;
+    pid_t pid = -1;
+    if (req.pool > 0 && (conv = borrow_converter(argv, key, key_len, &req.policy)) != NULL)
+        conv->pool = req.pool;
+
+    if (num_spawned == spawned_cap) {
+        int cap = spawned_cap ? spawned_cap * 2 : 16;
+        struct spawned *grown = realloc(spawned, cap * sizeof(*grown));
+        if (grown != NULL) {
+            spawned = grown;
+            spawned_cap = cap;
+        }
+    }
+
+    if ((req.pool == 0 || conv != NULL) && num_spawned < spawned_cap)
+        pid = fork();
+    if (pid == 0) {
+        close_server_fds(conv);
+        setpgid(0, req.pgid);
+        if (conv == NULL)
+            cgroup_join_leader(req.pgid);   // a persistent converter serves many jobs
+        reset_server_signals();
+
+        dup2(fds[0], STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        close(fds[2]);
+
+        apply_policy(&req.policy);
+        if (conv != NULL)
+            _exit(run_persistent_stage(conv->to_fd, conv->from_fd) == 0 ? 0 : 1);
+        if (req.workers > 1)
+            run_fanned_stage(argv, req.workers);
+        execvp(argv[0], argv);
+        _exit(1);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    if (write(fds[2], &pid, sizeof(pid)) != sizeof(pid)) {
+        // The master is gone; the stage will fail on its closed pipes.
+    }
+    if (pid < 0) {
+        close(fds[2]);
+        if (conv != NULL)
+            return_converter(conv, 1);   // never used
+        return;
+    }
+    spawned[num_spawned++] = (struct spawned){ pid, fds[2], conv };
+}
+
+static void reap(void) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < num_spawned; i++) {
+            if (spawned[i].pid != pid)
+                continue;
+            if (write(spawned[i].status_fd, &status, sizeof(status)) < 0) {
+                // The master is gone; nobody is waiting for this status.
+            }
+            close(spawned[i].status_fd);
+            if (spawned[i].conv != NULL) {
+                int ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                return_converter(spawned[i].conv, ok);
+            }
+            spawned[i] = spawned[--num_spawned];
+            break;
+        }
+        for (int i = 0; i < num_converters; i++) {
+            if (converters[i]->pid == pid) {
+                converters[i]->pid = -1;   // already reaped; keep kill() away from a reused pid
+                if (!converters[i]->busy)
+                    drop_converter(converters[i]);
+                break;
+            }
+        }
+    }
+}
+
+static void serve(void) {
+    sigset_t mask, oldmask;
+    sigemptyset(&oldmask);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    struct sigaction sa;
+    sa.sa_handler = server_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGIO, SIG_IGN);
+    signal(SIGALRM, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (1) {
+        if (got_sigchld) {
+            got_sigchld = 0;
+            reap();
+        }
+
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(server_fd, &rfds);
+        // Wait with SIGCHLD unblocked so stage exits are reported promptly.
+        if (pselect(server_fd + 1, &rfds, NULL, NULL, NULL, &oldmask) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        char buf[REQUEST_MAX];
+        char control[CMSG_SPACE(3 * sizeof(int))];
+        struct iovec iov = { buf, sizeof(buf) };
+        struct msghdr msg = { 0 };
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(server_fd, &msg, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;   // the spooler and all masters have exited
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+            continue;
+        int fds[3];
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        // Converters started for this request must not inherit them.
+        for (int i = 0; i < 3; i++)
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        if ((size_t)n < sizeof(struct spawn_request)) {
+            close(fds[0]); close(fds[1]); close(fds[2]);
+            continue;
+        }
+        handle_request(buf, n, fds);
+    }
+
+    while (num_converters > 0)
+        drop_converter(converters[0]);
+    _exit(0);
+}
+
+void forkserver_init(void) {
+    if (getenv("PRESI_FORKSERVER") == NULL)
+        return;
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        perror("socketpair");
+        return;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        server_fd = sv[1];
+        serve();
+    }
+    close(sv[1]);
+    server_fd = sv[0];
+    fcntl(server_fd, F_SETFD, FD_CLOEXEC);
+}
+
+int forkserver_enabled(void) {
+    return server_fd >= 0;
+}
+
+pid_t forkserver_spawn(char **cmd_and_args, int workers, int pool,
+                       const struct sched_policy *policy, pid_t pgid,
+                       int in_fd, int out_fd, int *status_fd) {
+    char buf[REQUEST_MAX];
+    struct spawn_request req = { pgid, workers, pool, *policy, 0 };
+    size_t len = sizeof(req);
+    for (; cmd_and_args[req.argc] != NULL; req.argc++) {
+        size_t arg_len = strlen(cmd_and_args[req.argc]) + 1;
+        if (len + arg_len > sizeof(buf))
+            return -1;
+        memcpy(buf + len, cmd_and_args[req.argc], arg_len);
+        len += arg_len;
+    }
+    memcpy(buf, &req, sizeof(req));
+
+    int status_pipe[2];
+    if (pipe(status_pipe) < 0)
+        return -1;
+
+    int fds[3] = { in_fd, out_fd, status_pipe[1] };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { buf, len };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    while ((sent = sendmsg(server_fd, &msg, 0)) < 0 && errno == EINTR)
+        ;
+    close(status_pipe[1]);
+    if (sent < 0) {
+        close(status_pipe[0]);
+        return -1;
+    }
+
+    pid_t pid;
+    ssize_t n;
+    while ((n = read(status_pipe[0], &pid, sizeof(pid))) < 0 && errno == EINTR)
+        ;
+    if (n != sizeof(pid) || pid < 0) {
+        close(status_pipe[0]);
+        return -1;
+    }
+    *status_fd = status_pipe[0];
+    return pid;
+}
@@ -8,4 +8,9 @@ int num_printers = 0;
 struct job jobs[MAX_JOBS];
 int num_jobs = 0;
 
+JOB_STATUS job_status[MAX_JOBS];
+unsigned int job_eligible[MAX_JOBS];
+pid_t job_pgid[MAX_JOBS];
+struct job_sched job_sched[MAX_JOBS];
+
 int next_job_id = 0;
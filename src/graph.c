@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "graph.h"
+#include "conversions.h"
+#include "registry.h"
+
+/* A cached path; path is NULL when there is no path between the types. */
+struct route {
+    int known;
+    CONVERSION **path;
+};
+
+static FILE_TYPE **types;
+static int num_types = 0, types_cap = 0;
+static struct registry *type_names;   // type name -> index in types
+static CONVERSION **convs;
+static int num_convs = 0, convs_cap = 0;
+
+static struct route *routes;   // routes_dim x routes_dim, by type index
+static int routes_dim = 0;
+
+static int grow(void **array, int *cap, int count, size_t size) {
+    if (count < *cap)
+        return 0;
+    int new_cap = *cap ? *cap * 2 : 16;
+    void *grown = realloc(*array, new_cap * size);
+    if (grown == NULL)
+        return -1;
+    *array = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static void clear_routes(void) {
+    for (int i = 0; i < routes_dim * routes_dim; i++) {
+        free(routes[i].path);
+        routes[i].path = NULL;
+        routes[i].known = 0;
+    }
+}
+
+/* Returns the cache entry for a pair of types, or NULL if it cannot be cached. */
+static struct route *route_entry(FILE_TYPE *from, FILE_TYPE *to) {
+    int need = (from->index > to->index ? from->index : to->index) + 1;
+    if (from->index < 0 || to->index < 0)
+        return NULL;
+    if (need > routes_dim) {
+        int dim = routes_dim ? routes_dim : 16;
+        while (dim < need)
+            dim *= 2;
+        struct route *grown = calloc((size_t)dim * dim, sizeof(*grown));
+        if (grown == NULL)
+            return NULL;
+        for (int i = 0; i < routes_dim; i++)
+            memcpy(&grown[i * dim], &routes[i * routes_dim], routes_dim * sizeof(*grown));
+        free(routes);
+        routes = grown;
+        routes_dim = dim;
+    }
+    return &routes[from->index * routes_dim + to->index];
+}
+
+static CONVERSION **copy_path(CONVERSION **path) {
+    int len = 0;
+    while (path[len] != NULL) len++;
+    CONVERSION **copy = malloc((len + 1) * sizeof(*copy));
+    if (copy != NULL)
+        memcpy(copy, path, (len + 1) * sizeof(*copy));
+    return copy;
+}
+
+void graph_add_type(FILE_TYPE *type) {
+    if (graph_find_type(type->name) == type)
+        return;
+    if (type_names == NULL && (type_names = registry_new()) == NULL)
+        return;
+    if (grow((void **)&types, &types_cap, num_types, sizeof(*types)) == 0 &&
+        registry_put(type_names, type->name, num_types) == 0)
+        types[num_types++] = type;
+}
+
+FILE_TYPE *graph_find_type(const char *name) {
+    int i = type_names ? registry_get(type_names, name) : -1;
+    return i >= 0 ? types[i] : NULL;
+}
+
+void graph_add_conversion(CONVERSION *conv) {
+    clear_routes();
+    for (int i = 0; i < num_convs; i++) {
+        if (convs[i]->from == conv->from && convs[i]->to == conv->to) {
+            convs[i] = conv;
+            return;
+        }
+    }
+    if (grow((void **)&convs, &convs_cap, num_convs, sizeof(*convs)) == 0)
+        convs[num_convs++] = conv;
+}
+
+int graph_types(FILE_TYPE ***out) {
+    *out = types;
+    return num_types;
+}
+
+int graph_conversions(CONVERSION ***out) {
+    *out = convs;
+    return num_convs;
+}
+
+CONVERSION **find_route(FILE_TYPE *from, FILE_TYPE *to) {
+    struct route *r = route_entry(from, to);
+    if (r != NULL && r->known)
+        return r->path ? copy_path(r->path) : NULL;
+
+    CONVERSION **path = find_conversion_path(from->name, to->name);
+    if (r != NULL) {
+        r->known = 1;
+        r->path = path ? copy_path(path) : NULL;
+    }
+    return path;
+}
+
+void set_route(FILE_TYPE *from, FILE_TYPE *to, CONVERSION **path) {
+    struct route *r = route_entry(from, to);
+    if (r == NULL)
+        return;
+    free(r->path);
+    r->known = 1;
+    r->path = path ? copy_path(path) : NULL;
+}
@@ -0,0 +1,100 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+struct interned {
+    struct interned *next;   // in the same bucket
+    unsigned int hash;
+    int refs;
+    char str[];
+};
+
+static struct interned **buckets;
+static unsigned int num_buckets = 0, num_strings = 0;
+
+static unsigned int hash_string(const char *s) {
+    unsigned int h = 2166136261u;   // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct interned *find(const char *s, unsigned int hash) {
+    if (num_buckets == 0)
+        return NULL;
+    for (struct interned *e = buckets[hash & (num_buckets - 1)]; e != NULL; e = e->next) {
+        if (e->hash == hash && strcmp(e->str, s) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+/* Doubles the bucket array once the table is three quarters full. */
+static int grow(void) {
+    if (num_buckets > 0 && num_strings < num_buckets / 4 * 3)
+        return 0;
+    unsigned int n = num_buckets ? num_buckets * 2 : 64;
+    struct interned **grown = calloc(n, sizeof(*grown));
+    if (grown == NULL)
+        return num_buckets > 0 ? 0 : -1;   // a full table still works
+    for (unsigned int b = 0; b < num_buckets; b++) {
+        struct interned *e = buckets[b];
+        while (e != NULL) {
+            struct interned *next = e->next;
+            e->next = grown[e->hash & (n - 1)];
+            grown[e->hash & (n - 1)] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = grown;
+    num_buckets = n;
+    return 0;
+}
+
+char *intern(const char *s) {
+    unsigned int hash = hash_string(s);
+    struct interned *e = find(s, hash);
+    if (e != NULL) {
+        e->refs++;
+        return e->str;
+    }
+
+    if (grow() < 0)
+        return NULL;
+    size_t len = strlen(s);
+    e = malloc(sizeof(*e) + len + 1);
+    if (e == NULL)
+        return NULL;
+    e->hash = hash;
+    e->refs = 1;
+    memcpy(e->str, s, len + 1);
+    e->next = buckets[hash & (num_buckets - 1)];
+    buckets[hash & (num_buckets - 1)] = e;
+    num_strings++;
+    return e->str;
+}
+
+char *intern_lookup(const char *s) {
+    struct interned *e = find(s, hash_string(s));
+    return e ? e->str : NULL;
+}
+
+void intern_release(char *s) {
+    if (s == NULL)
+        return;
+    struct interned *e = (struct interned *)(s - offsetof(struct interned, str));
+    if (--e->refs > 0)
+        return;
+
+    struct interned **link = &buckets[e->hash & (num_buckets - 1)];
+    while (*link != e)
+        link = &(*link)->next;
+    *link = e->next;
+    num_strings--;
+    free(e);
+}
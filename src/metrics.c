@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "stats.h"
+#include "timers.h"
+
+#define MAX_CLIENTS 8
+#define SEND_TIMEOUT_S 2    // longest a response may wait for a client to read
+
+static int listen_fd = -1;
+static int clients[MAX_CLIENTS];
+static int nclients;
+static char *socket_path;
+static char *file_path;
+static long file_interval_ms;
+static struct timer *file_timer;
+
+int metrics_serve(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+    // Connections raise SIGIO, like the shard sockets.
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETOWN, getpid());
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK | O_ASYNC);
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        if (strcmp(socket_path, path) != 0)
+            unlink(socket_path);
+    }
+    free(socket_path);
+    listen_fd = fd;
+    socket_path = strdup(path);
+    return 0;
+}
+
+/* Sends all of buf, without SIGPIPE if the client has gone.  Returns 0 if successful. */
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void answer(int fd) {
+    char *body;
+    size_t len;
+    FILE *out = open_memstream(&body, &len);
+    if (out == NULL)
+        return;
+    stats_export(out);
+    fclose(out);
+
+    char header[128];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n\r\n", len);
+    // The response may not fit in the socket buffer, so it is sent blocking,
+    // but a client that stops reading only holds the spooler up so long.
+    struct timeval timeout = { SEND_TIMEOUT_S, 0 };
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (send_all(fd, header, header_len) == 0)
+        send_all(fd, body, len);
+    free(body);
+}
+
+/*
+ * Reads what a client sent.  The request does not matter (every path gets
+ * the metrics), but answering before it arrives would make the client fail
+ * to send it.
+ *
+ * @return 1 if the client is done with the connection, 0 if it sent nothing yet.
+ */
+static int client_ready(int fd) {
+    char request[1024];
+    ssize_t n;
+    int got = 0;
+    while ((n = recv(fd, request, sizeof(request), 0)) > 0)
+        got = 1;
+    if (got)
+        answer(fd);
+    return got || n == 0 || errno != EAGAIN;
+}
+
+void metrics_poll(void) {
+    for (int i = 0; i < nclients; ) {
+        if (client_ready(clients[i])) {
+            close(clients[i]);
+            clients[i] = clients[--nclients];
+        } else {
+            i++;
+        }
+    }
+    if (listen_fd < 0)
+        return;
+    int fd;
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETOWN, getpid());
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK | O_ASYNC);
+        if (client_ready(fd)) {
+            close(fd);
+        } else if (nclients < MAX_CLIENTS) {
+            clients[nclients++] = fd;
+        } else {
+            close(fd);
+        }
+    }
+}
+
+static int write_file(void) {
+    char tmp[strlen(file_path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file_path);
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL)
+        return -1;
+    stats_export(out);
+    if (fclose(out) != 0 || rename(tmp, file_path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void file_tick(int arg) {
+    (void)arg;
+    file_timer = timer_add(file_interval_ms, file_tick, 0);
+    if (write_file() < 0)
+        fprintf(stderr, "metrics: cannot write %s: %s\n", file_path, strerror(errno));
+}
+
+int metrics_write_file(const char *path, long interval_ms) {
+    timer_cancel(file_timer);
+    file_timer = NULL;
+    free(file_path);
+    file_path = strdup(path);
+    file_interval_ms = interval_ms;
+    if (file_path == NULL || write_file() < 0)
+        return -1;
+    file_timer = timer_add(file_interval_ms, file_tick, 0);
+    return 0;
+}
+
+void metrics_stop(void) {
+    while (nclients > 0)
+        close(clients[--nclients]);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+        listen_fd = -1;
+    }
+    free(socket_path);
+    socket_path = NULL;
+    timer_cancel(file_timer);
+    file_timer = NULL;
+    free(file_path);
+    file_path = NULL;
+}
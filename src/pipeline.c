@@ -0,0 +1,1021 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+
+#include "pipeline.h"
+#include "convattr.h"
+#include "forkserver.h"
+#include "policy.h"
+#include "timers.h"
+#include "uring.h"
+#include "globals.h"
+#include "presi.h"
+#include "conversions.h"
+
+#define FAN_CHUNK (256 * 1024)   // input per worker per round of a fanned stage
+#define FRAME_MAX 65536           // largest frame sent to a persistent converter
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int use_uring = 0;   // feeders read through io_uring
+
+void set_input_feeder(int uring) {
+    use_uring = uring;
+}
+
+int input_feeder_uses_uring(void) {
+    return use_uring;
+}
+
+/*
+ * Copies length bytes (or everything, if length < 0) of in_fd starting at
+ * offset into out_fd, through io_uring if enabled and available, else with
+ * plain reads, counting them in progress->consumed.  Never returns.
+ */
+static void feed(int in_fd, off_t offset, off_t length, int out_fd,
+                 struct job_progress *progress) {
+    volatile long long *consumed = progress != NULL ? &progress->consumed : NULL;
+
+    // Tell the kernel to read ahead aggressively and start on the range now.
+    posix_fadvise(in_fd, offset, length > 0 ? length : 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(in_fd, offset, length > 0 ? length : 0, POSIX_FADV_WILLNEED);
+
+    if (use_uring) {
+        int result = uring_copy(in_fd, offset, length, out_fd, consumed);
+        if (result != URING_UNAVAILABLE)
+            _exit(result == 0 ? 0 : 1);
+    }
+
+    if (offset > 0 && lseek(in_fd, offset, SEEK_SET) < 0) _exit(1);
+
+    char buf[8192];
+    while (length != 0) {
+        size_t want = length > 0 && length < (off_t)sizeof(buf) ? (size_t)length : sizeof(buf);
+        ssize_t n = read(in_fd, buf, want);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 || (n == 0 && length > 0)) _exit(1);
+        if (n == 0) break;
+        if (write_all(out_fd, buf, n) < 0) _exit(1);
+        if (consumed != NULL) *consumed += n;
+        if (length > 0) length -= n;
+    }
+    _exit(0);
+}
+
+struct fan_worker {
+    pid_t pid;
+    int in_fd;            // write end of the worker's stdin, -1 once closed
+    int out_fd;           // read end of the worker's stdout, -1 at EOF
+    const char *in;       // input chunk not yet written
+    size_t in_len;
+    char *out;            // output collected so far
+    size_t out_len, out_cap;
+};
+
+/*
+ * Runs one round of a fanned stage: every chunk is converted by its own worker
+ * process and the outputs are written to stdout in chunk order.
+ */
+static int fan_round(char **cmd_and_args, char **chunk, size_t *chunk_len, int nchunks) {
+    struct fan_worker w[nchunks];
+    memset(w, 0, sizeof(w));
+
+    for (int i = 0; i < nchunks; i++) {
+        int in[2], out[2];
+        if (pipe(in) < 0 || pipe(out) < 0) return -1;
+
+        w[i].pid = fork();
+        if (w[i].pid < 0) return -1;
+        if (w[i].pid == 0) {
+            dup2(in[0], STDIN_FILENO);
+            dup2(out[1], STDOUT_FILENO);
+            close(in[0]); close(in[1]);
+            close(out[0]); close(out[1]);
+            for (int k = 0; k < i; k++) {
+                if (w[k].in_fd >= 0) close(w[k].in_fd);
+                close(w[k].out_fd);
+            }
+            signal(SIGPIPE, SIG_DFL);
+            execvp(cmd_and_args[0], cmd_and_args);
+            _exit(1);
+        }
+
+        close(in[0]);
+        close(out[1]);
+        w[i].in_fd = in[1];
+        w[i].out_fd = out[0];
+        w[i].in = chunk[i];
+        w[i].in_len = chunk_len[i];
+        fcntl(w[i].in_fd, F_SETFL, O_NONBLOCK);
+        if (w[i].in_len == 0) {
+            close(w[i].in_fd);
+            w[i].in_fd = -1;
+        }
+    }
+
+    // Feed all workers and drain their output concurrently, so that a worker
+    // blocked on a full output pipe can never stall the others.
+    while (1) {
+        struct pollfd pfd[2 * nchunks];
+        int who[2 * nchunks];
+        int n = 0;
+        for (int i = 0; i < nchunks; i++) {
+            if (w[i].in_fd >= 0) {
+                pfd[n] = (struct pollfd){ .fd = w[i].in_fd, .events = POLLOUT };
+                who[n++] = i;
+            }
+            if (w[i].out_fd >= 0) {
+                pfd[n] = (struct pollfd){ .fd = w[i].out_fd, .events = POLLIN };
+                who[n++] = i;
+            }
+        }
+        if (n == 0) break;
+
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        for (int k = 0; k < n; k++) {
+            struct fan_worker *fw = &w[who[k]];
+            if (pfd[k].revents == 0) continue;
+
+            if (pfd[k].fd == fw->in_fd) {
+                ssize_t put = write(fw->in_fd, fw->in, fw->in_len);
+                if (put > 0) {
+                    fw->in += put;
+                    fw->in_len -= put;
+                }
+                if ((put < 0 && errno != EAGAIN && errno != EINTR) || fw->in_len == 0) {
+                    close(fw->in_fd);
+                    fw->in_fd = -1;
+                }
+            } else {
+                if (fw->out_len == fw->out_cap) {
+                    fw->out_cap = fw->out_cap ? fw->out_cap * 2 : 65536;
+                    fw->out = realloc(fw->out, fw->out_cap);
+                    if (fw->out == NULL) return -1;
+                }
+                ssize_t got = read(fw->out_fd, fw->out + fw->out_len, fw->out_cap - fw->out_len);
+                if (got > 0) {
+                    fw->out_len += got;
+                } else if (got == 0 || errno != EINTR) {
+                    close(fw->out_fd);
+                    fw->out_fd = -1;
+                }
+            }
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < nchunks; i++) {
+        int status;
+        if (waitpid(w[i].pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+        if (!failed && write_all(STDOUT_FILENO, w[i].out, w[i].out_len) < 0)
+            failed = 1;
+        free(w[i].out);
+    }
+    return failed ? -1 : 0;
+}
+
+void run_fanned_stage(char **cmd_and_args, int workers) {
+    size_t cap = (size_t)workers * FAN_CHUNK;
+    char *buf = malloc(cap);
+    size_t len = 0;
+    int eof = 0;
+
+    if (buf == NULL) _exit(1);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!eof || len > 0) {
+        while (!eof && len < cap) {
+            ssize_t n = read(STDIN_FILENO, buf + len, cap - len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                _exit(1);
+            }
+            if (n == 0) eof = 1;
+            len += n;
+        }
+        if (len == 0) break;
+
+        // Only whole lines are converted this round unless input has ended.
+        size_t usable = len;
+        if (!eof) {
+            char *last_nl = NULL;
+            for (char *p = buf + len; p > buf; p--) {
+                if (p[-1] == '\n') { last_nl = p; break; }
+            }
+            if (last_nl != NULL) usable = last_nl - buf;
+        }
+
+        char *chunk[workers];
+        size_t chunk_len[workers];
+        int nchunks = 0;
+        size_t target = (usable + workers - 1) / workers;
+        size_t pos = 0;
+        while (pos < usable && nchunks < workers) {
+            size_t end = pos + target;
+            if (end >= usable || nchunks == workers - 1) {
+                end = usable;
+            } else {
+                char *nl = memchr(buf + end, '\n', usable - end);
+                end = nl ? (size_t)(nl - buf) + 1 : usable;
+            }
+            chunk[nchunks] = buf + pos;
+            chunk_len[nchunks++] = end - pos;
+            pos = end;
+        }
+
+        if (fan_round(cmd_and_args, chunk, chunk_len, nchunks) < 0)
+            _exit(1);
+
+        memmove(buf, buf + usable, len - usable);
+        len -= usable;
+    }
+    _exit(0);
+}
+
+int run_persistent_stage(int to_conv, int from_conv) {
+    char in[FRAME_MAX + 32];     // frame being written to the converter
+    size_t in_len = 0, in_off = 0;
+    int in_eof = 0;
+    char header[32];             // length line of the frame being read
+    size_t header_len = 0;
+    long long body_left = -1;    // bytes of the current output frame still to copy
+
+    signal(SIGPIPE, SIG_IGN);
+    fcntl(to_conv, F_SETFL, O_NONBLOCK);
+
+    while (1) {
+        struct pollfd pfd[2];
+        int n = 0, in_idx = -1;
+        if (in_off < in_len || !in_eof) {
+            pfd[n] = (struct pollfd){ .fd = in_off < in_len ? to_conv : STDIN_FILENO,
+                                      .events = in_off < in_len ? POLLOUT : POLLIN };
+            in_idx = n++;
+        }
+        pfd[n++] = (struct pollfd){ .fd = from_conv, .events = POLLIN };
+
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        if (in_idx >= 0 && pfd[in_idx].revents) {
+            if (in_off < in_len) {
+                ssize_t put = write(to_conv, in + in_off, in_len - in_off);
+                if (put < 0 && errno != EAGAIN && errno != EINTR)
+                    return -1;
+                if (put > 0) in_off += put;
+            } else {
+                ssize_t got = read(STDIN_FILENO, in + 32, FRAME_MAX);
+                if (got < 0 && errno != EINTR)
+                    return -1;
+                if (got >= 0) {
+                    // The length line goes right in front of the data.
+                    char len_line[32];
+                    int hl = snprintf(len_line, sizeof(len_line), "%zd\n", got);
+                    memcpy(in + 32 - hl, len_line, hl);
+                    memmove(in, in + 32 - hl, hl + got);
+                    in_len = hl + got;
+                    in_off = 0;
+                    if (got == 0) in_eof = 1;
+                }
+            }
+        }
+
+        if (pfd[n - 1].revents) {
+            char buf[65536];
+            ssize_t got = read(from_conv, buf, sizeof(buf));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0)
+                return -1;   // the converter went away mid-document
+
+            for (char *p = buf; p < buf + got; ) {
+                if (body_left > 0) {
+                    size_t take = buf + got - p < body_left ? (size_t)(buf + got - p) : (size_t)body_left;
+                    if (write_all(STDOUT_FILENO, p, take) < 0)
+                        return -1;
+                    p += take;
+                    body_left -= take;
+                    continue;
+                }
+                if (*p != '\n') {
+                    if (header_len == sizeof(header) - 1)
+                        return -1;
+                    header[header_len++] = *p++;
+                    continue;
+                }
+                p++;
+                header[header_len] = '\0';
+                header_len = 0;
+                body_left = atoll(header);
+                if (body_left == 0)
+                    // End of the converted document; anything after it is a protocol error.
+                    return in_eof && in_off == in_len && p == buf + got ? 0 : -1;
+            }
+        }
+    }
+}
+
+struct job_progress *job_progress_alloc(void) {
+    void *p = mmap(NULL, sizeof(struct job_progress), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    memset(p, 0, sizeof(struct job_progress));
+    return p;
+}
+
+void job_progress_free(struct job_progress *p) {
+    if (p != NULL)
+        munmap(p, sizeof(*p));
+}
+
+/*
+ * A descriptor sharing the file offset of the job's file that the first stage
+ * reads directly, or -1 if a feeder process reads it.
+ */
+static int input_pos_fd = -1;
+
+/* Publishes how far the first stage has read the job's file, if it reads it. */
+static void note_consumed(struct job_progress *progress) {
+    if (input_pos_fd < 0 || progress == NULL)
+        return;
+    off_t pos = lseek(input_pos_fd, 0, SEEK_CUR);
+    if (pos >= 0)
+        progress->consumed = pos;
+}
+
+/* The printer a master relays to, for reconnecting after a preemption. */
+static char *relay_printer;
+static char *relay_type;
+static int relay_flags;
+static volatile sig_atomic_t yield_requested = 0;
+
+/* The spooler preempts a job with SIGTSTP to its process group. */
+static void master_sigtstp(int sig) {
+    yield_requested = 1;
+}
+
+/*
+ * Gives up the printer while the job is preempted: closes the connection,
+ * so that the printer daemon can serve the urgent job, and stops until the
+ * spooler continues the job.  Returns the new connection, or -1 if the
+ * printer cannot be reached.
+ */
+static int yield_printer(int printer_fd) {
+    yield_requested = 0;
+    close(printer_fd);
+    kill(getpid(), SIGSTOP);
+    return presi_connect_to_printer(relay_printer, relay_type, relay_flags);
+}
+
+/*
+ * Copies the final pipeline output to the printer, discarding the first
+ * `skip` bytes (already delivered before a disconnect).  The rest of the
+ * output goes on a new connection if the job is preempted meanwhile, which
+ * *printer_fd is updated to.  Returns 0 at end of input, or -1 if the
+ * printer connection failed.
+ */
+static int relay_output(int from_fd, int *printer_fd, off_t skip, struct job_progress *progress) {
+    char buf[65536];
+    long long offset = 0;
+
+    while (1) {
+        if (yield_requested && (*printer_fd = yield_printer(*printer_fd)) < 0)
+            return -1;
+        ssize_t n = read(from_fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;   // a stage failed; its exit status tells the story
+        }
+        note_consumed(progress);
+        if (n == 0)
+            return 0;
+
+        char *data = buf;
+        if (offset < skip) {
+            long long drop = skip - offset < n ? skip - offset : n;
+            offset += drop;
+            data += drop;
+            n -= drop;
+        }
+        while (n > 0) {
+            if (yield_requested && (*printer_fd = yield_printer(*printer_fd)) < 0)
+                return -1;
+            ssize_t w = write(*printer_fd, data, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            data += w;
+            n -= w;
+            offset += w;
+            if (progress != NULL)
+                progress->delivered = offset;
+        }
+    }
+}
+
+/*
+ * Interposes a feeder process (in the job's process group) that copies the
+ * job's byte range, or the whole file if length < 0, into a pipe.  Returns
+ * the descriptor the first stage should read from.
+ */
+static int open_range(int in_fd, off_t offset, off_t length, struct job_progress *progress) {
+    int fds[2];
+    if (pipe(fds) < 0) return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        close(fds[0]);
+        feed(in_fd, offset, length, fds[1], progress);
+    }
+
+    close(fds[1]);
+    close(in_fd);
+    return fds[0];
+}
+
+static pid_t *stage_pids;
+static int *stage_status;     // per stage: fork server status descriptor, or -1
+static int num_stages;
+static struct job_progress *stage_progress;
+static const struct sched_policy *stage_printer_policy;   // of the printer the stages feed
+static volatile sig_atomic_t children_failed = 0;
+
+static void stage_exited(int i, int status) {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        children_failed = 1;
+    if (i < 32 && stage_progress != NULL) {
+        stage_progress->stage_done_ms[i] = timers_now_ms();
+        stage_progress->stages_done |= 1U << i;
+    }
+}
+
+/*
+ * The master reaps its children as they exit, so that the spooler's watchdog
+ * can see (through the progress record) which stages are still running.
+ */
+static void master_sigchld(int sig) {
+    int saved_errno = errno;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        int stage = -1;
+        for (int i = 0; i < num_stages; i++) {
+            if (stage_pids[i] == pid && stage_status[i] < 0)
+                stage = i;
+        }
+        if (stage >= 0) {
+            stage_pids[stage] = 0;
+            stage_exited(stage, status);
+        }
+        else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            children_failed = 1;
+    }
+    errno = saved_errno;
+}
+
+/* Stages started by the fork server are reported on their status pipes. */
+static void master_sigio(int sig) {
+    int saved_errno = errno;
+    for (int i = 0; i < num_stages; i++) {
+        int status;
+        if (stage_status[i] >= 0 && read(stage_status[i], &status, sizeof(status)) == sizeof(status)) {
+            close(stage_status[i]);
+            stage_status[i] = -1;
+            stage_pids[i] = 0;
+            stage_exited(i, status);
+        }
+    }
+    errno = saved_errno;
+}
+
+/*
+ * Waits for stage i to exit, if it has not been reported already.  Called
+ * with SIGCHLD and SIGIO blocked.
+ */
+static void wait_stage(int i) {
+    int status;
+    if (stage_status[i] >= 0) {
+        fcntl(stage_status[i], F_SETFL, 0);
+        if (read(stage_status[i], &status, sizeof(status)) != sizeof(status))
+            status = 1 << 8;   // the fork server went away
+        close(stage_status[i]);
+        stage_status[i] = -1;
+        stage_exited(i, status);
+    } else if (stage_pids[i] > 0 && waitpid(stage_pids[i], &status, 0) == stage_pids[i]) {
+        stage_exited(i, status);
+    }
+    stage_pids[i] = 0;
+}
+
+/*
+ * Installs the master's SIGCHLD and SIGIO handlers with both signals
+ * blocked; the caller unblocks them (by restoring *oldmask) once the stage
+ * table is filled in.
+ */
+static void master_init(sigset_t *oldmask) {
+    // Masters are often forked from the signal hook, which runs with every
+    // signal blocked; their stages must start with none blocked.
+    sigemptyset(oldmask);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGIO);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    struct sigaction sa;
+    sa.sa_handler = master_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+    sa.sa_handler = master_sigio;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGIO, &sa, NULL);
+    // Not restarted, so that a preempted master stops waiting on the pipeline
+    // or the printer and gives the printer up.
+    sa.sa_handler = master_sigtstp;
+    sa.sa_flags = 0;
+    sigaction(SIGTSTP, &sa, NULL);
+}
+
+/*
+ * Runs a persistent conversion without the fork server: the converter is
+ * started for this one document.  Never returns.
+ */
+static void run_private_converter(char **cmd_and_args) {
+    int to[2], from[2];
+    if (pipe(to) < 0 || pipe(from) < 0) _exit(1);
+
+    pid_t pid = fork();
+    if (pid < 0) _exit(1);
+    if (pid == 0) {
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+        close(to[0]); close(to[1]); close(from[0]); close(from[1]);
+        execvp(cmd_and_args[0], cmd_and_args);
+        _exit(1);
+    }
+    close(to[0]);
+    close(from[1]);
+
+    int ok = run_persistent_stage(to[1], from[0]) == 0;
+    close(to[1]);
+    close(from[0]);
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        ok = 0;
+    _exit(ok ? 0 : 1);
+}
+
+/*
+ * Starts the conversion stages of path in the master's process group, the
+ * first one reading from in_fd, either by forking them or through the fork
+ * server.  Descriptors in close_fds (terminated by -1) are closed in every
+ * forked stage.  Returns the descriptor carrying the final output, which is
+ * in_fd itself for an empty path.
+ */
+static int start_stages(CONVERSION **path, int in_fd, int printer_fd, int *close_fds,
+                        sigset_t *oldmask) {
+    pid_t pgid = getpid();  // This will be used for all children
+
+    int path_len = 0;
+    while (path[path_len]) path_len++;
+    free(stage_pids);
+    free(stage_status);
+    stage_pids = calloc(path_len + 1, sizeof(pid_t));
+    stage_status = malloc((path_len + 1) * sizeof(int));
+    if (stage_pids == NULL || stage_status == NULL) exit(1);
+    for (int i = 0; i < path_len; i++)
+        stage_status[i] = -1;
+    num_stages = path_len;
+
+    // pipes[i] carries the output of stage i; the last one feeds the relay.
+    int pipes[path_len + 1][2];
+    for (int i = 0; i < path_len; i++) {
+        if (pipe(pipes[i]) < 0) exit(1);
+    }
+
+    for (int i = 0; i < path_len; i++) {
+        const struct conversion_attrs *attrs = conversion_attrs(path[i]);
+        struct sched_policy policy = merge_policies(stage_printer_policy, &attrs->policy);
+        int stage_in = i == 0 ? in_fd : pipes[i - 1][0];
+
+        if (forkserver_enabled()) {
+            int status_fd;
+            stage_pids[i] = forkserver_spawn(path[i]->cmd_and_args, attrs->workers, attrs->pool,
+                                             &policy, pgid, stage_in, pipes[i][1], &status_fd);
+            if (stage_pids[i] < 0) exit(1);
+            fcntl(status_fd, F_SETOWN, pgid);
+            fcntl(status_fd, F_SETFL, O_NONBLOCK | O_ASYNC);
+            stage_status[i] = status_fd;
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) exit(1);
+
+        if (pid == 0) {
+            setpgid(0, pgid);  // ✅ join master's process group
+            signal(SIGCHLD, SIG_DFL);
+            signal(SIGTSTP, SIG_DFL);
+            signal(SIGIO, SIG_IGN);
+            sigprocmask(SIG_SETMASK, oldmask, NULL);
+
+            dup2(stage_in, STDIN_FILENO);
+            dup2(pipes[i][1], STDOUT_FILENO);
+
+            for (int k = 0; k < path_len; k++) {
+                close(pipes[k][0]);
+                close(pipes[k][1]);
+            }
+
+            close(in_fd);
+            close(printer_fd);
+            for (int k = 0; close_fds[k] >= 0; k++)
+                close(close_fds[k]);
+
+            apply_policy(&policy);
+            if (attrs->pool > 0)
+                run_private_converter(path[i]->cmd_and_args);
+            if (attrs->workers > 1)
+                run_fanned_stage(path[i]->cmd_and_args, attrs->workers);
+            execvp(path[i]->cmd_and_args[0], path[i]->cmd_and_args);
+            exit(1);
+        }
+        stage_pids[i] = pid;
+    }
+
+    // Catch exits reported before the status pipes were set to signal.
+    master_sigio(SIGIO);
+
+    if (path_len == 0)
+        return in_fd;
+
+    for (int i = 0; i < path_len; i++) {
+        if (i < path_len - 1) close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    close(in_fd);
+    return pipes[path_len - 1][0];
+}
+
+/*
+ * Relays the pipeline output to the printer, waits for every child and exits
+ * with the master's status.
+ */
+static void finish_pipeline(int relay_fd, int printer_fd, off_t checkpoint,
+                            struct job_progress *progress) {
+    // A dropped printer connection must show up as a write error, not kill us.
+    signal(SIGPIPE, SIG_IGN);
+    int lost = relay_output(relay_fd, &printer_fd, checkpoint, progress) < 0;
+    close(relay_fd);
+    if (printer_fd >= 0)
+        close(printer_fd);
+
+    // With the printer let go of, a preemption from now on just stops the
+    // master, so that the spooler sees the job paused and can continue it.
+    signal(SIGTSTP, SIG_DFL);
+    if (yield_requested)
+        kill(getpid(), SIGSTOP);
+
+    if (lost) {
+        // Stop the rest of the pipeline; the job will be requeued.
+        signal(SIGTERM, SIG_IGN);
+        kill(0, SIGTERM);
+        kill(0, SIGCONT);
+        signal(SIGTERM, SIG_DFL);
+    }
+
+    // Wait for every stage, and for any other child such as a feeder.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGIO);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    for (int i = 0; i < num_stages; i++)
+        wait_stage(i);
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            children_failed = 1;
+    }
+
+    exit(lost ? PIPELINE_DISCONNECTED : children_failed ? 1 : 0);
+}
+
+/* Opens the job's input for the first stage; exits if it cannot. */
+static int open_input(struct job *job) {
+    int in_fd = open(job->file, O_RDONLY);
+    if (in_fd < 0) exit(1);
+    if (job->length >= 0 || use_uring) {
+        in_fd = open_range(in_fd, job->offset, job->length, job->progress);
+        if (in_fd < 0) exit(1);
+    } else if ((input_pos_fd = dup(in_fd)) >= 0) {
+        fcntl(input_pos_fd, F_SETFD, FD_CLOEXEC);
+    }
+    return in_fd;
+}
+
+void run_pipeline(struct job *job, CONVERSION **path, int printer_fd, int p,
+                  const struct sched_policy *policy) {
+    sigset_t oldmask;
+    master_init(&oldmask);
+    stage_progress = job->progress;
+    stage_printer_policy = policy;
+    relay_printer = printers[p].name;
+    relay_type = printers[p].type->name;
+    relay_flags = printers[p].connect_flags;
+
+    int in_fd = open_input(job);
+    int no_fds[] = { -1 };
+    int relay_fd = start_stages(path, in_fd, printer_fd, no_fds, &oldmask);
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    finish_pipeline(relay_fd, printer_fd, job->checkpoint, job->progress);
+}
+
+/*
+ * Sends copies 2 to `copies` of a job's output, saved in spill_fd, to printer
+ * p, each on a connection of its own.  Runs in a child of the master; exits
+ * with status 0 if every copy was delivered.
+ */
+static void send_copies(int spill_fd, off_t size, int p, int copies,
+                        struct job_progress *progress) {
+    signal(SIGCHLD, SIG_DFL);
+    for (int c = 2; c <= copies; c++) {
+        int fd = presi_connect_to_printer(printers[p].name, printers[p].type->name,
+                                          printers[p].connect_flags);
+        if (fd < 0)
+            _exit(1);
+        off_t offset = 0;
+        while (offset < size) {
+            ssize_t n = sendfile(fd, spill_fd, &offset, size - offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+        }
+        close(fd);
+        if (offset < size)
+            _exit(1);
+        progress->copies_done[p] = c;
+    }
+    _exit(0);
+}
+
+/*
+ * Relays the pipeline output to every destination still connected, saving it
+ * to spill_fd (if >= 0) for further copies, then sends those once every stage
+ * has succeeded.  Waits for every child and exits with the master's status.
+ */
+static void finish_fanout(int relay_fd, int *fds, const int *dests, int num_dests,
+                          int spill_fd, int copies, struct job_progress *progress) {
+    signal(SIGPIPE, SIG_IGN);
+    struct job_progress none;
+    if (progress == NULL) {
+        memset(&none, 0, sizeof(none));
+        progress = &none;
+    }
+
+    char buf[65536];
+    long long total = 0;
+    int live = num_dests;
+    int failed = 0;
+    ssize_t n;
+    while (live > 0 && (n = read(relay_fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;   // a stage failed; its exit status tells the story
+        }
+        for (int i = 0; i < num_dests; i++) {
+            if (fds[i] >= 0 && write_all(fds[i], buf, n) < 0) {
+                progress->dests_failed |= 1U << dests[i];
+                close(fds[i]);
+                fds[i] = -1;
+                live--;
+                failed = 1;
+            }
+        }
+        if (spill_fd >= 0 && write_all(spill_fd, buf, n) < 0)
+            exit(1);
+        total += n;
+        progress->delivered = total;
+        note_consumed(progress);
+    }
+    close(relay_fd);
+    for (int i = 0; i < num_dests; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);   // fds[i] stays set: the printer got the whole output
+    }
+
+    if (live == 0) {
+        // Every printer is gone; stop the rest of the pipeline.
+        signal(SIGTERM, SIG_IGN);
+        kill(0, SIGTERM);
+        kill(0, SIGCONT);
+        signal(SIGTERM, SIG_DFL);
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGIO);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    for (int i = 0; i < num_stages; i++)
+        wait_stage(i);
+
+    // A copy is only done once every stage has succeeded: a stage that failed
+    // late may have cut the document short.
+    for (int i = 0; i < num_dests && !children_failed; i++) {
+        if (fds[i] >= 0)
+            progress->copies_done[dests[i]] = 1;
+    }
+
+    // Further copies are only worth sending of a complete document.
+    if (copies > 1 && !children_failed) {
+        for (int i = 0; i < num_dests; i++) {
+            if (fds[i] < 0)
+                continue;
+            pid_t pid = fork();
+            if (pid < 0)
+                failed = 1;
+            else if (pid == 0)
+                send_copies(spill_fd, total, dests[i], copies, progress);
+        }
+    }
+
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            children_failed = 1;
+    }
+    exit(failed || children_failed ? 1 : 0);
+}
+
+void run_fanout_pipeline(struct job *job, CONVERSION **path, const int *printer_fds,
+                         const int *dests, int num_dests, const struct sched_policy *policy) {
+    sigset_t oldmask;
+    master_init(&oldmask);
+    stage_progress = job->progress;
+    stage_printer_policy = policy;
+
+    int spill_fd = -1;
+    if (job->copies > 1) {
+        FILE *spill = tmpfile();
+        if (spill == NULL) exit(1);
+        spill_fd = fileno(spill);
+    }
+
+    // The stages must hold none of the connections, or the printers would
+    // not see the end of the document when the master closes them.
+    int fds[num_dests], close_fds[num_dests + 1], n = 0;
+    for (int i = 0; i < num_dests; i++) {
+        fds[i] = printer_fds[i];
+        if (i > 0)
+            close_fds[n++] = fds[i];
+    }
+    if (spill_fd >= 0)
+        close_fds[n++] = spill_fd;
+    close_fds[n] = -1;
+
+    int in_fd = open_input(job);
+    int relay_fd = start_stages(path, in_fd, fds[0], close_fds, &oldmask);
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    finish_fanout(relay_fd, fds, dests, num_dests, spill_fd, job->copies, job->progress);
+}
+
+/* What a pre-started pipeline is told to print. */
+struct pipeline_order {
+    off_t offset;
+    off_t length;
+    off_t checkpoint;
+    char type[64];
+    char file[1024];
+};
+
+void run_warm_pipeline(char *type_name, CONVERSION **path, char *printer_name,
+                       char *printer_type, int connect_flags, int order_fd,
+                       struct job_progress *progress, const struct sched_policy *policy) {
+    sigset_t oldmask;
+    master_init(&oldmask);
+    stage_progress = progress;
+    stage_printer_policy = policy;
+    relay_printer = printer_name;
+    relay_type = printer_type;
+    relay_flags = connect_flags;
+
+    // Starts the printer daemon if needed; exits if it cannot be reached.
+    int printer_fd = presi_connect_to_printer(printer_name, printer_type, connect_flags);
+    if (printer_fd < 0) exit(1);
+
+    int input[2];
+    if (pipe(input) < 0) exit(1);
+
+    int close_fds[] = { input[1], order_fd, -1 };
+    int relay_fd = start_stages(path, input[0], printer_fd, close_fds, &oldmask);
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+
+    struct pipeline_order order;
+    ssize_t n;
+    while ((n = read(order_fd, &order, sizeof(order))) < 0 && errno == EINTR)
+        ;
+    close(order_fd);
+    if (n != sizeof(order)) {
+        // Discarded before it was used.
+        close(input[1]);
+        signal(SIGTERM, SIG_IGN);
+        kill(0, SIGTERM);
+        _exit(0);
+    }
+
+    if (strcmp(order.type, type_name) != 0) {
+        // Prepared for another type: keep the connection, replace the stages.
+        CONVERSION **job_path = find_conversion_path(order.type, printer_type);
+        if (job_path == NULL) exit(1);
+
+        master_init(&oldmask);
+        for (int i = 0; i < num_stages; i++) {
+            if (stage_pids[i] > 0)
+                kill(stage_pids[i], SIGTERM);
+            wait_stage(i);
+        }
+        close(relay_fd);
+        close(input[1]);
+        children_failed = 0;
+        progress->stages_done = 0;
+
+        if (pipe(input) < 0) exit(1);
+        close_fds[0] = input[1];
+        close_fds[1] = -1;
+        relay_fd = start_stages(job_path, input[0], printer_fd, close_fds, &oldmask);
+        sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    }
+
+    pid_t feeder = fork();
+    if (feeder < 0) exit(1);
+    if (feeder == 0) {
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        close(relay_fd);
+        close(printer_fd);
+        int in_fd = open(order.file, O_RDONLY);
+        if (in_fd < 0) _exit(1);
+        feed(in_fd, order.offset, order.length, input[1], progress);
+    }
+    close(input[1]);
+
+    finish_pipeline(relay_fd, printer_fd, order.checkpoint, progress);
+}
+
+int send_pipeline_order(int order_fd, struct job *job) {
+    struct pipeline_order order;
+    memset(&order, 0, sizeof(order));
+    if (strlen(job->file) >= sizeof(order.file) || strlen(job->type->name) >= sizeof(order.type))
+        return -1;
+    strcpy(order.file, job->file);
+    strcpy(order.type, job->type->name);
+    order.offset = job->length >= 0 ? job->offset : 0;
+    order.length = job->length;
+    order.checkpoint = job->checkpoint;
+    // Smaller than PIPE_BUF, so written in one piece.  The master may have
+    // exited (its printer disconnected) without being reaped yet: that must
+    // fail the order, not kill the spooler, so SIGPIPE is blocked and any it
+    // raised is discarded.
+    sigset_t pipe_set, old_mask, pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipe_set, &old_mask);
+    ssize_t n = write(order_fd, &order, sizeof(order));
+    sigpending(&pending);
+    if (sigismember(&pending, SIGPIPE)) {
+        struct timespec zero = { 0, 0 };
+        sigtimedwait(&pipe_set, NULL, &zero);
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return n == sizeof(order) ? 0 : -1;
+}
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE   // sched_setaffinity() and CPU_SET()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "policy.h"
+#include "presi.h"
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define MAX_POLICY_CPUS 64
+
+static const char *io_classes[] = { "none", "rt", "be", "idle" };
+
+static struct sched_policy printer_policies[MAX_PRINTERS];
+
+static int parse_cpus(const char *list, unsigned long long *cpus) {
+    *cpus = 0;
+    const char *s = list;
+    while (*s) {
+        char *end;
+        long first = strtol(s, &end, 10);
+        long last = first;
+        if (end == s) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s) return -1;
+        }
+        if (first < 0 || last < first || last >= MAX_POLICY_CPUS) return -1;
+        for (long c = first; c <= last; c++)
+            *cpus |= 1ULL << c;
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        s = end;
+    }
+    return *cpus ? 0 : -1;
+}
+
+int parse_policy_option(struct sched_policy *policy, const char *option, const char *value) {
+    if (strcmp(option, "-c") == 0) {
+        if (parse_cpus(value, &policy->cpus) < 0)
+            return -1;
+        policy->set |= POLICY_CPUS;
+        return 0;
+    }
+
+    if (strcmp(option, "-n") == 0) {
+        char *end;
+        long n = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || n < -39 || n > 39)
+            return -1;
+        policy->nice = n;
+        policy->set |= POLICY_NICE;
+        return 0;
+    }
+
+    if (strcmp(option, "-i") == 0) {
+        size_t len = strcspn(value, ":");
+        int level = 4;
+        if (value[len] == ':') {
+            char *end;
+            level = strtol(value + len + 1, &end, 10);
+            if (end == value + len + 1 || *end != '\0' || level < 0 || level > 7)
+                return -1;
+        }
+        for (int c = 1; c < 4; c++) {
+            if (strlen(io_classes[c]) == len && strncmp(value, io_classes[c], len) == 0) {
+                // The idle class has no levels.
+                policy->ioprio = c << IOPRIO_CLASS_SHIFT | (c == 3 ? 0 : level);
+                policy->set |= POLICY_IOPRIO;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    return -1;
+}
+
+struct sched_policy *printer_policy(int p) {
+    return &printer_policies[p];
+}
+
+struct sched_policy merge_policies(const struct sched_policy *printer,
+                                   const struct sched_policy *conversion) {
+    struct sched_policy merged = { 0, 0, 0, 0 };
+    const struct sched_policy *from[] = { printer, conversion };
+    for (int i = 0; i < 2; i++) {
+        if (from[i] == NULL)
+            continue;
+        if (from[i]->set & POLICY_CPUS)
+            merged.cpus = from[i]->cpus;
+        if (from[i]->set & POLICY_NICE)
+            merged.nice = from[i]->nice;
+        if (from[i]->set & POLICY_IOPRIO)
+            merged.ioprio = from[i]->ioprio;
+        merged.set |= from[i]->set;
+    }
+    return merged;
+}
+
+void apply_policy(const struct sched_policy *policy) {
+    if (policy->set & POLICY_CPUS) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c = 0; c < MAX_POLICY_CPUS; c++) {
+            if (policy->cpus & (1ULL << c))
+                CPU_SET(c, &set);
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (policy->set & POLICY_NICE) {
+        if (nice(policy->nice) == -1) {
+            // Not permitted; keep the inherited value.
+        }
+    }
+    if (policy->set & POLICY_IOPRIO)
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, policy->ioprio);
+}
+
+char *format_policy(const struct sched_policy *policy, char *buf, int buf_size) {
+    int len = 0;
+    buf[0] = '\0';
+
+    if (policy->set & POLICY_CPUS) {
+        len += snprintf(buf + len, buf_size - len, "cpus=");
+        const char *sep = "";
+        for (int c = 0; c < MAX_POLICY_CPUS && len < buf_size; c++) {
+            if (!(policy->cpus & (1ULL << c)) || (c > 0 && (policy->cpus & (1ULL << (c - 1)))))
+                continue;
+            int last = c;
+            while (last + 1 < MAX_POLICY_CPUS && (policy->cpus & (1ULL << (last + 1))))
+                last++;
+            if (last > c)
+                len += snprintf(buf + len, buf_size - len, "%s%d-%d", sep, c, last);
+            else
+                len += snprintf(buf + len, buf_size - len, "%s%d", sep, c);
+            sep = ",";
+        }
+    }
+    if ((policy->set & POLICY_NICE) && len < buf_size)
+        len += snprintf(buf + len, buf_size - len, "%snice=%d", len ? ", " : "", policy->nice);
+    if ((policy->set & POLICY_IOPRIO) && len < buf_size) {
+        int class = policy->ioprio >> IOPRIO_CLASS_SHIFT;
+        if (class == 3)
+            snprintf(buf + len, buf_size - len, "%sioprio=idle", len ? ", " : "");
+        else
+            snprintf(buf + len, buf_size - len, "%sioprio=%s:%d", len ? ", " : "",
+                     io_classes[class], policy->ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1));
+    }
+    return buf;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "registry.h"
+
+/* Open addressing with linear probing; a NULL name marks an empty slot. */
+struct slot {
+    const char *name;
+    unsigned int hash;
+    int value;
+};
+
+struct registry {
+    struct slot *slots;
+    unsigned int cap;     // a power of two
+    unsigned int count;
+};
+
+static unsigned int hash_name(const char *s) {
+    unsigned int h = 2166136261u;   // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct slot *lookup(const struct registry *reg, const char *name, unsigned int hash) {
+    unsigned int i = hash & (reg->cap - 1);
+    while (reg->slots[i].name != NULL) {
+        if (reg->slots[i].hash == hash && strcmp(reg->slots[i].name, name) == 0)
+            break;
+        i = (i + 1) & (reg->cap - 1);
+    }
+    return &reg->slots[i];
+}
+
+struct registry *registry_new(void) {
+    struct registry *reg = malloc(sizeof(*reg));
+    if (reg == NULL)
+        return NULL;
+    reg->cap = 64;
+    reg->count = 0;
+    reg->slots = calloc(reg->cap, sizeof(*reg->slots));
+    if (reg->slots == NULL) {
+        free(reg);
+        return NULL;
+    }
+    return reg;
+}
+
+void registry_free(struct registry *reg) {
+    if (reg == NULL)
+        return;
+    free(reg->slots);
+    free(reg);
+}
+
+/* Doubles the table once it is half full, which keeps probe runs short. */
+static int grow(struct registry *reg) {
+    if (reg->count + 1 <= reg->cap / 2)
+        return 0;
+    struct registry bigger = { calloc(reg->cap * 2, sizeof(struct slot)), reg->cap * 2, 0 };
+    if (bigger.slots == NULL)
+        return -1;
+    for (unsigned int i = 0; i < reg->cap; i++) {
+        if (reg->slots[i].name != NULL)
+            *lookup(&bigger, reg->slots[i].name, reg->slots[i].hash) = reg->slots[i];
+    }
+    free(reg->slots);
+    reg->slots = bigger.slots;
+    reg->cap = bigger.cap;
+    return 0;
+}
+
+int registry_put(struct registry *reg, const char *name, int value) {
+    unsigned int hash = hash_name(name);
+    struct slot *s = lookup(reg, name, hash);
+    if (s->name == NULL) {
+        if (grow(reg) < 0)
+            return -1;
+        s = lookup(reg, name, hash);
+        s->name = name;
+        s->hash = hash;
+        reg->count++;
+    }
+    s->value = value;
+    return 0;
+}
+
+int registry_get(const struct registry *reg, const char *name) {
+    struct slot *s = lookup(reg, name, hash_name(name));
+    return s->name ? s->value : -1;
+}
+
+void registry_remove(struct registry *reg, const char *name) {
+    struct slot *s = lookup(reg, name, hash_name(name));
+    if (s->name == NULL)
+        return;
+
+    // Shift back the entries of the probe run that follows, so that lookups
+    // never stop early at the emptied slot.
+    unsigned int mask = reg->cap - 1;
+    unsigned int hole = s - reg->slots;
+    unsigned int i = hole;
+    for (;;) {
+        i = (i + 1) & mask;
+        if (reg->slots[i].name == NULL)
+            break;
+        unsigned int home = reg->slots[i].hash & mask;
+        // Move the entry unless its home lies cyclically in (hole, i].
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            reg->slots[hole] = reg->slots[i];
+            hole = i;
+        }
+    }
+    reg->slots[hole].name = NULL;
+    reg->count--;
+}
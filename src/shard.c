@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "shard.h"
+#include "vaildargs.h"
+#include "dispatch.h"
+#include "globals.h"
+#include "presi.h"
+#include "conversions.h"
+#include "graph.h"
+#include "bulk.h"
+#include "registry.h"
+#include "timers.h"
+#include "cgroup.h"
+
+#define SHARD_LINE_MAX 4096
+
+struct shard {
+    int fd;              // coordinator end of the socket pair
+    pid_t pid;
+    int load;            // unfinished jobs, as last reported by the shard
+    int num_printers;
+    char buf[SHARD_LINE_MAX];
+    size_t buf_len;
+};
+
+struct shard_printer {
+    char *name;
+    FILE_TYPE *type;
+    int shard;
+};
+
+struct shard_job {
+    int shard;
+};
+
+static struct shard shards[MAX_SHARDS];
+static int num_shards = 0;
+
+static struct shard_printer shard_printers[MAX_SHARDS * MAX_PRINTERS];
+static int num_shard_printers = 0;
+static struct registry *shard_printer_names;   // name -> index in shard_printers
+
+static struct shard_job *shard_jobs = NULL;
+static int shard_jobs_cap = 0;
+
+/* ---- shard side ---- */
+
+static void shard_report_load(int fd) {
+    static int last_load = -1;
+    int load = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        if (job_status[i] == JOB_CREATED || job_status[i] == JOB_RUNNING ||
+            job_status[i] == JOB_PAUSED)
+            load++;
+    }
+    if (load == last_load)
+        return;
+
+    char msg[32];
+    int n = snprintf(msg, sizeof(msg), "LOAD %d\n", load);
+    if (write(fd, msg, n) == n)
+        last_load = load;
+}
+
+/*
+ * Job commands come from the coordinator with its job ids, which the shard
+ * looks up among the ids it stored with each job.
+ */
+static void shard_job_command(char *line, FILE *out) {
+    char *id_str = line + strcspn(line, " ");
+    int global_id = atoi(id_str);
+    for (int i = 0; i < num_jobs; i++) {
+        if (job_status[i] != JOB_DELETED && jobs[i].global_id == global_id &&
+            jobs[i].parent < 0) {
+            char local[64];
+            snprintf(local, sizeof(local), "%.*s %d", (int)(id_str - line), line, jobs[i].id);
+            handle_user_command(local, out);
+            return;
+        }
+    }
+    sf_cmd_error("Invalid job ID.");
+}
+
+static void shard_serve(int fd, FILE *out) {
+    char buf[SHARD_LINE_MAX];
+    size_t len = 0;
+
+    sigset_t mask, oldmask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+
+    while (1) {
+        timers_run();
+        reap_finished_jobs();
+        dispatch_jobs();
+        shard_report_load(fd);
+        fflush(stdout);
+
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(fd, &rfds);
+        // Wait with SIGCHLD unblocked so job completions wake us up.
+        if (pselect(fd + 1, &rfds, NULL, NULL, NULL, &oldmask) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        ssize_t n = read(fd, buf + len, sizeof(buf) - 1 - len);
+        if (n <= 0) break;
+        len += n;
+
+        char *start = buf, *nl;
+        while ((nl = memchr(start, '\n', buf + len - start)) != NULL) {
+            *nl = '\0';
+            if (strcmp(start, "quit") == 0)
+                goto done;
+            if (strncmp(start, "pause ", 6) == 0 || strncmp(start, "resume ", 7) == 0 ||
+                strncmp(start, "cancel ", 7) == 0)
+                shard_job_command(start, out);
+            else if (*start != '\0')
+                handle_user_command(start, out);
+            start = nl + 1;
+        }
+        len -= start - buf;
+        memmove(buf, start, len);
+        if (len == sizeof(buf) - 1) len = 0;   // drop an overlong line
+    }
+
+done:
+    fflush(NULL);
+    cgroup_cleanup();
+    conversions_fini();
+    exit(EXIT_SUCCESS);
+}
+
+/* ---- coordinator side ---- */
+
+int shard_init(FILE *out) {
+    char *env = getenv("PRESI_SHARDS");
+    if (env == NULL)
+        return 0;
+
+    int n = atoi(env);
+    if (n <= 1)
+        return 0;
+    if (n > MAX_SHARDS)
+        n = MAX_SHARDS;
+
+    fflush(NULL);   // don't let children inherit buffered output
+    for (int i = 0; i < n; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            perror("socketpair");
+            break;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(sv[0]);
+            close(sv[1]);
+            break;
+        }
+
+        if (pid == 0) {
+            for (int k = 0; k < num_shards; k++)
+                close(shards[k].fd);
+            close(sv[0]);
+            num_shards = 0;
+            shard_serve(sv[1], out);
+        }
+
+        close(sv[1]);
+        fcntl(sv[0], F_SETOWN, getpid());
+        fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_ASYNC);
+
+        struct shard *s = &shards[num_shards++];
+        memset(s, 0, sizeof(*s));
+        s->fd = sv[0];
+        s->pid = pid;
+    }
+
+    return num_shards;
+}
+
+int shard_is_coordinator(void) {
+    return num_shards > 0;
+}
+
+static void shard_send(int s, const char *line) {
+    size_t len = strlen(line);
+    // A shard that died must not take the coordinator down with SIGPIPE.
+    if (send(shards[s].fd, line, len, MSG_NOSIGNAL) != (ssize_t)len ||
+        send(shards[s].fd, "\n", 1, MSG_NOSIGNAL) != 1)
+        fprintf(stderr, "Failed to send command to shard %d\n", s);
+}
+
+static void shard_broadcast(const char *line) {
+    for (int s = 0; s < num_shards; s++)
+        shard_send(s, line);
+}
+
+void shard_poll(void) {
+    for (int s = 0; s < num_shards; s++) {
+        struct shard *sh = &shards[s];
+        ssize_t n;
+        while ((n = recv(sh->fd, sh->buf + sh->buf_len,
+                         sizeof(sh->buf) - 1 - sh->buf_len, MSG_DONTWAIT)) > 0) {
+            sh->buf_len += n;
+            char *start = sh->buf, *nl;
+            while ((nl = memchr(start, '\n', sh->buf + sh->buf_len - start)) != NULL) {
+                *nl = '\0';
+                int load;
+                if (sscanf(start, "LOAD %d", &load) == 1)
+                    sh->load = load;
+                start = nl + 1;
+            }
+            sh->buf_len -= start - sh->buf;
+            memmove(sh->buf, start, sh->buf_len);
+        }
+    }
+}
+
+static struct shard_printer *find_shard_printer(const char *name) {
+    int i = shard_printer_names ? registry_get(shard_printer_names, name) : -1;
+    return i >= 0 ? &shard_printers[i] : NULL;
+}
+
+static void coordinator_printer(char *line) {
+    char *copy = strdup(line);
+    char *name = strtok(copy + 8, " \t");
+    char *type_name = strtok(NULL, " \t");
+    FILE_TYPE *type = type_name ? graph_find_type(type_name) : NULL;
+
+    if (!name || !type || find_shard_printer(name) ||
+        num_shard_printers >= MAX_SHARDS * MAX_PRINTERS) {
+        sf_cmd_error("printer");
+        free(copy);
+        return;
+    }
+
+    // Place the printer on the shard that owns the fewest printers.
+    int best = -1;
+    for (int s = 0; s < num_shards; s++) {
+        if (shards[s].num_printers >= MAX_PRINTERS) continue;
+        if (best < 0 || shards[s].num_printers < shards[best].num_printers)
+            best = s;
+    }
+    if (best < 0) {
+        sf_cmd_error("printer");
+        free(copy);
+        return;
+    }
+
+    if (shard_printer_names == NULL)
+        shard_printer_names = registry_new();
+    struct shard_printer *sp = &shard_printers[num_shard_printers];
+    sp->name = strdup(name);
+    if (sp->name == NULL || shard_printer_names == NULL ||
+        registry_put(shard_printer_names, sp->name, num_shard_printers) < 0) {
+        free(sp->name);
+        sf_cmd_error("printer");
+        free(copy);
+        return;
+    }
+    num_shard_printers++;
+    sp->type = type;
+    sp->shard = best;
+    shards[best].num_printers++;
+    free(copy);
+
+    shard_send(best, line);
+}
+
+static void coordinator_printer_command(char *line, int skip) {
+    char *start = line + skip;
+    while (isspace(*start)) start++;
+    char name[SHARD_LINE_MAX];
+    snprintf(name, sizeof(name), "%.*s", (int)strcspn(start, " \t"), start);
+
+    struct shard_printer *sp = find_shard_printer(name);
+    if (sp == NULL) {
+        sf_cmd_error("Printer not found.");
+        return;
+    }
+    shard_send(sp->shard, line);
+}
+
+/*
+ * Printer policies go to the shard that owns the printer, conversion policies
+ * to every shard.
+ */
+static void coordinator_policy(char *line) {
+    char *copy = strdup(line);
+    char *target = strtok(copy + 7, " \t");
+    while (target != NULL && target[0] == '-') {
+        strtok(NULL, " \t");
+        target = strtok(NULL, " \t");
+    }
+    char *name = strtok(NULL, " \t");
+
+    if (target != NULL && strcmp(target, "printer") == 0 && name != NULL) {
+        struct shard_printer *sp = find_shard_printer(name);
+        if (sp == NULL)
+            sf_cmd_error("Printer not found.");
+        else
+            shard_send(sp->shard, line);
+    } else {
+        shard_broadcast(line);
+    }
+    free(copy);
+}
+
+static int printer_eligible(struct shard_printer *sp, FILE_TYPE *type) {
+    CONVERSION **path = find_route(type, sp->type);
+    if (path == NULL)
+        return 0;
+    free(path);
+    return 1;
+}
+
+/*
+ * Routes a print command to a shard.  With bulk set it is forwarded as a bulk
+ * command, so that a shard whose job table is full keeps the file in its
+ * backlog instead of refusing it.
+ */
+static void coordinator_print(char *line, int bulk, FILE *out) {
+    char *copy = strdup(line);
+    char *file = strtok(copy + 6, " \t");
+
+    // Print options are passed through to the shard untouched.
+    char options[SHARD_LINE_MAX] = "";
+    int options_len = 0;
+    int fanout = 0;
+    while (file != NULL && file[0] == '-') {
+        char *value = strtok(NULL, " \t");
+        if (value == NULL) break;
+        fanout |= strcmp(file, "-m") == 0 && strcmp(value, "all") == 0;
+        options_len += snprintf(options + options_len, sizeof(options) - options_len,
+                                "%s %s ", file, value);
+        file = strtok(NULL, " \t");
+    }
+    FILE_TYPE *type = file ? infer_file_type(file) : NULL;
+    if (type == NULL) {
+        sf_cmd_error("print");
+        free(copy);
+        return;
+    }
+
+    // Collect the named printers (all printers if none were named).
+    struct shard_printer *named[MAX_SHARDS * MAX_PRINTERS];
+    int num_named = 0;
+    char *name;
+    while ((name = strtok(NULL, " \t")) != NULL) {
+        struct shard_printer *sp = find_shard_printer(name);
+        if (sp == NULL) {
+            sf_cmd_error("Invalid printer name.");
+            free(copy);
+            return;
+        }
+        named[num_named++] = sp;
+    }
+    // A fan-out job holds all its printers at once, so they must share a shard.
+    for (int i = 1; fanout && i < num_named; i++) {
+        if (named[i]->shard != named[0]->shard) {
+            sf_cmd_error("Fan-out printers must be on one shard.");
+            free(copy);
+            return;
+        }
+    }
+    int restricted = num_named > 0;
+    if (!restricted) {
+        for (int i = 0; i < num_shard_printers; i++)
+            named[num_named++] = &shard_printers[i];
+    }
+
+    int eligible[MAX_SHARDS] = {0};
+    for (int i = 0; i < num_named; i++) {
+        if (printer_eligible(named[i], type))
+            eligible[named[i]->shard]++;
+    }
+
+    // Least load per eligible printer wins; with no eligible printer anywhere,
+    // park the job on the least loaded shard.
+    int best = -1;
+    for (int s = 0; s < num_shards; s++) {
+        if (restricted && eligible[s] == 0) {
+            int owns = 0;
+            for (int i = 0; i < num_named; i++)
+                if (named[i]->shard == s) owns = 1;
+            if (!owns) continue;
+        }
+        if (best < 0) {
+            best = s;
+        } else if (eligible[s] > 0 && eligible[best] == 0) {
+            best = s;
+        } else if ((eligible[s] > 0) == (eligible[best] > 0)) {
+            int ls = shards[s].load, lb = shards[best].load;
+            int es = eligible[s] ? eligible[s] : 1, eb = eligible[best] ? eligible[best] : 1;
+            if ((long)ls * eb < (long)lb * es)
+                best = s;
+        }
+    }
+    if (best < 0) best = 0;
+
+    // The shard keeps this job id with the job, so that the ids stay ours
+    // even if the shard refuses a print or holds it in its backlog.
+    char fwd[SHARD_LINE_MAX];
+    int len = snprintf(fwd, sizeof(fwd), "%s -g %d %s%s%s", bulk ? "bulk" : "print",
+                       next_job_id, options, file, bulk && restricted ? " --" : "");
+    if (restricted) {
+        for (int i = 0; i < num_named && len < (int)sizeof(fwd); i++) {
+            if (named[i]->shard == best)
+                len += snprintf(fwd + len, sizeof(fwd) - len, " %s", named[i]->name);
+        }
+    }
+    free(copy);
+
+    if (next_job_id >= shard_jobs_cap) {
+        int cap = shard_jobs_cap ? shard_jobs_cap * 2 : 64;
+        struct shard_job *grown = realloc(shard_jobs, cap * sizeof(*grown));
+        if (grown == NULL) {
+            sf_cmd_error("Too many jobs.");
+            return;
+        }
+        shard_jobs = grown;
+        shard_jobs_cap = cap;
+    }
+    int job_id = next_job_id++;
+    shard_jobs[job_id].shard = best;
+    shards[best].load++;
+
+    fprintf(out, "ROUTE: job=%d, shard=%d\n", job_id, best);
+    shard_send(best, fwd);
+}
+
+struct coordinator_bulk {
+    char *options;
+    char *printers;
+    FILE *out;
+    int routed;
+};
+
+static void coordinator_bulk_file(char *file, void *ctx) {
+    struct coordinator_bulk *cb = ctx;
+    char line[SHARD_LINE_MAX];
+    snprintf(line, sizeof(line), "print %s%s%s", cb->options, file, cb->printers);
+    coordinator_print(line, 1, cb->out);
+    cb->routed++;
+}
+
+/* Expands a bulk command here and routes every file like a print command. */
+static void coordinator_bulk(char *line, FILE *out) {
+    char *copy = strdup(line);
+    char options[SHARD_LINE_MAX] = "", printers[SHARD_LINE_MAX] = "";
+    int options_len = 0, printers_len = 0;
+    char *args[SHARD_LINE_MAX / 2];
+    int num_args = 0;
+
+    char *arg = strtok(copy + 5, " \t");
+    while (arg != NULL && arg[0] == '-' && strcmp(arg, "--") != 0) {
+        char *value = strtok(NULL, " \t");
+        if (value == NULL) break;
+        options_len += snprintf(options + options_len, sizeof(options) - options_len,
+                                "%s %s ", arg, value);
+        arg = strtok(NULL, " \t");
+    }
+    for (; arg != NULL && strcmp(arg, "--") != 0; arg = strtok(NULL, " \t"))
+        args[num_args++] = arg;
+    while ((arg = strtok(NULL, " \t")) != NULL) {
+        printers_len += snprintf(printers + printers_len, sizeof(printers) - printers_len,
+                                 " %s", arg);
+    }
+
+    struct coordinator_bulk cb = { options, printers, out, 0 };
+    for (int i = 0; i < num_args; i++)
+        bulk_expand(args[i], coordinator_bulk_file, &cb);
+    fprintf(out, "BULK: routed=%d\n", cb.routed);
+    free(copy);
+}
+
+static void coordinator_job_command(char *line, int skip) {
+    char *id_str = line + skip;
+    while (isspace(*id_str)) id_str++;
+
+    if (*id_str == '\0') {
+        sf_cmd_error("Missing job ID.");
+        return;
+    }
+    int job_id = atoi(id_str);
+    if (job_id < 0 || job_id >= next_job_id) {
+        sf_cmd_error("Invalid job ID.");
+        return;
+    }
+
+    char fwd[64];
+    snprintf(fwd, sizeof(fwd), "%.*s %d", skip - 1, line, job_id);
+    shard_send(shard_jobs[job_id].shard, fwd);
+}
+
+static void coordinator_shards(FILE *out) {
+    shard_poll();
+    for (int s = 0; s < num_shards; s++) {
+        fprintf(out, "SHARD[%d]: pid=%d, printers=%d, load=%d\n",
+                s, shards[s].pid, shards[s].num_printers, shards[s].load);
+    }
+    sf_cmd_ok();
+}
+
+void handle_coordinator_command(char *line, FILE *out) {
+    if (strncmp(line, "type ", 5) == 0 || strncmp(line, "conversion ", 11) == 0 ||
+        strncmp(line, "splitter ", 9) == 0 || strncmp(line, "retry ", 6) == 0 ||
+        strncmp(line, "retention ", 10) == 0 || strncmp(line, "feeder ", 7) == 0 ||
+        strncmp(line, "preempt ", 8) == 0 || strncmp(line, "caps ", 5) == 0 ||
+        strncmp(line, "progress ", 9) == 0) {
+        // Define locally for routing decisions, then replicate.
+        char *copy = strdup(line);
+        handle_user_command(copy, out);
+        free(copy);
+        shard_broadcast(line);
+    }
+    else if (strncmp(line, "printer ", 8) == 0) coordinator_printer(line);
+    else if (strncmp(line, "enable ", 7) == 0) coordinator_printer_command(line, 7);
+    else if (strncmp(line, "disable ", 8) == 0) coordinator_printer_command(line, 8);
+    else if (strncmp(line, "warm ", 5) == 0) coordinator_printer_command(line, 5);
+    else if (strncmp(line, "faults ", 7) == 0) coordinator_printer_command(line, 7);
+    else if (strncmp(line, "policy ", 7) == 0) coordinator_policy(line);
+    else if (strncmp(line, "print ", 6) == 0) coordinator_print(line, 0, out);
+    else if (strncmp(line, "bulk ", 5) == 0) coordinator_bulk(line, out);
+    else if (strcmp(line, "jobs") == 0 || strcmp(line, "printers") == 0) shard_broadcast(line);
+    else if (strncmp(line, "limits", 6) == 0) shard_broadcast(line);  // the budget is per shard
+    else if (strncmp(line, "top", 3) == 0) shard_broadcast(line);
+    else if (strncmp(line, "pause ", 6) == 0) coordinator_job_command(line, 6);
+    else if (strncmp(line, "resume ", 7) == 0) coordinator_job_command(line, 7);
+    else if (strncmp(line, "cancel ", 7) == 0) coordinator_job_command(line, 7);
+    else if (strcmp(line, "shards") == 0) coordinator_shards(out);
+    else if (strncmp(line, "save ", 5) == 0 || strncmp(line, "load ", 5) == 0)
+        sf_cmd_error("Snapshots are not supported in sharded mode.");
+    else if (strncmp(line, "metrics", 7) == 0)
+        sf_cmd_error("Metrics are not supported in sharded mode.");
+    else if (strncmp(line, "trace", 5) == 0)
+        sf_cmd_error("Tracing is not supported in sharded mode.");
+    else if (strncmp(line, "remove ", 7) == 0)
+        sf_cmd_error("Printers cannot be removed in sharded mode.");
+    else handle_user_command(line, out);
+}
+
+void shard_fini(void) {
+    shard_broadcast("quit");
+    for (int s = 0; s < num_shards; s++) {
+        close(shards[s].fd);
+        waitpid(shards[s].pid, NULL, 0);
+    }
+    num_shards = 0;
+
+    registry_free(shard_printer_names);
+    shard_printer_names = NULL;
+    for (int i = 0; i < num_shard_printers; i++)
+        free(shard_printers[i].name);
+    num_shard_printers = 0;
+    free(shard_jobs);
+    shard_jobs = NULL;
+    shard_jobs_cap = 0;
+}
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "graph.h"
+#include "dispatch.h"
+#include "convattr.h"
+#include "policy.h"
+#include "warm.h"
+#include "globals.h"
+#include "presi.h"
+#include "conversions.h"
+
+#define SNAPSHOT_MAGIC "PRESISNP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MAX_ARGS 32
+
+#define SNAP_PRINTER_ENABLED 0x1
+#define SNAP_PRINTER_WARM 0x2      // kept warm with the warm command
+
+/*
+ * Layout: the header, then (each aligned to 8 bytes) the type names, the
+ * conversion, printer and route records, an array of 32-bit words holding
+ * command arguments and paths, and the NUL-terminated strings.  Strings are
+ * referred to by offset, types and conversions by record number.
+ */
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;       // sizes of the records, which depend on the build
+    uint32_t conversion_size;
+    uint32_t printer_size;
+    uint32_t num_types, num_conversions, num_printers, num_routes;
+    uint32_t num_words, strings_len;
+    uint64_t types_off, conversions_off, printers_off, routes_off, words_off, strings_off;
+};
+
+struct snap_conversion {
+    uint32_t from, to;
+    uint32_t argc, argv;        // argument strings at words[argv ... argv + argc - 1]
+    struct conversion_attrs attrs;
+};
+
+struct snap_printer {
+    uint32_t name, type;
+    uint32_t flags;             // SNAP_PRINTER_*
+    struct sched_policy policy;
+};
+
+struct snap_route {
+    uint32_t from, to;
+    int32_t len;                // -1: no path
+    uint32_t first;             // conversions at words[first ... first + len - 1]
+};
+
+/* Growable arrays used while writing a snapshot. */
+struct snap_buf {
+    char *data;
+    size_t len, cap;
+};
+
+static int buf_add(struct snap_buf *b, const void *data, size_t len) {
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len)
+            cap *= 2;
+        char *grown = realloc(b->data, cap);
+        if (grown == NULL)
+            return -1;
+        b->data = grown;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static uint32_t add_string(struct snap_buf *strings, const char *s, int *failed) {
+    uint32_t off = strings->len;
+    if (buf_add(strings, s, strlen(s) + 1) < 0)
+        *failed = 1;
+    return off;
+}
+
+static uint32_t add_word(struct snap_buf *words, uint32_t w, int *failed) {
+    uint32_t index = words->len / sizeof(uint32_t);
+    if (buf_add(words, &w, sizeof(w)) < 0)
+        *failed = 1;
+    return index;
+}
+
+static int index_of(void **array, int count, void *item) {
+    for (int i = 0; i < count; i++) {
+        if (array[i] == item)
+            return i;
+    }
+    return -1;
+}
+
+static uint64_t align8(uint64_t off) {
+    return (off + 7) & ~(uint64_t)7;
+}
+
+int save_snapshot(const char *path) {
+    FILE_TYPE **types;
+    CONVERSION **convs;
+    int num_types = graph_types(&types);
+    int num_convs = graph_conversions(&convs);
+    struct snap_buf type_recs = {0}, conv_recs = {0}, printer_recs = {0}, route_recs = {0};
+    struct snap_buf words = {0}, strings = {0};
+    int failed = 0;
+
+    for (int i = 0; i < num_types; i++) {
+        uint32_t name = add_string(&strings, types[i]->name, &failed);
+        failed |= buf_add(&type_recs, &name, sizeof(name)) < 0;
+    }
+
+    for (int i = 0; i < num_convs; i++) {
+        struct snap_conversion rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.from = index_of((void **)types, num_types, convs[i]->from);
+        rec.to = index_of((void **)types, num_types, convs[i]->to);
+        rec.argc = 0;
+        rec.argv = words.len / sizeof(uint32_t);
+        for (char **arg = convs[i]->cmd_and_args; *arg != NULL; arg++, rec.argc++)
+            add_word(&words, add_string(&strings, *arg, &failed), &failed);
+        rec.attrs = *conversion_attrs(convs[i]);
+        failed |= buf_add(&conv_recs, &rec, sizeof(rec)) < 0;
+    }
+
+    uint32_t num_printer_recs = 0;
+    for (int i = 0; i < num_printers; i++) {
+        if (printers[i].name == NULL)
+            continue;   // removed
+        struct snap_printer rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.name = add_string(&strings, printers[i].name, &failed);
+        rec.type = index_of((void **)types, num_types, printers[i].type);
+        rec.flags = (printers[i].status != PRINTER_DISABLED ? SNAP_PRINTER_ENABLED : 0) |
+                    (warm_kept(i) ? SNAP_PRINTER_WARM : 0);
+        rec.policy = *printer_policy(i);
+        failed |= buf_add(&printer_recs, &rec, sizeof(rec)) < 0;
+        num_printer_recs++;
+    }
+
+    // Paths from every type to the type of every printer.
+    uint32_t num_routes = 0;
+    for (int t = 0; t < num_types; t++) {
+        for (int p = 0; p < num_printers; p++) {
+            if (printers[p].name == NULL)
+                continue;
+            int seen = 0;
+            for (int q = 0; q < p; q++)
+                seen |= printers[q].type == printers[p].type;
+            if (seen)
+                continue;
+
+            struct snap_route rec = { t, index_of((void **)types, num_types, printers[p].type), -1, 0 };
+            CONVERSION **route = find_route(types[t], printers[p].type);
+            if (route != NULL) {
+                rec.len = 0;
+                rec.first = words.len / sizeof(uint32_t);
+                for (; route[rec.len] != NULL; rec.len++)
+                    add_word(&words, index_of((void **)convs, num_convs, route[rec.len]), &failed);
+                free(route);
+            }
+            failed |= buf_add(&route_recs, &rec, sizeof(rec)) < 0;
+            num_routes++;
+        }
+    }
+
+    struct snapshot_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.header_size = sizeof(h);
+    h.conversion_size = sizeof(struct snap_conversion);
+    h.printer_size = sizeof(struct snap_printer);
+    h.num_types = num_types;
+    h.num_conversions = num_convs;
+    h.num_printers = num_printer_recs;
+    h.num_routes = num_routes;
+    h.num_words = words.len / sizeof(uint32_t);
+    h.strings_len = strings.len;
+
+    struct snap_buf *sections[] = { &type_recs, &conv_recs, &printer_recs, &route_recs, &words, &strings };
+    uint64_t *offsets[] = { &h.types_off, &h.conversions_off, &h.printers_off, &h.routes_off,
+                            &h.words_off, &h.strings_off };
+    uint64_t off = align8(sizeof(h));
+    for (int i = 0; i < 6; i++) {
+        *offsets[i] = off;
+        off = align8(off + sections[i]->len);
+    }
+
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = failed ? NULL : fopen(tmp, "w");
+    if (f != NULL) {
+        static const char zeros[8];
+        failed |= fwrite(&h, sizeof(h), 1, f) != 1;
+        uint64_t at = sizeof(h);
+        for (int i = 0; i < 6; i++) {
+            failed |= fwrite(zeros, 1, *offsets[i] - at, f) != *offsets[i] - at;
+            failed |= sections[i]->len > 0 && fwrite(sections[i]->data, sections[i]->len, 1, f) != 1;
+            at = *offsets[i] + sections[i]->len;
+        }
+        failed |= fclose(f) != 0;
+        failed |= !failed && rename(tmp, path) < 0;
+        if (failed)
+            unlink(tmp);
+    } else {
+        failed = 1;
+    }
+
+    for (int i = 0; i < 6; i++)
+        free(sections[i]->data);
+    return failed ? -1 : 0;
+}
+
+/* Checks that count records of size bytes at off lie within the file. */
+static int section_ok(uint64_t off, uint64_t count, uint64_t size, uint64_t file_size) {
+    return off % 8 == 0 && off <= file_size && count <= (file_size - off) / (size ? size : 1);
+}
+
+static int validate(const char *map, size_t size) {
+    const struct snapshot_header *h = (const struct snapshot_header *)map;
+    if (size < sizeof(*h) || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != SNAPSHOT_VERSION || h->header_size != sizeof(*h) ||
+        h->conversion_size != sizeof(struct snap_conversion) ||
+        h->printer_size != sizeof(struct snap_printer))
+        return -1;
+
+    if (!section_ok(h->types_off, h->num_types, sizeof(uint32_t), size) ||
+        !section_ok(h->conversions_off, h->num_conversions, sizeof(struct snap_conversion), size) ||
+        !section_ok(h->printers_off, h->num_printers, sizeof(struct snap_printer), size) ||
+        !section_ok(h->routes_off, h->num_routes, sizeof(struct snap_route), size) ||
+        !section_ok(h->words_off, h->num_words, sizeof(uint32_t), size) ||
+        !section_ok(h->strings_off, h->strings_len, 1, size))
+        return -1;
+
+    // Every string offset must be below strings_len, and the area ends in a NUL.
+    const char *strings = map + h->strings_off;
+    if (h->strings_len == 0 || strings[h->strings_len - 1] != '\0')
+        return -1;
+
+    const uint32_t *type_names = (const uint32_t *)(map + h->types_off);
+    const uint32_t *words = (const uint32_t *)(map + h->words_off);
+    for (uint32_t i = 0; i < h->num_types; i++) {
+        if (type_names[i] >= h->strings_len)
+            return -1;
+    }
+
+    const struct snap_conversion *convs = (const struct snap_conversion *)(map + h->conversions_off);
+    for (uint32_t i = 0; i < h->num_conversions; i++) {
+        if (convs[i].from >= h->num_types || convs[i].to >= h->num_types ||
+            convs[i].argc == 0 || convs[i].argc >= SNAPSHOT_MAX_ARGS ||
+            convs[i].argv > h->num_words || convs[i].argc > h->num_words - convs[i].argv)
+            return -1;
+        for (uint32_t a = 0; a < convs[i].argc; a++) {
+            if (words[convs[i].argv + a] >= h->strings_len)
+                return -1;
+        }
+    }
+
+    const struct snap_printer *prs = (const struct snap_printer *)(map + h->printers_off);
+    for (uint32_t i = 0; i < h->num_printers; i++) {
+        if (prs[i].name >= h->strings_len || prs[i].type >= h->num_types)
+            return -1;
+    }
+
+    const struct snap_route *routes = (const struct snap_route *)(map + h->routes_off);
+    for (uint32_t i = 0; i < h->num_routes; i++) {
+        if (routes[i].from >= h->num_types || routes[i].to >= h->num_types || routes[i].len < -1)
+            return -1;
+        if (routes[i].len < 0)
+            continue;
+        if (routes[i].first > h->num_words || (uint32_t)routes[i].len > h->num_words - routes[i].first)
+            return -1;
+        for (int32_t k = 0; k < routes[i].len; k++) {
+            if (words[routes[i].first + k] >= h->num_conversions)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static void add_printer(char *name, FILE_TYPE *type, uint32_t flags, const struct sched_policy *policy) {
+    if (find_printer(name) >= 0)
+        return;
+    int i = define_printer(name, type);
+    if (i < 0) {
+        fprintf(stderr, "Snapshot: too many printers, %s not added\n", name);
+        return;
+    }
+
+    PRINTER *p = &printers[i];
+    *printer_policy(i) = *policy;
+    sf_printer_defined(p->name, p->type->name);
+    printf("PRINTER: id=%d, name=%s, type=%s, status=disabled\n", i, p->name, p->type->name);
+
+    if (flags & SNAP_PRINTER_ENABLED) {
+        p->status = PRINTER_IDLE;
+        sf_printer_status(p->name, PRINTER_IDLE);
+        printf("PRINTER: id=%d, name=%s, type=%s, status=idle\n", i, p->name, p->type->name);
+        warm_keep(i, (flags & SNAP_PRINTER_WARM) != 0);
+    }
+}
+
+int load_snapshot(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct snapshot_header)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    // Private and writable, as the definitions take (and copy) non-const strings.
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    if (validate(map, size) < 0) {
+        munmap(map, size);
+        return -1;
+    }
+
+    struct snapshot_header *h = (struct snapshot_header *)map;
+    uint32_t *type_names = (uint32_t *)(map + h->types_off);
+    struct snap_conversion *conv_recs = (struct snap_conversion *)(map + h->conversions_off);
+    struct snap_printer *printer_recs = (struct snap_printer *)(map + h->printers_off);
+    struct snap_route *route_recs = (struct snap_route *)(map + h->routes_off);
+    uint32_t *words = (uint32_t *)(map + h->words_off);
+    char *strings = map + h->strings_off;
+
+    FILE_TYPE **types = malloc((h->num_types + 1) * sizeof(*types));
+    CONVERSION **convs = malloc((h->num_conversions + 1) * sizeof(*convs));
+    int result = types && convs ? 0 : -1;
+
+    for (uint32_t i = 0; result == 0 && i < h->num_types; i++) {
+        char *name = strings + type_names[i];
+        types[i] = find_type(name);
+        if (types[i] == NULL)
+            types[i] = define_type(name);
+        if (types[i] == NULL)
+            result = -1;
+        else
+            graph_add_type(types[i]);
+    }
+
+    for (uint32_t i = 0; result == 0 && i < h->num_conversions; i++) {
+        struct snap_conversion *rec = &conv_recs[i];
+        char *argv[SNAPSHOT_MAX_ARGS];
+        for (uint32_t a = 0; a < rec->argc; a++)
+            argv[a] = strings + words[rec->argv + a];
+        argv[rec->argc] = NULL;
+
+        convs[i] = define_conversion(types[rec->from]->name, types[rec->to]->name, argv);
+        if (convs[i] == NULL) {
+            result = -1;
+            break;
+        }
+        graph_add_conversion(convs[i]);
+        struct conversion_attrs *attrs = define_conversion_attrs(types[rec->from], types[rec->to]);
+        if (attrs != NULL)
+            *attrs = rec->attrs;
+    }
+
+    for (uint32_t i = 0; result == 0 && i < h->num_printers; i++)
+        add_printer(strings + printer_recs[i].name, types[printer_recs[i].type],
+                    printer_recs[i].flags, &printer_recs[i].policy);
+
+    // Conversions are all defined, so the paths can be filled in.
+    for (uint32_t i = 0; result == 0 && i < h->num_routes; i++) {
+        struct snap_route *rec = &route_recs[i];
+        if (rec->len < 0) {
+            set_route(types[rec->from], types[rec->to], NULL);
+            continue;
+        }
+        CONVERSION **route = malloc((rec->len + 1) * sizeof(*route));
+        if (route == NULL)
+            continue;   // left to be searched for
+        for (int32_t k = 0; k < rec->len; k++)
+            route[k] = convs[words[rec->first + k]];
+        route[rec->len] = NULL;
+        set_route(types[rec->from], types[rec->to], route);
+        free(route);
+    }
+
+    free(types);
+    free(convs);
+    munmap(map, size);
+    return result;
+}
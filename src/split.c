@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "split.h"
+#include "dispatch.h"
+#include "globals.h"
+#include "presi.h"
+#include "conversions.h"
+#include "timers.h"
+#include "graph.h"
+#include "stats.h"
+#include "intern.h"
+
+#define MAX_SPLITTERS 32
+
+struct splitter {
+    FILE_TYPE *type;
+    char **cmd_and_args;
+};
+
+static struct splitter splitters[MAX_SPLITTERS];
+static int num_splitters = 0;
+
+static void free_argv(char **argv) {
+    if (argv == NULL) return;
+    for (int i = 0; argv[i]; i++)
+        free(argv[i]);
+    free(argv);
+}
+
+int define_splitter(char *type_name, char **cmd_and_args) {
+    FILE_TYPE *type = graph_find_type(type_name);
+    if (type == NULL)
+        return -1;
+
+    struct splitter *sp = NULL;
+    for (int i = 0; i < num_splitters; i++) {
+        if (splitters[i].type == type)
+            sp = &splitters[i];
+    }
+
+    if (cmd_and_args == NULL) {
+        if (sp != NULL) {
+            free_argv(sp->cmd_and_args);
+            *sp = splitters[--num_splitters];
+        }
+        return 0;
+    }
+
+    if (sp == NULL) {
+        if (num_splitters >= MAX_SPLITTERS)
+            return -1;
+        sp = &splitters[num_splitters++];
+        sp->type = type;
+    } else {
+        free_argv(sp->cmd_and_args);
+    }
+
+    int argc = 0;
+    while (cmd_and_args[argc]) argc++;
+    sp->cmd_and_args = calloc(argc + 1, sizeof(char *));
+    for (int i = 0; i < argc; i++)
+        sp->cmd_and_args[i] = strdup(cmd_and_args[i]);
+    return 0;
+}
+
+static struct splitter *find_splitter(FILE_TYPE *type) {
+    for (int i = 0; i < num_splitters; i++) {
+        if (splitters[i].type == type)
+            return &splitters[i];
+    }
+    return NULL;
+}
+
+static struct job *new_chunk(struct job *parent, char *file, off_t offset, off_t length, int owns_file) {
+    char *interned = intern(file);
+    if (interned == NULL)
+        return NULL;
+    int j = num_jobs++;
+    struct job *c = &jobs[j];
+    memset(c, 0, sizeof(*c));
+    memset(&job_sched[j], 0, sizeof(job_sched[j]));
+    c->id = next_job_id++;
+    c->file = interned;
+    c->type = parent->type;
+    job_status[j] = JOB_CREATED;
+    stats_job_status(c->type, JOB_DELETED, JOB_CREATED);
+    job_eligible[j] = job_eligible[job_index(parent)];
+    job_pgid[j] = -1;
+    c->status_changed_at = time(NULL);
+    c->parent = parent->id;
+    c->global_id = parent->global_id;
+    c->offset = offset;
+    c->length = length;
+    c->owns_file = owns_file;
+    c->timeout_ms = parent->timeout_ms;
+    c->retention_ms = parent->retention_ms;
+    c->copies = 1;
+    job_sched[j].priority = job_sched[job_index(parent)].priority;
+    c->preempted_on = -1;
+    c->cpu_us = -1;
+    c->mem_kb = -1;
+    job_sched[j].queued_ms = timers_now_ms();
+
+    sf_job_created(c->id, c->file, c->type->name);
+
+    char created_str[64];
+    format_time(c->status_changed_at, created_str, sizeof(created_str));
+    printf("JOB[%d]: type=%s, creation(%s), status(%s)=%s, eligible=%08x, file=%s, chunk of=%d\n",
+           c->id, c->type->name, created_str, created_str,
+           job_status_names[JOB_CREATED], job_eligible[j], c->file, parent->id);
+    return c;
+}
+
+/* A splitter running in the background for a job. */
+struct split_run {
+    pid_t pid;           // its process group
+    int parent;          // id of the job being split
+    int chunks;          // chunks requested
+    char dir[64];        // private directory it writes the chunks to
+};
+
+static struct split_run runs[MAX_JOBS];
+static int num_runs = 0;
+
+static void chunk_path(struct split_run *r, int i, char *buf, size_t size) {
+    snprintf(buf, size, "%s/chunk.%d", r->dir, i);
+}
+
+/* Removes the splitter outputs from the first on that no chunk job took, and
+ * the directory once it is empty. */
+static void remove_outputs(struct split_run *r, int first) {
+    char path[128];
+    for (int i = first; i < r->chunks; i++) {
+        chunk_path(r, i, path, sizeof(path));
+        unlink(path);
+    }
+    rmdir(r->dir);
+}
+
+/*
+ * Starts the splitter on a job's file, writing to a directory of its own,
+ * and returns 0, or -1 if it could not be started.  It is reaped like a
+ * job's master, by split_reaped().
+ */
+static int start_splitter(struct splitter *sp, struct job *parent, int chunks) {
+    struct split_run *r = &runs[num_runs];
+    snprintf(r->dir, sizeof(r->dir), "/tmp/presi_split_XXXXXX");
+    if (mkdtemp(r->dir) == NULL)
+        return -1;
+
+    char chunks_str[16], prefix[80];
+    snprintf(chunks_str, sizeof(chunks_str), "%d", chunks);
+    snprintf(prefix, sizeof(prefix), "%s/chunk", r->dir);
+
+    int argc = 0;
+    while (sp->cmd_and_args[argc]) argc++;
+    char *argv[argc + 3];
+    for (int i = 0; i < argc; i++)
+        argv[i] = sp->cmd_and_args[i];
+    argv[argc] = chunks_str;
+    argv[argc + 1] = prefix;
+    argv[argc + 2] = NULL;
+
+    fflush(stdout);  // the splitter must not inherit buffered output
+    pid_t pid = fork();
+    if (pid < 0) {
+        rmdir(r->dir);
+        return -1;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);  // cancelling the job kills the whole group
+        int in_fd = open(parent->file, O_RDONLY);
+        if (in_fd < 0) _exit(1);
+        dup2(in_fd, STDIN_FILENO);
+        close(in_fd);
+        execvp(argv[0], argv);
+        _exit(1);
+    }
+    setpgid(pid, pid);
+
+    r->pid = pid;
+    r->parent = parent->id;
+    r->chunks = chunks;
+    num_runs++;
+    return 0;
+}
+
+/* Splits a job into byte ranges of its file; returns the number of chunks or -1. */
+static int split_by_range(struct job *parent, int chunks) {
+    struct stat st;
+    if (stat(parent->file, &st) < 0 || st.st_size < chunks)
+        return -1;
+
+    off_t chunk_size = (st.st_size + chunks - 1) / chunks;
+    int created = 0;
+    for (off_t off = 0; off < st.st_size; off += chunk_size) {
+        off_t len = st.st_size - off < chunk_size ? st.st_size - off : chunk_size;
+        created++;
+        job_sched[job_index(parent)].chunks_left = created;
+        new_chunk(parent, parent->file, off, len, 0);
+    }
+    return created;
+}
+
+int split_job(struct job *parent, int chunks) {
+    if (chunks > MAX_JOBS - num_jobs)
+        chunks = MAX_JOBS - num_jobs;
+    if (chunks < 2)
+        return -1;
+
+    struct splitter *sp = find_splitter(parent->type);
+    if (sp != NULL) {
+        if (start_splitter(sp, parent, chunks) == 0) {
+            job_sched[job_index(parent)].chunks_left = chunks;   // keeps it from being dispatched meanwhile
+            return 0;
+        }
+        fprintf(stderr, "Splitter for type %s failed, splitting by byte ranges\n", parent->type->name);
+    }
+    return split_by_range(parent, chunks);
+}
+
+int split_reaped(pid_t pid, int status) {
+    int i = 0;
+    while (i < num_runs && runs[i].pid != pid)
+        i++;
+    if (i == num_runs)
+        return 0;
+    struct split_run r = runs[i];
+    runs[i] = runs[--num_runs];
+
+    struct job *parent = find_job(r.parent);
+    if (parent == NULL || job_status[job_index(parent)] != JOB_CREATED) {
+        remove_outputs(&r, 0);   // cancelled while it was being split
+        return 1;
+    }
+
+    // The job table may have filled up while the splitter ran.
+    int room = MAX_JOBS - num_jobs;
+    int produced = 0;
+    char path[128];
+    while (WIFEXITED(status) && WEXITSTATUS(status) == 0 && produced < r.chunks && produced < room) {
+        chunk_path(&r, produced, path, sizeof(path));
+        if (access(path, R_OK) != 0) break;
+        produced++;
+    }
+
+    job_sched[job_index(parent)].chunks_left = 0;
+    if (produced > 0) {
+        job_sched[job_index(parent)].chunks_left = produced;
+        for (int c = 0; c < produced; c++) {
+            chunk_path(&r, c, path, sizeof(path));
+            if (new_chunk(parent, path, 0, -1, 1) == NULL) {
+                unlink(path);   // out of memory: counted as an aborted chunk
+                job_sched[job_index(parent)].chunks_left--;
+                parent->chunks_failed++;
+            }
+        }
+        remove_outputs(&r, produced);
+        return 1;
+    }
+
+    remove_outputs(&r, 0);
+    fprintf(stderr, "Splitter for type %s failed, splitting by byte ranges\n", parent->type->name);
+    int chunks = r.chunks < room ? r.chunks : room;
+    if (chunks >= 2)
+        split_by_range(parent, chunks);   // else it prints whole
+    return 1;
+}
+
+void split_remove_output(struct job *chunk) {
+    unlink(chunk->file);
+    // The directory goes with the last chunk's output.
+    char dir[128];
+    snprintf(dir, sizeof(dir), "%s", chunk->file);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        rmdir(dir);
+    }
+}
+
+void split_chunk_started(struct job *chunk) {
+    struct job *parent = find_job(chunk->parent);
+    if (parent != NULL && job_status[job_index(parent)] == JOB_CREATED) {
+        set_job_status(job_index(parent), JOB_RUNNING);
+        parent->status_changed_at = time(NULL);
+        sf_job_status(parent->id, JOB_RUNNING);
+    }
+}
+
+void split_chunk_done(struct job *chunk) {
+    struct job *parent = find_job(chunk->parent);
+    if (parent == NULL)
+        return;
+    int p = job_index(parent);
+    if (job_sched[p].chunks_left == 0)
+        return;
+
+    if (job_status[job_index(chunk)] == JOB_ABORTED)
+        parent->chunks_failed++;
+    if (--job_sched[p].chunks_left > 0)
+        return;
+    if (job_status[p] == JOB_FINISHED || job_status[p] == JOB_ABORTED)
+        return;
+
+    parent->status_changed_at = time(NULL);
+    if (parent->chunks_failed == 0) {
+        set_job_status(p, JOB_FINISHED);
+        sf_job_status(parent->id, JOB_FINISHED);
+        sf_job_finished(parent->id, 0);
+    } else {
+        set_job_status(p, JOB_ABORTED);
+        sf_job_status(parent->id, JOB_ABORTED);
+        sf_job_aborted(parent->id, 0);
+    }
+    schedule_job_deletion(parent);
+}
+
+void split_cancel(struct job *parent) {
+    for (int i = 0; i < num_runs; i++) {
+        if (runs[i].parent == parent->id) {
+            kill(-runs[i].pid, SIGKILL);   // its output is removed once it is reaped
+            job_sched[job_index(parent)].chunks_left = 0;
+        }
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        struct job *c = &jobs[i];
+        if (c->parent != parent->id ||
+            job_status[i] == JOB_FINISHED || job_status[i] == JOB_ABORTED || job_status[i] == JOB_DELETED)
+            continue;
+
+        if (job_pgid[i] > 0) {
+            // The chunk is accounted for when its process group is reaped.
+            kill(-job_pgid[i], SIGTERM);
+            kill(-job_pgid[i], SIGCONT);
+        } else {
+            job_sched[job_index(parent)].chunks_left--;
+        }
+        set_job_status(i, JOB_ABORTED);
+        c->status_changed_at = time(NULL);
+        sf_job_status(c->id, JOB_ABORTED);
+        sf_job_aborted(c->id, 0);
+        schedule_job_deletion(c);
+    }
+}
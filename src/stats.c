@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "graph.h"
+#include "timers.h"
+#include "globals.h"
+#include "presi.h"
+#include "conversions.h"
+
+#define BUCKET_MS 5000
+#define NUM_BUCKETS 180                       // 15 minutes
+#define NUM_HIST 160                          // latency histogram buckets
+
+/* Upper bounds of the exported histogram buckets, in seconds. */
+static const double le_seconds[] = { 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300 };
+#define NUM_LE ((int)(sizeof(le_seconds) / sizeof(le_seconds[0])))
+
+/* Busy time of one printer, per bucket of BUCKET_MS. */
+struct printer_stats {
+    long long since_ms;                   // when the printer was defined
+    long long busy_since_ms;              // start of the job it is printing, 0 if idle
+    long long epoch[NUM_BUCKETS];         // bucket number held by each slot
+    int busy_ms[NUM_BUCKETS];
+    long long busy_total_ms;              // since the printer was defined
+};
+
+/*
+ * Latencies in milliseconds, four buckets per power of two for percentiles,
+ * and cumulative counts at the bounds in le_seconds for export.
+ */
+struct histogram {
+    long long count;
+    long long sum_ms;
+    long long buckets[NUM_HIST];
+    long long le[NUM_LE];
+};
+
+/* Queue depth and resources used by jobs of one input type. */
+struct type_stats {
+    int queued;
+    long long cpu_us;                     // CPU time of ended jobs
+    long mem_peak_kb;                     // largest memory peak of an ended job
+};
+
+/* Run times of the stages of one conversion. */
+struct conversion_stats {
+    CONVERSION *conv;
+    struct histogram hist;
+};
+
+static struct printer_stats printer_stats[MAX_PRINTERS];
+static int jobs_by_status[JOB_DELETED];
+static struct type_stats *type_stats;         // indexed by type index
+static int type_stats_cap = 0;
+static struct histogram wait_hist, run_hist;
+static int procs_admitted = 0;
+static long long jobs_created = 0, jobs_finished = 0, jobs_aborted = 0;
+static struct conversion_stats *conversion_stats;
+static int num_conversion_stats = 0;
+
+static int hist_bucket(long long ms) {
+    if (ms < 4)
+        return ms < 0 ? 0 : ms;
+    int e = 63 - __builtin_clzll(ms);         // ms >= 4, so e >= 2
+    int b = 4 + (e - 2) * 4 + ((ms >> (e - 2)) & 3);
+    return b < NUM_HIST ? b : NUM_HIST - 1;
+}
+
+/* Midpoint of a bucket's range. */
+static long long hist_value(int b) {
+    if (b < 4)
+        return b;
+    int e = (b - 4) / 4 + 2;
+    long long low = (4LL + (b - 4) % 4) << (e - 2);
+    return low + (1LL << (e - 2)) / 2;
+}
+
+static void hist_add(struct histogram *h, long long ms) {
+    h->buckets[hist_bucket(ms)]++;
+    h->count++;
+    h->sum_ms += ms;
+    for (int k = 0; k < NUM_LE; k++) {
+        if (ms <= le_seconds[k] * 1000)
+            h->le[k]++;
+    }
+}
+
+static long long hist_percentile(const struct histogram *h, int pct) {
+    long long rank = (h->count * pct + 99) / 100, seen = 0;
+    for (int b = 0; b < NUM_HIST; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank && seen > 0)
+            return hist_value(b);
+    }
+    return 0;
+}
+
+static struct type_stats *type_slot(FILE_TYPE *type) {
+    if (type == NULL || type->index < 0)
+        return NULL;
+    if (type->index >= type_stats_cap) {
+        int cap = type_stats_cap ? type_stats_cap : 16;
+        while (cap <= type->index)
+            cap *= 2;
+        struct type_stats *grown = realloc(type_stats, cap * sizeof(*grown));
+        if (grown == NULL)
+            return NULL;
+        memset(&grown[type_stats_cap], 0, (cap - type_stats_cap) * sizeof(*grown));
+        type_stats = grown;
+        type_stats_cap = cap;
+    }
+    return &type_stats[type->index];
+}
+
+void stats_job_status(FILE_TYPE *type, int from, int to) {
+    if (from == to)
+        return;
+    if (from >= 0 && from < JOB_DELETED)
+        jobs_by_status[from]--;
+    if (to >= 0 && to < JOB_DELETED)
+        jobs_by_status[to]++;
+    jobs_created += from == JOB_DELETED;
+    jobs_finished += to == JOB_FINISHED;
+    jobs_aborted += to == JOB_ABORTED;
+
+    struct type_stats *ts = type_slot(type);
+    if (ts != NULL)
+        ts->queued += (to == JOB_CREATED) - (from == JOB_CREATED);
+}
+
+void stats_job_resources(FILE_TYPE *type, long long cpu_us, long mem_kb) {
+    struct type_stats *ts = type_slot(type);
+    if (ts == NULL)
+        return;
+    if (cpu_us > 0)
+        ts->cpu_us += cpu_us;
+    if (mem_kb > ts->mem_peak_kb)
+        ts->mem_peak_kb = mem_kb;
+}
+
+/* Adds the busy interval [start, end) to a printer's buckets. */
+static void add_busy(struct printer_stats *ps, long long start, long long end) {
+    if (start < end - (long long)NUM_BUCKETS * BUCKET_MS)
+        start = end - (long long)NUM_BUCKETS * BUCKET_MS;
+    while (start < end) {
+        long long epoch = start / BUCKET_MS;
+        long long bucket_end = (epoch + 1) * BUCKET_MS;
+        long long until = end < bucket_end ? end : bucket_end;
+        int slot = epoch % NUM_BUCKETS;
+        if (ps->epoch[slot] != epoch) {
+            ps->epoch[slot] = epoch;
+            ps->busy_ms[slot] = 0;
+        }
+        ps->busy_ms[slot] += until - start;
+        start = until;
+    }
+}
+
+void stats_printer_defined(int p) {
+    struct printer_stats *ps = &printer_stats[p];
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        ps->epoch[i] = -1;
+        ps->busy_ms[i] = 0;
+    }
+    ps->busy_since_ms = 0;
+    ps->busy_total_ms = 0;
+    ps->since_ms = timers_now_ms();
+}
+
+void stats_printer_busy(int p, int busy) {
+    struct printer_stats *ps = &printer_stats[p];
+    long long now = timers_now_ms();
+    if (busy) {
+        ps->busy_since_ms = now;
+    } else if (ps->busy_since_ms > 0) {
+        add_busy(ps, ps->busy_since_ms, now);
+        ps->busy_total_ms += now - ps->busy_since_ms;
+        ps->busy_since_ms = 0;
+    }
+}
+
+/* Percentage of the last window_ms (or of the printer's lifetime, if shorter) spent busy. */
+static int utilization(const struct printer_stats *ps, long long now, long long window_ms) {
+    long long from = now - window_ms;
+    if (from < ps->since_ms)
+        from = ps->since_ms;
+    if (now <= from)
+        return 0;
+
+    long long busy = 0;
+    for (long long epoch = from / BUCKET_MS; epoch <= now / BUCKET_MS; epoch++) {
+        int slot = epoch % NUM_BUCKETS;
+        if (ps->epoch[slot] == epoch)
+            busy += ps->busy_ms[slot];
+    }
+    if (ps->busy_since_ms > 0)
+        busy += now - (ps->busy_since_ms > from ? ps->busy_since_ms : from);
+
+    long long pct = busy * 100 / (now - from);
+    return pct > 100 ? 100 : pct;
+}
+
+void stats_job_started(long long wait_ms, int procs) {
+    hist_add(&wait_hist, wait_ms > 0 ? wait_ms : 0);
+    procs_admitted += procs;
+}
+
+void stats_job_ended(long long run_ms, int procs) {
+    if (run_ms >= 0)
+        hist_add(&run_hist, run_ms);
+    procs_admitted -= procs;
+}
+
+void stats_conversion_ms(CONVERSION *conv, long long ms) {
+    int i = 0;
+    while (i < num_conversion_stats && conversion_stats[i].conv != conv)
+        i++;
+    if (i == num_conversion_stats) {
+        struct conversion_stats *grown =
+            realloc(conversion_stats, (i + 1) * sizeof(*grown));
+        if (grown == NULL)
+            return;
+        conversion_stats = grown;
+        memset(&conversion_stats[i], 0, sizeof(conversion_stats[i]));
+        conversion_stats[i].conv = conv;
+        num_conversion_stats++;
+    }
+    hist_add(&conversion_stats[i].hist, ms);
+}
+
+static void report_latency(FILE *out, const char *what, const struct histogram *h) {
+    fprintf(out, "%s: n=%lld, p50=%.1fs, p90=%.1fs, p99=%.1fs\n", what, h->count,
+            hist_percentile(h, 50) / 1000.0, hist_percentile(h, 90) / 1000.0,
+            hist_percentile(h, 99) / 1000.0);
+}
+
+void stats_report(FILE *out) {
+    long long now = timers_now_ms();
+    fprintf(out, "TOP: queued=%d, running=%d, paused=%d, finished=%d, aborted=%d, procs=%d\n",
+            jobs_by_status[JOB_CREATED], jobs_by_status[JOB_RUNNING],
+            jobs_by_status[JOB_PAUSED], jobs_by_status[JOB_FINISHED],
+            jobs_by_status[JOB_ABORTED], procs_admitted);
+
+    for (int p = 0; p < num_printers; p++) {
+        if (printers[p].name == NULL)
+            continue;
+        const struct printer_stats *ps = &printer_stats[p];
+        fprintf(out, "PRINTER[%d]: name=%s, status=%s, util=%d%%/%d%%/%d%% (1m/5m/15m)\n",
+                p, printers[p].name,
+                printers[p].status == PRINTER_BUSY ? "busy" :
+                printers[p].status == PRINTER_IDLE ? "idle" : "disabled",
+                utilization(ps, now, 60000), utilization(ps, now, 300000),
+                utilization(ps, now, 900000));
+    }
+
+    FILE_TYPE **types;
+    int num_types = graph_types(&types);
+    for (int t = 0; t < num_types; t++) {
+        struct type_stats *ts = type_slot(types[t]);
+        if (ts != NULL && ts->queued > 0)
+            fprintf(out, "QUEUE: type=%s, depth=%d\n", types[t]->name, ts->queued);
+    }
+
+    report_latency(out, "WAIT", &wait_hist);
+    report_latency(out, "SERVICE", &run_hist);
+}
+
+/* Writes a label value, escaped as the text format requires. */
+static void export_label(FILE *out, const char *value) {
+    for (; *value; value++) {
+        if (*value == '\\' || *value == '"')
+            fputc('\\', out);
+        if (*value == '\n')
+            fputs("\\n", out);
+        else
+            fputc(*value, out);
+    }
+}
+
+static void export_header(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Writes a histogram's samples; labels is empty or "name=\"value\"," with a trailing comma. */
+static void export_histogram(FILE *out, const char *name, const char *labels,
+                             const struct histogram *h) {
+    for (int k = 0; k < NUM_LE; k++)
+        fprintf(out, "%s_bucket{%sle=\"%g\"} %lld\n", name, labels, le_seconds[k], h->le[k]);
+    fprintf(out, "%s_bucket{%sle=\"+Inf\"} %lld\n", name, labels, h->count);
+    int len = strlen(labels);
+    if (len > 0)   // drop the trailing comma
+        fprintf(out, "%s_sum{%.*s} %.3f\n%s_count{%.*s} %lld\n", name, len - 1, labels,
+                h->sum_ms / 1000.0, name, len - 1, labels, h->count);
+    else
+        fprintf(out, "%s_sum %.3f\n%s_count %lld\n", name, h->sum_ms / 1000.0, name, h->count);
+}
+
+void stats_export(FILE *out) {
+    static const char *status_labels[] = { "queued", "running", "paused", "finished", "aborted" };
+    long long now = timers_now_ms();
+
+    export_header(out, "presi_jobs_created_total", "counter", "Jobs created, including chunks.");
+    fprintf(out, "presi_jobs_created_total %lld\n", jobs_created);
+    export_header(out, "presi_jobs_finished_total", "counter", "Jobs that finished.");
+    fprintf(out, "presi_jobs_finished_total %lld\n", jobs_finished);
+    export_header(out, "presi_jobs_aborted_total", "counter", "Jobs that were aborted.");
+    fprintf(out, "presi_jobs_aborted_total %lld\n", jobs_aborted);
+
+    export_header(out, "presi_jobs", "gauge", "Jobs by status.");
+    for (int s = 0; s < JOB_DELETED; s++)
+        fprintf(out, "presi_jobs{status=\"%s\"} %d\n", status_labels[s], jobs_by_status[s]);
+
+    export_header(out, "presi_queue_depth", "gauge", "Queued jobs by input type.");
+    FILE_TYPE **types;
+    int num_types = graph_types(&types);
+    for (int t = 0; t < num_types; t++) {
+        struct type_stats *ts = type_slot(types[t]);
+        fprintf(out, "presi_queue_depth{type=\"");
+        export_label(out, types[t]->name);
+        fprintf(out, "\"} %d\n", ts ? ts->queued : 0);
+    }
+
+    export_header(out, "presi_job_cpu_seconds_total", "counter",
+                  "CPU time of the pipelines of ended jobs, by input type.");
+    for (int t = 0; t < num_types; t++) {
+        struct type_stats *ts = type_slot(types[t]);
+        fprintf(out, "presi_job_cpu_seconds_total{type=\"");
+        export_label(out, types[t]->name);
+        fprintf(out, "\"} %.3f\n", ts ? ts->cpu_us / 1e6 : 0.0);
+    }
+    export_header(out, "presi_job_memory_peak_bytes", "gauge",
+                  "Largest memory peak of an ended job's pipeline, by input type.");
+    for (int t = 0; t < num_types; t++) {
+        struct type_stats *ts = type_slot(types[t]);
+        fprintf(out, "presi_job_memory_peak_bytes{type=\"");
+        export_label(out, types[t]->name);
+        fprintf(out, "\"} %lld\n", ts ? ts->mem_peak_kb * 1024LL : 0);
+    }
+
+    export_header(out, "presi_conversion_processes", "gauge",
+                  "Conversion processes admitted for dispatched jobs.");
+    fprintf(out, "presi_conversion_processes %d\n", procs_admitted);
+
+    export_header(out, "presi_dispatch_wait_seconds", "histogram",
+                  "Time jobs spent queued before dispatch.");
+    export_histogram(out, "presi_dispatch_wait_seconds", "", &wait_hist);
+    export_header(out, "presi_job_run_seconds", "histogram",
+                  "Run time of finished jobs, not counting pauses.");
+    export_histogram(out, "presi_job_run_seconds", "", &run_hist);
+
+    export_header(out, "presi_printer_busy_seconds_total", "counter",
+                  "Time printers spent printing jobs since they were defined.");
+    for (int p = 0; p < num_printers; p++) {
+        if (printers[p].name == NULL)
+            continue;
+        const struct printer_stats *ps = &printer_stats[p];
+        long long busy = ps->busy_total_ms + (ps->busy_since_ms > 0 ? now - ps->busy_since_ms : 0);
+        fprintf(out, "presi_printer_busy_seconds_total{printer=\"");
+        export_label(out, printers[p].name);
+        fprintf(out, "\"} %.3f\n", busy / 1000.0);
+    }
+
+    export_header(out, "presi_conversion_seconds", "histogram",
+                  "Time from job start until each conversion stage exited.");
+    CONVERSION **convs;
+    int num_convs = graph_conversions(&convs);
+    for (int c = 0; c < num_convs; c++) {
+        for (int i = 0; i < num_conversion_stats; i++) {
+            if (conversion_stats[i].conv != convs[c])
+                continue;
+            char *labels;
+            size_t len;
+            FILE *l = open_memstream(&labels, &len);
+            if (l == NULL)
+                break;
+            fprintf(l, "from=\"");
+            export_label(l, convs[c]->from->name);
+            fprintf(l, "\",to=\"");
+            export_label(l, convs[c]->to->name);
+            fprintf(l, "\",");
+            fclose(l);
+            export_histogram(out, "presi_conversion_seconds", labels, &conversion_stats[i].hist);
+            free(labels);
+        }
+    }
+}
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "timers.h"
+
+/*
+ * Hierarchical timing wheel.  Level 0 has one slot per tick; each slot of
+ * level n covers a whole revolution of level n - 1.  A timer is filed in the
+ * lowest level whose range covers its delay and moves down a level each time
+ * the wheel reaches the start of its slot, so adding, cancelling and expiring
+ * a timer are all constant time.  A bitmap of non-empty slots per level lets
+ * the wheel skip idle stretches and tells arm() when the next slot is due.
+ */
+#define TIMER_TICK_MS  10
+#define WHEEL_BITS     6
+#define WHEEL_SLOTS    (1 << WHEEL_BITS)
+#define WHEEL_MASK     (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS   4
+#define WHEEL_RANGE    (1LL << (WHEEL_BITS * WHEEL_LEVELS))   // ~31 days of ticks
+
+struct timer {
+    struct timer *next;
+    struct timer **pprev;
+    long long expires;       // tick
+    int level;
+    int slot;
+    timer_func_t *func;
+    int arg;
+};
+
+static struct timer *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t occupied[WHEEL_LEVELS];
+static long long wheel_tick = -1;      // last tick processed
+static int num_pending = 0;
+
+long long timers_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long long now_tick(void) {
+    return timers_now_ms() / TIMER_TICK_MS;
+}
+
+static void link_timer(struct timer *t) {
+    long long delta = t->expires - wheel_tick;
+    long long slot_of = t->expires;
+    int level = 0;
+
+    if (delta >= WHEEL_RANGE)
+        slot_of = wheel_tick + WHEEL_RANGE - 1;   // filed as far out as possible, refiled later
+    while (level < WHEEL_LEVELS - 1 && delta >= 1LL << (WHEEL_BITS * (level + 1)))
+        level++;
+
+    t->level = level;
+    t->slot = (slot_of >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    struct timer **head = &wheel[level][t->slot];
+    t->next = *head;
+    if (*head != NULL)
+        (*head)->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    occupied[level] |= 1ULL << t->slot;
+}
+
+static void unlink_timer(struct timer *t) {
+    *t->pprev = t->next;
+    if (t->next != NULL)
+        t->next->pprev = t->pprev;
+    if (wheel[t->level][t->slot] == NULL)
+        occupied[t->level] &= ~(1ULL << t->slot);
+}
+
+/*
+ * @return the distance, 1 to WHEEL_SLOTS, from slot cur to the next occupied
+ * slot after it, or 0 if no slot of the level is occupied.
+ */
+static int next_occupied(int level, int cur) {
+    uint64_t bits = occupied[level];
+    if (bits == 0)
+        return 0;
+    int shift = (cur + 1) & WHEEL_MASK;
+    if (shift != 0)
+        bits = (bits >> shift) | (bits << (WHEEL_SLOTS - shift));
+    return __builtin_ctzll(bits) + 1;
+}
+
+/*
+ * @return the first tick after wheel_tick at which a slot holding timers is
+ * processed, or -1 if there are no timers.
+ */
+static long long next_event_tick(void) {
+    long long best = -1;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        int dist = next_occupied(level, (wheel_tick >> shift) & WHEEL_MASK);
+        if (dist == 0)
+            continue;
+        // Slots of upper levels are processed when the levels below wrap to 0.
+        long long tick = ((wheel_tick >> shift) + dist) << shift;
+        if (best < 0 || tick < best)
+            best = tick;
+    }
+    return best;
+}
+
+static void arm(void) {
+    struct itimerval it = {0};
+    long long next = num_pending > 0 ? next_event_tick() : -1;
+    if (next >= 0) {
+        long long delay = next * TIMER_TICK_MS - timers_now_ms();
+        if (delay < 1) delay = 1;
+        it.it_value.tv_sec = delay / 1000;
+        it.it_value.tv_usec = (delay % 1000) * 1000;
+    }
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+struct timer *timer_add(long ms, timer_func_t *func, int arg) {
+    struct timer *t = malloc(sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    if (wheel_tick < 0)
+        wheel_tick = now_tick();
+
+    t->expires = (timers_now_ms() + ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (t->expires <= wheel_tick)
+        t->expires = wheel_tick + 1;
+    t->func = func;
+    t->arg = arg;
+    link_timer(t);
+    num_pending++;
+
+    arm();
+    return t;
+}
+
+void timer_cancel(struct timer *t) {
+    if (t == NULL)
+        return;
+    unlink_timer(t);
+    free(t);
+    num_pending--;
+}
+
+// Moves the timers of a slot down to the levels that now cover them.
+static void cascade(int level, int slot) {
+    struct timer *t = wheel[level][slot];
+    wheel[level][slot] = NULL;
+    occupied[level] &= ~(1ULL << slot);
+    while (t != NULL) {
+        struct timer *next = t->next;
+        link_timer(t);
+        t = next;
+    }
+}
+
+void timers_run(void) {
+    if (wheel_tick < 0)
+        return;
+    long long target = now_tick();
+
+    while (wheel_tick < target && num_pending > 0) {
+        // Jump over ticks that cannot hold anything.
+        long long next = next_event_tick();
+        if (next > target)
+            break;
+        wheel_tick = next;
+
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            int shift = WHEEL_BITS * level;
+            if ((wheel_tick & ((1LL << shift) - 1)) != 0)
+                break;
+            cascade(level, (wheel_tick >> shift) & WHEEL_MASK);
+        }
+
+        int slot = wheel_tick & WHEEL_MASK;
+        struct timer *t;
+        while ((t = wheel[0][slot]) != NULL) {
+            // Unlinked before the call, so the callback may add or cancel timers.
+            unlink_timer(t);
+            num_pending--;
+            t->func(t->arg);
+            free(t);
+        }
+    }
+    wheel_tick = target;
+    arm();
+}
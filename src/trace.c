@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "trace.h"
+#include "globals.h"
+#include "presi.h"
+#include "conversions.h"
+#include "graph.h"
+#include "pipeline.h"
+#include "timers.h"
+
+#define TRACE_EVENTS 4096          // events held before they are written out
+#define TRACE_FLUSH_MS 1000
+
+#define TID_LIFECYCLE 0
+#define TID_WRITE 1
+#define TID_STAGE 2               // first stage; stage i is TID_STAGE + i
+
+struct event {
+    char ph;                      // 'X' span, 'i' instant, 'M' metadata
+    int pid, tid;                 // job id, row within the job
+    long long ts, dur;            // microseconds
+    char name[32];
+    char arg[96];                 // name given by metadata, or the status of an instant
+};
+
+static FILE *trace_file;
+static struct event events[TRACE_EVENTS];
+static int num_events;
+static int events_written;        // to the file, for the separators
+static struct timer *flush_timer;
+
+long long trace_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int trace_active(void) {
+    return trace_file != NULL;
+}
+
+static void write_string(const char *s) {
+    fputc('"', trace_file);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(trace_file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(trace_file, "\\u%04x", c);
+        else
+            fputc(c, trace_file);
+    }
+    fputc('"', trace_file);
+}
+
+static void flush_events(void) {
+    for (int i = 0; i < num_events; i++) {
+        struct event *e = &events[i];
+        fputs(events_written++ ? ",\n{\"name\":" : "{\"name\":", trace_file);
+        write_string(e->name);
+        fprintf(trace_file, ",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d", e->ph, e->pid, e->tid);
+        if (e->ph != 'M')
+            fprintf(trace_file, ",\"ts\":%lld", e->ts);
+        if (e->ph == 'X')
+            fprintf(trace_file, ",\"dur\":%lld", e->dur);
+        if (e->ph == 'i')
+            fputs(",\"s\":\"t\"", trace_file);
+        if (e->arg[0] != '\0') {
+            fputs(e->ph == 'M' ? ",\"args\":{\"name\":" : ",\"args\":{\"status\":", trace_file);
+            write_string(e->arg);
+            fputc('}', trace_file);
+        }
+        fputc('}', trace_file);
+    }
+    num_events = 0;
+    fflush(trace_file);
+}
+
+static void flush_tick(int arg) {
+    (void)arg;
+    flush_events();
+    flush_timer = timer_add(TRACE_FLUSH_MS, flush_tick, 0);
+}
+
+static struct event *add_event(char ph, int pid, int tid, const char *name) {
+    if (num_events == TRACE_EVENTS)
+        flush_events();   // more than a flush interval's worth; write them now
+    struct event *e = &events[num_events++];
+    e->ph = ph;
+    e->pid = pid;
+    e->tid = tid;
+    e->ts = e->dur = 0;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    e->arg[0] = '\0';
+    return e;
+}
+
+static void add_span(int pid, int tid, const char *name, long long from_us, long long to_us) {
+    struct event *e = add_event('X', pid, tid, name);
+    e->ts = from_us;
+    e->dur = to_us > from_us ? to_us - from_us : 0;
+}
+
+static void name_row(int pid, int tid, const char *kind, const char *name) {
+    struct event *e = add_event('M', pid, tid, kind);
+    snprintf(e->arg, sizeof(e->arg), "%s", name);
+}
+
+int trace_start(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+    trace_stop();
+    trace_file = f;
+    num_events = 0;
+    events_written = 0;
+    fcntl(fileno(trace_file), F_SETFD, FD_CLOEXEC);
+    // Flushed right away, as after every write: masters fork with a copy of
+    // the stream and would write out anything still buffered when they exit.
+    fputs("[\n", trace_file);
+    fflush(trace_file);
+    flush_timer = timer_add(TRACE_FLUSH_MS, flush_tick, 0);
+    return 0;
+}
+
+void trace_stop(void) {
+    if (trace_file == NULL)
+        return;
+    timer_cancel(flush_timer);
+    flush_timer = NULL;
+    flush_events();
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+void trace_job_started(struct job *job, long long connect_us, long long connected_us) {
+    if (trace_file == NULL)
+        return;
+    char label[96];
+    snprintf(label, sizeof(label), "job %d %s", job->id, job->file);
+    name_row(job->id, 0, "process_name", label);
+    name_row(job->id, TID_LIFECYCLE, "thread_name", "lifecycle");
+
+    long long started_us = job->started_ms * 1000;
+    add_span(job->id, TID_LIFECYCLE, "queued", job_sched[job_index(job)].queued_ms * 1000,
+             connect_us != 0 ? connect_us : started_us);
+    if (connect_us != 0)
+        add_span(job->id, TID_LIFECYCLE, "connect", connect_us, connected_us);
+}
+
+void trace_job_ended(struct job *job, int p, int status) {
+    if (trace_file == NULL)
+        return;
+    long long started_us = job->started_ms * 1000;
+    long long now_us = trace_now_us();
+
+    CONVERSION **path = find_route(job->type, printers[p].type);
+    for (int i = 0; path != NULL && path[i] != NULL; i++) {
+        char row[32];
+        snprintf(row, sizeof(row), "stage %d", i + 1);
+        name_row(job->id, TID_STAGE + i, "thread_name", row);
+        // Stages that did not exit before the master are cut at the reap.
+        long long done_us = now_us;
+        if (i < 32 && job->progress != NULL && (job->progress->stages_done & (1U << i)))
+            done_us = job->progress->stage_done_ms[i] * 1000;
+        add_span(job->id, TID_STAGE + i, path[i]->cmd_and_args[0], started_us, done_us);
+    }
+    free(path);
+
+    char row[64];
+    snprintf(row, sizeof(row), "printer %s", printers[p].name);
+    name_row(job->id, TID_WRITE, "thread_name", row);
+    add_span(job->id, TID_WRITE, "write", started_us, now_us);
+
+    struct event *e = add_event('i', job->id, TID_LIFECYCLE, "reap");
+    e->ts = now_us;
+    if (WIFEXITED(status))
+        snprintf(e->arg, sizeof(e->arg), "exit %d", WEXITSTATUS(status));
+    else
+        snprintf(e->arg, sizeof(e->arg), "signal %d", WTERMSIG(status));
+}
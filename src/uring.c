@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+#define URING_DEPTH 8                  // reads kept in flight
+#define URING_CHUNK (128 * 1024)       // bytes per read
+
+struct ring {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+};
+
+/* A read of one chunk; chunk n is read into slot n % URING_DEPTH. */
+struct slot {
+    char *buf;
+    off_t offset;       // file offset of the chunk
+    size_t want;        // size of the chunk
+    size_t got;         // bytes read so far
+    int done;           // chunk complete, or short because of end of file
+};
+
+static int ring_init(struct ring *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (r->fd < 0)
+        return -1;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && r->cq_len > r->sq_len)
+        r->sq_len = r->cq_len;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    close(r->fd);
+    return -1;
+}
+
+/* Queues a read of the rest of a slot's chunk; it is submitted by ring_enter(). */
+static void queue_read(struct ring *r, int in_fd, struct slot *s, int index) {
+    unsigned tail = *r->sq_tail;
+    unsigned i = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = in_fd;
+    sqe->addr = (unsigned long)(s->buf + s->got);
+    sqe->len = s->want - s->got;
+    sqe->off = s->offset + s->got;
+    sqe->user_data = index;
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int ring_enter(struct ring *r, unsigned to_submit, unsigned min_complete) {
+    for (;;) {
+        int n = syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+                        min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0 || errno != EINTR)
+            return n < 0 ? -1 : 0;
+    }
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int uring_copy(int in_fd, off_t offset, off_t length, int out_fd,
+               volatile long long *copied) {
+    struct ring r;
+    if (ring_init(&r) < 0)
+        return URING_UNAVAILABLE;
+
+    struct slot slots[URING_DEPTH];
+    char *bufs = malloc((size_t)URING_DEPTH * URING_CHUNK);
+    if (bufs == NULL) {
+        close(r.fd);
+        return URING_UNAVAILABLE;
+    }
+
+    off_t next = offset;                       // offset of the next chunk to queue
+    off_t end = length >= 0 ? offset + length : -1;
+    int head = 0, queued = 0, in_flight = 0;   // chunk numbers: next to write, next to queue
+    int eof = 0, written = 0, result = 0;
+
+    for (;;) {
+        // Keep the ring full, unless the end is known to be reached.
+        unsigned to_submit = 0;
+        while (!eof && queued - head < URING_DEPTH && (end < 0 || next < end)) {
+            struct slot *s = &slots[queued % URING_DEPTH];
+            s->buf = bufs + (size_t)(queued % URING_DEPTH) * URING_CHUNK;
+            s->offset = next;
+            s->want = end >= 0 && end - next < URING_CHUNK ? (size_t)(end - next) : URING_CHUNK;
+            s->got = 0;
+            s->done = 0;
+            queue_read(&r, in_fd, s, queued % URING_DEPTH);
+            next += s->want;
+            queued++;
+            to_submit++;
+        }
+        if (head == queued)
+            break;
+
+        if (ring_enter(&r, to_submit, 1) < 0) {
+            result = -1;
+            break;
+        }
+        in_flight += to_submit;
+
+        // Collect completions; a short read is continued in place.
+        to_submit = 0;
+        unsigned cq_head = *r.cq_head;
+        while (cq_head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &r.cqes[cq_head & *r.cq_mask];
+            struct slot *s = &slots[cqe->user_data];
+            in_flight--;
+            if (cqe->res < 0) {
+                result = -1;
+            } else if (cqe->res == 0) {
+                s->done = 1;   // end of file
+                eof = 1;
+            } else {
+                s->got += cqe->res;
+                if (s->got == s->want) {
+                    s->done = 1;
+                } else {
+                    queue_read(&r, in_fd, s, cqe->user_data);
+                    to_submit++;
+                }
+            }
+            cq_head++;
+        }
+        __atomic_store_n(r.cq_head, cq_head, __ATOMIC_RELEASE);
+        if (result < 0)
+            break;
+        if (to_submit > 0) {
+            if (ring_enter(&r, to_submit, 0) < 0) {
+                result = -1;
+                break;
+            }
+            in_flight += to_submit;
+        }
+
+        // Write completed chunks in order.
+        while (head < queued && slots[head % URING_DEPTH].done) {
+            struct slot *s = &slots[head % URING_DEPTH];
+            if (s->got > 0 && write_all(out_fd, s->buf, s->got) < 0) {
+                result = -1;
+                break;
+            }
+            written = 1;
+            if (copied != NULL)
+                *copied += s->got;
+            head++;
+            if (s->got < s->want) {
+                // End of file: later chunks are empty.
+                if (end >= 0)
+                    result = -1;   // the range runs past the end of the file
+                head = queued;
+                break;
+            }
+        }
+        if (result < 0 || (eof && head == queued))
+            break;
+    }
+
+    // Reads still in flight use the buffers; wait for them before freeing.
+    while (in_flight > 0 && ring_enter(&r, 0, 1) == 0) {
+        unsigned cq_head = *r.cq_head;
+        while (cq_head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)) {
+            cq_head++;
+            in_flight--;
+        }
+        __atomic_store_n(r.cq_head, cq_head, __ATOMIC_RELEASE);
+    }
+
+    munmap(r.sqes, r.sqes_len);
+    if (r.cq_ptr != r.sq_ptr)
+        munmap(r.cq_ptr, r.cq_len);
+    munmap(r.sq_ptr, r.sq_len);
+    close(r.fd);
+    free(bufs);
+    return result < 0 && !written ? URING_UNAVAILABLE : result;
+}
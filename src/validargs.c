@@ -10,7 +10,21 @@
 #include "vaildargs.h"
 #include "dispatch.h"
 #include "conversions.h"
+#include "graph.h"
 #include "presi.h"
+#include "split.h"
+#include "convattr.h"
+#include "timers.h"
+#include "warm.h"
+#include "policy.h"
+#include "pipeline.h"
+#include "snapshot.h"
+#include "bulk.h"
+#include "stats.h"
+#include "metrics.h"
+#include "trace.h"
+#include "cgroup.h"
+#include "estimate.h"
 
 #define MAX_ARGS 32
 
@@ -19,7 +33,7 @@ volatile sig_atomic_t got_sigchld = 0;
 
 
 void handle_help(FILE *out) {
-    fprintf(out, "Commands are: help quit type printer conversion printers jobs print cancel disable enable pause resume\n");
+    fprintf(out, "Commands are: help quit type printer conversion printers jobs print cancel disable enable remove pause resume splitter retry retention warm limits policy feeder save load bulk top metrics trace faults preempt caps progress\n");
     sf_cmd_ok();
 }
 
@@ -30,7 +44,10 @@ void handle_type(char *line) {
         sf_cmd_error("Missing type name.");
     } else {
         FILE_TYPE *t = define_type(type_name);
-        if (t != NULL) sf_cmd_ok();
+        if (t != NULL) {
+            graph_add_type(t);
+            sf_cmd_ok();
+        }
         else sf_cmd_error("Failed to define type.");
     }
 }
@@ -38,6 +55,8 @@ void handle_type(char *line) {
 void handle_printers(FILE *out) {
     for (int i = 0; i < num_printers; i++) {
         PRINTER *p = &printers[i];
+        if (p->name == NULL)
+            continue;   // removed
         printf("PRINTER: id=%d, name=%s, type=%s, status=%s\n",
                i,
                p->name ? p->name : "(null)",
@@ -61,28 +80,24 @@ void handle_printer(char *line) {
         return;
     }
 
-    FILE_TYPE *ftype = find_type(type_name);
+    FILE_TYPE *ftype = graph_find_type(type_name);
     if (!ftype) {
         sf_cmd_error("printer");
         return;
     }
 
-    if (num_printers >= MAX_PRINTERS) {
+    int i = define_printer(name, ftype);
+    if (i < 0) {
         sf_cmd_error("printer");
         return;
     }
-
-    PRINTER *p = &printers[num_printers++];
-    p->name = strdup(name);
-    p->type = ftype;
-    p->status = PRINTER_DISABLED;
-    p->current_pid = 0;
+    PRINTER *p = &printers[i];
 
     sf_printer_defined(p->name, p->type->name);
 
     // ✅ This line prints immediately after creation (like your professor's output)
     printf("PRINTER: id=%d, name=%s, type=%s, status=disabled\n",
-           num_printers - 1, p->name, p->type->name);
+           i, p->name, p->type->name);
     
     sf_cmd_ok();
 }
@@ -91,16 +106,41 @@ void handle_printer(char *line) {
 void handle_conversion(char *line) {
     char *args = line + 11;
     char *from_type = strtok(args, " \t");
+    int workers = 1;
+    long timeout_ms = 0;
+    int pool = 0;
+    long mem_mb = 0;
+
+    // Options precede the types and each takes exactly one value.
+    while (from_type != NULL && from_type[0] == '-') {
+        char *value = strtok(NULL, " \t");
+        if (value != NULL && strcmp(from_type, "-j") == 0 && atoi(value) >= 0) {
+            workers = atoi(value);
+            if (workers == 0)
+                workers = sysconf(_SC_NPROCESSORS_ONLN);
+        } else if (value != NULL && strcmp(from_type, "-t") == 0 && atof(value) > 0) {
+            timeout_ms = (long)(atof(value) * 1000);
+        } else if (value != NULL && strcmp(from_type, "-P") == 0 && atoi(value) > 0) {
+            pool = atoi(value);
+        } else if (value != NULL && strcmp(from_type, "-m") == 0 && atol(value) > 0) {
+            mem_mb = atol(value);
+        } else {
+            sf_cmd_error("Usage: conversion [-j <workers>] [-t <secs>] [-P <pool>] [-m <MB>] <from_type> <to_type> <cmd> [args...]");
+            return;
+        }
+        from_type = strtok(NULL, " \t");
+    }
+
     char *to_type = strtok(NULL, " \t");
     char *cmd = strtok(NULL, " \t");
 
     if (!from_type || !to_type || !cmd) {
-        sf_cmd_error("Usage: conversion <from_type> <to_type> <cmd> [args...]");
+        sf_cmd_error("Usage: conversion [-j <workers>] [-t <secs>] [-P <pool>] [-m <MB>] <from_type> <to_type> <cmd> [args...]");
         return;
     }
 
-    FILE_TYPE *from = find_type(from_type);
-    FILE_TYPE *to = find_type(to_type);
+    FILE_TYPE *from = graph_find_type(from_type);
+    FILE_TYPE *to = graph_find_type(to_type);
     if (!from || !to) {
         sf_cmd_error("One or both types not defined.");
         return;
@@ -115,40 +155,547 @@ void handle_conversion(char *line) {
     }
     cmd_and_args[i] = NULL;
 
-    if (define_conversion(from_type, to_type, cmd_and_args)) {
+    CONVERSION *conv = define_conversion(from_type, to_type, cmd_and_args);
+    if (conv) {
+        graph_add_conversion(conv);
+        struct conversion_attrs *attrs = define_conversion_attrs(from, to);
+        if (attrs != NULL) {
+            attrs->workers = workers > 1 ? workers : 1;
+            attrs->timeout_ms = timeout_ms;
+            attrs->pool = pool;
+            attrs->mem_mb = mem_mb;
+        }
         sf_cmd_ok();
     } else {
         sf_cmd_error("Failed to define conversion.");
     }
 }
 
+void handle_splitter(char *line) {
+    char *type_name = strtok(line + 9, " \t");
+    if (!type_name) {
+        sf_cmd_error("Usage: splitter <type> [<cmd> [args...]]");
+        return;
+    }
+
+    char *cmd_and_args[MAX_ARGS];
+    int i = 0;
+    char *arg;
+    while ((arg = strtok(NULL, " \t")) && i < MAX_ARGS - 1) {
+        cmd_and_args[i++] = arg;
+    }
+    cmd_and_args[i] = NULL;
+
+    if (define_splitter(type_name, i > 0 ? cmd_and_args : NULL) == 0) {
+        sf_cmd_ok();
+    } else {
+        sf_cmd_error("Failed to define splitter.");
+    }
+}
+
+void handle_retry(char *line) {
+    char *max_str = strtok(line + 6, " \t");
+    char *backoff_str = strtok(NULL, " \t");
+    char *mode = strtok(NULL, " \t");
+
+    if (!max_str || atoi(max_str) < 0 || (backoff_str && atol(backoff_str) <= 0) ||
+        (mode && strcmp(mode, "checkpoint") != 0 && strcmp(mode, "restart") != 0)) {
+        sf_cmd_error("Usage: retry <max> [<backoff_ms> [checkpoint|restart]]");
+        return;
+    }
+
+    set_retry_policy(atoi(max_str), backoff_str ? atol(backoff_str) : 500,
+                     mode && strcmp(mode, "checkpoint") == 0);
+    sf_cmd_ok();
+}
+
+void handle_preempt(char *line) {
+    char *gap_str = strtok(line + 8, " \t");
+    char *run_str = strtok(NULL, " \t");
+    char *max_str = strtok(NULL, " \t");
+
+    if (gap_str && strcmp(gap_str, "off") == 0 && !run_str) {
+        set_preempt_policy(0, 0, 0);
+        sf_cmd_ok();
+        return;
+    }
+    if (!gap_str || atoi(gap_str) <= 0 || (run_str && atof(run_str) < 0) ||
+        (max_str && atoi(max_str) <= 0)) {
+        sf_cmd_error("Usage: preempt off | preempt <min_gap> [<min_run_secs> [<max_per_job>]]");
+        return;
+    }
+
+    set_preempt_policy(atoi(gap_str), run_str ? (long)(atof(run_str) * 1000) : 2000,
+                       max_str ? atoi(max_str) : 1);
+    sf_cmd_ok();
+}
+
+#define CAPS_USAGE "Usage: caps <type> [-m <mem_MB>] [-c <cpu_percent>] | caps <type> off"
+
+void handle_caps(char *line) {
+    char *type_name = strtok(line + 5, " \t");
+    FILE_TYPE *type = type_name ? graph_find_type(type_name) : NULL;
+    if (!type_name) {
+        sf_cmd_error(CAPS_USAGE);
+        return;
+    }
+    if (!type) {
+        sf_cmd_error("Type not found.");
+        return;
+    }
+
+    long mem_mb;
+    int cpu_pct;
+    cgroup_get_caps(type, &mem_mb, &cpu_pct);
+    char *opt;
+    while ((opt = strtok(NULL, " \t")) != NULL) {
+        char *value = strcmp(opt, "off") == 0 ? NULL : strtok(NULL, " \t");
+        if (strcmp(opt, "off") == 0) {
+            mem_mb = 0;
+            cpu_pct = 0;
+        } else if (strcmp(opt, "-m") == 0 && value && atol(value) >= 0) {
+            mem_mb = atol(value);
+        } else if (strcmp(opt, "-c") == 0 && value && atoi(value) >= 0) {
+            cpu_pct = atoi(value);
+        } else {
+            sf_cmd_error(CAPS_USAGE);
+            return;
+        }
+    }
+
+    int enforced = cgroup_set_caps(type, mem_mb, cpu_pct);
+    printf("CAPS: type=%s", type->name);
+    if (mem_mb > 0)
+        printf(", mem=%ldMB%s", mem_mb, enforced & 1 ? "" : " (address space per process)");
+    if (cpu_pct > 0)
+        printf(", cpu=%d%%%s", cpu_pct, enforced & 2 ? "" : " (not enforced)");
+    if (mem_mb == 0 && cpu_pct == 0)
+        printf(", (none)");
+    printf("\n");
+    sf_cmd_ok();
+}
+
+void handle_progress(char *line) {
+    char *secs_str = strtok(line + 9, " \t");
+
+    if (secs_str && strcmp(secs_str, "off") == 0) {
+        set_progress_interval(0);
+        sf_cmd_ok();
+        return;
+    }
+    if (!secs_str || atof(secs_str) <= 0) {
+        sf_cmd_error("Usage: progress <secs> | progress off");
+        return;
+    }
+
+    set_progress_interval((long)(atof(secs_str) * 1000));
+    sf_cmd_ok();
+}
+
+void handle_retention(char *line) {
+    char *secs_str = strtok(line + 10, " \t");
+
+    if (!secs_str || atof(secs_str) < 0) {
+        sf_cmd_error("Usage: retention <secs>");
+        return;
+    }
+
+    set_job_retention((long)(atof(secs_str) * 1000));
+    sf_cmd_ok();
+}
+
+void handle_limits(char *line, FILE *out) {
+    char *procs_str = strtok(line + 6, " \t");
+    char *mem_str = strtok(NULL, " \t");
+
+    if (!procs_str) {
+        print_resource_usage(out);
+        sf_cmd_ok();
+        return;
+    }
+    if (atoi(procs_str) < 0 || (mem_str && atol(mem_str) < 0)) {
+        sf_cmd_error("Usage: limits [<procs> [<mem_MB>]]");
+        return;
+    }
+
+    set_resource_limits(atoi(procs_str), mem_str ? atol(mem_str) : 0);
+    dispatch_jobs();  // a raised limit may admit queued jobs
+    sf_cmd_ok();
+}
+
+static struct timer *top_timer;   // pending refresh of a live top
+static long top_interval_ms;
+
+static void top_refresh(int arg) {
+    (void)arg;
+    top_timer = timer_add(top_interval_ms, top_refresh, 0);
+    if (isatty(STDOUT_FILENO))
+        printf("\033[H\033[2J");
+    stats_report(stdout);
+    fflush(stdout);
+}
+
+/*
+ * top shows the statistics once; top <secs> shows them again every secs
+ * seconds, between commands, until top off.
+ */
+void handle_top(char *line, FILE *out) {
+    char *arg = strtok(line + 3, " \t");
+
+    if (arg != NULL && strcmp(arg, "off") == 0) {
+        timer_cancel(top_timer);
+        top_timer = NULL;
+        sf_cmd_ok();
+        return;
+    }
+    if (arg != NULL && atof(arg) <= 0) {
+        sf_cmd_error("Usage: top [<secs>|off]");
+        return;
+    }
+
+    stats_report(out);
+    if (arg != NULL) {
+        top_interval_ms = (long)(atof(arg) * 1000);
+        timer_cancel(top_timer);
+        top_timer = timer_add(top_interval_ms, top_refresh, 0);
+    }
+    sf_cmd_ok();
+}
+
+#define METRICS_USAGE "Usage: metrics [socket <path> | file <path> [<secs>] | off]"
+
+void handle_metrics(char *line, FILE *out) {
+    char *mode = strtok(line + 7, " \t");
+    char *path = strtok(NULL, " \t");
+    char *secs = strtok(NULL, " \t");
+
+    if (mode == NULL) {
+        stats_export(out);
+    } else if (strcmp(mode, "off") == 0 && path == NULL) {
+        metrics_stop();
+    } else if (strcmp(mode, "socket") == 0 && path != NULL && secs == NULL) {
+        if (metrics_serve(path) < 0) {
+            sf_cmd_error("Cannot serve metrics on that socket.");
+            return;
+        }
+    } else if (strcmp(mode, "file") == 0 && path != NULL && (secs == NULL || atof(secs) > 0)) {
+        if (metrics_write_file(path, secs ? (long)(atof(secs) * 1000) : 10000) < 0) {
+            sf_cmd_error("Cannot write metrics to that file.");
+            return;
+        }
+    } else {
+        sf_cmd_error(METRICS_USAGE);
+        return;
+    }
+    sf_cmd_ok();
+}
+
+#define TRACE_USAGE "Usage: trace start <file> | trace stop"
+
+void handle_trace(char *line) {
+    char *action = strtok(line + 5, " \t");
+    char *path = strtok(NULL, " \t");
+
+    if (action != NULL && strcmp(action, "start") == 0 && path != NULL) {
+        if (trace_start(path) < 0) {
+            sf_cmd_error("Cannot create the trace file.");
+            return;
+        }
+    } else if (action != NULL && strcmp(action, "stop") == 0 && path == NULL) {
+        if (!trace_active()) {
+            sf_cmd_error("No trace is being recorded.");
+            return;
+        }
+        trace_stop();
+    } else {
+        sf_cmd_error(TRACE_USAGE);
+        return;
+    }
+    sf_cmd_ok();
+}
+
+#define POLICY_USAGE "Usage: policy [-c <cpus>] [-n <nice>] [-i <class>[:<level>]] printer <name> | conversion <from_type> <to_type>"
+
+void handle_policy(char *line) {
+    char *target = strtok(line + 7, " \t");
+    struct sched_policy policy = { 0, 0, 0, 0 };
+
+    // Options precede the target and each takes exactly one value.
+    while (target != NULL && target[0] == '-') {
+        char *value = strtok(NULL, " \t");
+        if (value == NULL || parse_policy_option(&policy, target, value) < 0) {
+            sf_cmd_error(POLICY_USAGE);
+            return;
+        }
+        target = strtok(NULL, " \t");
+    }
+
+    char desc[256];
+    format_policy(&policy, desc, sizeof(desc));
+
+    if (target != NULL && strcmp(target, "printer") == 0) {
+        char *printer_name = strtok(NULL, " \t");
+        if (printer_name == NULL) {
+            sf_cmd_error(POLICY_USAGE);
+            return;
+        }
+        int i = find_printer(printer_name);
+        if (i < 0) {
+            sf_cmd_error("Printer not found.");
+            return;
+        }
+        *printer_policy(i) = policy;
+        printf("PRINTER: id=%d, name=%s, policy=%s\n", i, printers[i].name,
+               desc[0] ? desc : "(none)");
+        sf_cmd_ok();
+        return;
+    }
+
+    if (target != NULL && strcmp(target, "conversion") == 0) {
+        char *from_type = strtok(NULL, " \t");
+        char *to_type = strtok(NULL, " \t");
+        if (!from_type || !to_type) {
+            sf_cmd_error(POLICY_USAGE);
+            return;
+        }
+        FILE_TYPE *from = graph_find_type(from_type);
+        FILE_TYPE *to = graph_find_type(to_type);
+        struct conversion_attrs *attrs = from && to ? find_conversion_attrs(from, to) : NULL;
+        if (attrs == NULL) {
+            sf_cmd_error("Conversion not defined.");
+            return;
+        }
+        attrs->policy = policy;
+        printf("CONVERSION: from=%s, to=%s, policy=%s\n", from_type, to_type,
+               desc[0] ? desc : "(none)");
+        sf_cmd_ok();
+        return;
+    }
+
+    sf_cmd_error(POLICY_USAGE);
+}
+
+void handle_feeder(char *line) {
+    char *mode = strtok(line + 7, " \t");
+
+    if (!mode || (strcmp(mode, "uring") != 0 && strcmp(mode, "read") != 0)) {
+        sf_cmd_error("Usage: feeder uring|read");
+        return;
+    }
+
+    set_input_feeder(strcmp(mode, "uring") == 0);
+    sf_cmd_ok();
+}
+
+void handle_save(char *line) {
+    char *path = strtok(line + 5, " \t");
+
+    if (!path) {
+        sf_cmd_error("Usage: save <file>");
+        return;
+    }
+    if (save_snapshot(path) < 0) {
+        sf_cmd_error("Failed to save snapshot.");
+        return;
+    }
+    sf_cmd_ok();
+}
+
+void handle_load(char *line) {
+    char *path = strtok(line + 5, " \t");
+
+    if (!path) {
+        sf_cmd_error("Usage: load <file>");
+        return;
+    }
+    if (load_snapshot(path) < 0) {
+        sf_cmd_error("Failed to load snapshot.");
+        return;
+    }
+    sf_cmd_ok();
+    dispatch_jobs();
+}
+
+void handle_warm(char *line) {
+    char *printer_name = strtok(line + 5, " \t");
+    char *type_name = strtok(NULL, " \t");
+
+    if (!printer_name) {
+        sf_cmd_error("Usage: warm <printer> [<type>|off]");
+        return;
+    }
+
+    int i = find_printer(printer_name);
+    if (i < 0) {
+        sf_cmd_error("Printer not found.");
+        return;
+    }
+
+    if (type_name && strcmp(type_name, "off") == 0) {
+        warm_keep(i, 0);
+        sf_cmd_ok();
+        return;
+    }
+
+    FILE_TYPE *type = NULL;
+    if (type_name && (type = graph_find_type(type_name)) == NULL) {
+        sf_cmd_error("Unknown file type.");
+        return;
+    }
+    if (printers[i].status != PRINTER_IDLE) {
+        sf_cmd_error("Printer is not idle.");
+        return;
+    }
+    if (warm_printer(i, type) < 0) {
+        sf_cmd_error("No conversion path to the printer.");
+        return;
+    }
+    warm_keep(i, 1);
+    sf_cmd_ok();
+}
+
+#define FAULTS_USAGE "Usage: faults <printer> normal | [delays] [flaky]"
+
+/*
+ * Sets the faults a printer's daemon injects: random delays while printing,
+ * random disconnects, or neither.  They apply from the printer's next
+ * connection; a warm pipeline that is already connected keeps its own.
+ */
+void handle_faults(char *line) {
+    char *printer_name = strtok(line + 7, " \t");
+    char *flag = strtok(NULL, " \t");
+    if (printer_name == NULL || flag == NULL) {
+        sf_cmd_error(FAULTS_USAGE);
+        return;
+    }
+
+    int flags = PRINTER_NORMAL;
+    for (; flag != NULL; flag = strtok(NULL, " \t")) {
+        if (strcmp(flag, "delays") == 0) {
+            flags |= PRINTER_DELAYS;
+        } else if (strcmp(flag, "flaky") == 0) {
+            flags |= PRINTER_FLAKY;
+        } else if (strcmp(flag, "normal") != 0) {
+            sf_cmd_error(FAULTS_USAGE);
+            return;
+        }
+    }
+
+    int i = find_printer(printer_name);
+    if (i < 0) {
+        sf_cmd_error("Printer not found.");
+        return;
+    }
+    printers[i].connect_flags = flags;
+    sf_cmd_ok();
+}
+
+/*
+ * Disables a printer.  A job it is printing runs to completion, after which
+ * the printer stays disabled.
+ */
+void handle_disable(char *line) {
+    char *printer_name = line + 8;
+    while (isspace(*printer_name)) printer_name++;
+
+    int i = find_printer(printer_name);
+    if (i < 0) {
+        sf_cmd_error("Printer not found.");
+        return;
+    }
+    if (printers[i].status == PRINTER_DISABLED) {
+        sf_cmd_error("Printer already disabled.");
+        return;
+    }
+    printers[i].status = PRINTER_DISABLED;
+    warm_discard(i);   // a printer kept warm is warmed again once enabled
+    sf_printer_status(printers[i].name, PRINTER_DISABLED);
+    printf("PRINTER: id=%d, name=%s, type=%s, status=disabled\n",
+           i, printers[i].name, printers[i].type->name);
+    sf_cmd_ok();
+}
+
+void handle_remove(char *line) {
+    char *printer_name = line + 7;
+    while (isspace(*printer_name)) printer_name++;
+
+    int i = find_printer(printer_name);
+    if (i < 0) {
+        sf_cmd_error("Printer not found.");
+        return;
+    }
+    if (remove_printer(i) < 0) {
+        sf_cmd_error("Printer is printing a job.");
+        return;
+    }
+    printf("PRINTER: id=%d, name=%s, removed\n", i, printer_name);
+    sf_cmd_ok();
+}
+
 void handle_enable(char *line) {
     char *printer_name = line + 7;
     while (isspace(*printer_name)) printer_name++;
 
-    for (int i = 0; i < num_printers; i++) {
-        if (strcmp(printers[i].name, printer_name) == 0) {
-            if (printers[i].status == PRINTER_DISABLED) {
-                printers[i].status = PRINTER_IDLE;
-                sf_printer_status(printers[i].name, PRINTER_IDLE);
+    int i = find_printer(printer_name);
+    if (i >= 0) {
+        if (printers[i].status == PRINTER_DISABLED) {
+            // A printer disabled while printing goes back to its job.
+            int busy = printers[i].current_pid != 0;
+            printers[i].status = busy ? PRINTER_BUSY : PRINTER_IDLE;
+            sf_printer_status(printers[i].name, printers[i].status);
 
-                fprintf(stdout, "PRINTER: id=%d, name=%s, type=%s, status=idle\n",
-                        i, printers[i].name, printers[i].type->name);
-                sf_cmd_ok();
-                dispatch_jobs();
-            } else {
-                sf_cmd_error("Printer already enabled.");
-            }
-            return;
+            fprintf(stdout, "PRINTER: id=%d, name=%s, type=%s, status=%s\n",
+                    i, printers[i].name, printers[i].type->name, busy ? "busy" : "idle");
+            sf_cmd_ok();
+            dispatch_jobs();
+        } else {
+            sf_cmd_error("Printer already enabled.");
         }
+        return;
     }
 
     sf_cmd_error("Printer not found.");
 }
 
+static int parse_print_option(struct print_options *options, char *option, char *value) {
+    if (value == NULL)
+        return -1;
+    if (strcmp(option, "-c") == 0 && atoi(value) > 0)
+        options->chunks = atoi(value);
+    else if (strcmp(option, "-t") == 0 && atof(value) > 0)
+        options->timeout_ms = (long)(atof(value) * 1000);
+    else if (strcmp(option, "-k") == 0 && atof(value) >= 0)
+        options->retention_ms = (long)(atof(value) * 1000);
+    else if (strcmp(option, "-n") == 0 && atoi(value) > 0)
+        options->copies = atoi(value);
+    else if (strcmp(option, "-p") == 0)
+        options->priority = atoi(value);
+    else if (strcmp(option, "-m") == 0 && (strcmp(value, "all") == 0 || strcmp(value, "any") == 0))
+        options->fanout = strcmp(value, "all") == 0;
+    else if (strcmp(option, "-g") == 0 && atoi(value) >= 0)
+        options->global_id = atoi(value);   // set by the coordinator of a shard
+    else
+        return -1;
+    return 0;
+}
+
 void handle_print(char *line) {
     char *args = line + 6;
     char *file = strtok(args, " \t");
+    struct print_options options = { 1, 0, -1, 1, 0, 0, -1 };
+
+    // Options precede the file name and each takes exactly one value.
+    while (file != NULL && file[0] == '-') {
+        if (parse_print_option(&options, file, strtok(NULL, " \t")) < 0) {
+            sf_cmd_error("print");
+            return;
+        }
+        file = strtok(NULL, " \t");
+    }
+    if (options.chunks > 1 && (options.copies > 1 || options.fanout)) {
+        sf_cmd_error("Chunks cannot be combined with copies or fan-out.");
+        return;
+    }
 
     if (file == NULL) {
         sf_cmd_error("Missing file name.");
@@ -174,23 +721,31 @@ void handle_print(char *line) {
     char *printer_name = strtok(NULL, " \t");
 
     if (printer_name == NULL) {
+    if (options.fanout) {
+        sf_cmd_error("Fan-out needs the printers named.");
+        return;
+    }
     eligibility_mask = 0xFFFFFFFF; // Eligible for all printers by default
 }
  else {
+        // Fan-out converts the file once, so its printers must share a type.
+        FILE_TYPE *fanout_type = NULL;
         do {
-            int found = 0;
-            for (int i = 0; i < num_printers; i++) {
-                if (strcmp(printers[i].name, printer_name) == 0) {
-                    CONVERSION **path = find_conversion_path(ftype->name, printers[i].type->name);
-                    if (path) {
-                        eligibility_mask |= (1U << i);
-                        free(path);
+            int i = find_printer(printer_name);
+            if (i >= 0) {
+                CONVERSION **path = find_route(ftype, printers[i].type);
+                if (path) {
+                    eligibility_mask |= (1U << i);
+                    free(path);
+                }
+                if (options.fanout) {
+                    if (path == NULL || (fanout_type != NULL && printers[i].type != fanout_type)) {
+                        sf_cmd_error("Fan-out printers must take the file and share a type.");
+                        return;
                     }
-                    found = 1;
-                    break;
+                    fanout_type = printers[i].type;
                 }
-            }
-            if (!found) {
+            } else {
                 sf_cmd_error("Invalid printer name.");
                 sf_cmd_ok();
                 return;
@@ -198,51 +753,196 @@ void handle_print(char *line) {
         } while ((printer_name = strtok(NULL, " \t")) != NULL);
     }
 
-    int job_id = next_job_id++;
-    jobs[num_jobs].id = job_id;
-    jobs[num_jobs].file = strdup(file);
-    jobs[num_jobs].type = ftype;
-    jobs[num_jobs].status = JOB_CREATED;
-    jobs[num_jobs].eligible = eligibility_mask;
-    jobs[num_jobs].pgid = -1;
-    jobs[num_jobs].status_changed_at = time(NULL);
-    num_jobs++;
-
-    sf_job_created(job_id, file, ftype->name);
-
-    char created_str[64], status_str[64];
-    format_time(jobs[job_id].status_changed_at, created_str, sizeof(created_str));
-    format_time(jobs[job_id].status_changed_at, status_str, sizeof(status_str));
-    printf("JOB[%d]: type=%s, creation(%s), status(%s)=%s, eligible=%08x, file=%s\n",
-           job_id,
-           ftype->name,
-           created_str,
-           status_str,
-           job_status_names[JOB_CREATED],
-           eligibility_mask,
-           file);
+    struct job *job = create_job(file, ftype, eligibility_mask);
+    if (job == NULL) {
+        sf_cmd_error("Out of memory.");
+        sf_cmd_ok();
+        return;
+    }
+    job->timeout_ms = options.timeout_ms;
+    job->retention_ms = options.retention_ms;
+    job->copies = options.copies;
+    job_sched[job_index(job)].priority = options.priority;
+    job->global_id = options.global_id;
+    if (options.fanout)
+        job_sched[job_index(job)].fanout = eligibility_mask;
+
+    if (options.chunks > 1)
+        split_job(job, options.chunks);
 
     //sf_cmd_ok();
     dispatch_jobs();
 }
 
+/* State of a bulk command while its arguments are expanded. */
+struct bulk_state {
+    int printers[MAX_PRINTERS];   // printers named after "--"
+    int num_printers;             // 0: all printers are eligible
+    struct {
+        FILE_TYPE *type;
+        unsigned int eligible;
+    } *masks;                     // eligibility, worked out once per type
+    int num_masks;
+    struct print_options options;
+    int created, backlogged, rejected;
+};
+
+static void bulk_file(char *file, void *ctx) {
+    struct bulk_state *b = ctx;
+    FILE_TYPE *ftype = infer_file_type(file);
+    if (ftype == NULL) {
+        fprintf(stderr, "bulk: %s: unknown file type\n", file);
+        b->rejected++;
+        return;
+    }
+
+    unsigned int eligible = 0xFFFFFFFF;
+    if (b->num_printers > 0) {
+        int m = 0;
+        while (m < b->num_masks && b->masks[m].type != ftype)
+            m++;
+        if (m == b->num_masks) {
+            void *grown = realloc(b->masks, (m + 1) * sizeof(*b->masks));
+            if (grown == NULL) {
+                b->rejected++;
+                return;
+            }
+            b->masks = grown;
+            b->masks[m].type = ftype;
+            b->masks[m].eligible = 0;
+            for (int i = 0; i < b->num_printers; i++) {
+                CONVERSION **path = find_route(ftype, printers[b->printers[i]].type);
+                if (path) {
+                    b->masks[m].eligible |= 1U << b->printers[i];
+                    free(path);
+                }
+            }
+            b->num_masks++;
+        }
+        eligible = b->masks[m].eligible;
+    }
+
+    int queued = bulk_submit(file, ftype, eligible, &b->options);
+    if (queued > 0) b->created++;
+    else if (queued == 0) b->backlogged++;
+    else b->rejected++;
+}
+
+void handle_bulk(char *line) {
+    char *arg = strtok(line + 5, " \t");
+    struct bulk_state b;
+    memset(&b, 0, sizeof(b));
+    b.options = (struct print_options){ 1, 0, -1, 1, 0, 0, -1 };
+
+    // Options precede the files and each takes exactly one value.
+    while (arg != NULL && arg[0] == '-' && strcmp(arg, "--") != 0) {
+        // Fan-out is for one file at a time, with print.
+        if (parse_print_option(&b.options, arg, strtok(NULL, " \t")) < 0 || b.options.fanout) {
+            sf_cmd_error("Usage: bulk [-c <n>] [-n <copies>] [-t <secs>] [-k <secs>] <file|pattern|@list>... [-- <printer>...]");
+            return;
+        }
+        arg = strtok(NULL, " \t");
+    }
+    if (b.options.chunks > 1 && b.options.copies > 1) {
+        sf_cmd_error("Chunks cannot be combined with copies or fan-out.");
+        return;
+    }
+
+    char *files[MAX_ARGS];
+    int num_files = 0;
+    for (; arg != NULL && strcmp(arg, "--") != 0; arg = strtok(NULL, " \t")) {
+        if (num_files == MAX_ARGS) {
+            sf_cmd_error("Too many arguments; use an @list file.");
+            return;
+        }
+        files[num_files++] = arg;
+    }
+    if (num_files == 0) {
+        sf_cmd_error("Usage: bulk [-c <n>] [-n <copies>] [-t <secs>] [-k <secs>] <file|pattern|@list>... [-- <printer>...]");
+        return;
+    }
+
+    char *printer_name;
+    while ((printer_name = strtok(NULL, " \t")) != NULL) {
+        int found = find_printer(printer_name);
+        if (found < 0) {
+            sf_cmd_error("Invalid printer name.");
+            return;
+        }
+        int listed = 0;
+        for (int i = 0; i < b.num_printers; i++)
+            listed |= b.printers[i] == found;
+        if (!listed)
+            b.printers[b.num_printers++] = found;
+    }
+
+    for (int i = 0; i < num_files; i++) {
+        if (bulk_expand(files[i], bulk_file, &b) < 0) {
+            fprintf(stderr, "bulk: %s: no such files\n", files[i]);
+            b.rejected++;
+        }
+    }
+    free(b.masks);
+
+    printf("BULK: created=%d, backlog=%d, rejected=%d\n", b.created, b.backlogged, b.rejected);
+    sf_cmd_ok();
+    dispatch_jobs();
+}
+
 void handle_jobs(FILE *out) {
+    long long est_ms[MAX_JOBS];
+    expected_jobs_ms(est_ms);
     for (int i = 0; i < num_jobs; i++) {
-        if (jobs[i].status != JOB_DELETED) {
+        if (job_status[i] != JOB_DELETED) {
             char created_str[64], status_str[64];
             format_time(jobs[i].status_changed_at, status_str, sizeof(status_str));
             format_time(jobs[i].status_changed_at, created_str, sizeof(created_str));
 
-            fprintf(out, "JOB[%d]: type=%s, creation(%s), status(%s)=%s, eligible=%08x, file=%s\n",
-                jobs[i].id,
+            // A shard lists its jobs under the ids the coordinator gave out.
+            fprintf(out, "JOB[%d]: type=%s, creation(%s), status(%s)=%s, eligible=%08x, file=%s",
+                jobs[i].global_id >= 0 ? jobs[i].global_id : jobs[i].id,
                 jobs[i].type ? jobs[i].type->name : "(null)",
                 created_str,
                 status_str,
-                job_status_names[jobs[i].status],
-                jobs[i].eligible,
+                job_status_names[job_status[i]],
+                job_eligible[i],
                 jobs[i].file ? jobs[i].file : "(null)");
+            if (jobs[i].global_id >= 0 && jobs[i].parent >= 0)
+                fprintf(out, ", chunk of=%d", jobs[i].global_id);
+            if (jobs[i].retries > 0)
+                fprintf(out, ", retries=%d", jobs[i].retries);
+            if (job_sched[i].priority != 0)
+                fprintf(out, ", priority=%d", job_sched[i].priority);
+            if (jobs[i].preemptions > 0)
+                fprintf(out, ", preempted=%d", jobs[i].preemptions);
+            long long cpu_us = jobs[i].cpu_us;
+            long mem_kb = jobs[i].mem_kb;
+            long long live_cpu_us;
+            long live_mem_kb;
+            if ((job_status[i] == JOB_RUNNING || job_status[i] == JOB_PAUSED) &&
+                cgroup_job_usage(&jobs[i], &live_cpu_us, &live_mem_kb) == 0) {
+                cpu_us = (cpu_us > 0 ? cpu_us : 0) + live_cpu_us;
+                if (live_mem_kb > mem_kb)
+                    mem_kb = live_mem_kb;
+            }
+            if (cpu_us >= 0)
+                fprintf(out, ", cpu=%.2fs", cpu_us / 1e6);
+            if (mem_kb >= 0)
+                fprintf(out, ", mem=%.1fMB", mem_kb / 1024.0);
+            if (est_ms[i] >= 0)
+                fprintf(out, ", est=%.1fs", est_ms[i] / 1000.0);
+            if ((job_status[i] == JOB_RUNNING || job_status[i] == JOB_PAUSED) &&
+                jobs[i].progress != NULL) {
+                long long consumed, delivered;
+                long long eta = job_progress_eta(&jobs[i], &consumed, &delivered);
+                fprintf(out, ", delivered=%lld, consumed=%lld/%lld", delivered, consumed,
+                        (long long)job_input_bytes(&jobs[i]));
+                if (eta >= 0)
+                    fprintf(out, ", eta=%.1fs", eta / 1000.0);
+            }
+            fprintf(out, "\n");
 
-            sf_job_status(jobs[i].id, jobs[i].status);
+            sf_job_status(jobs[i].id, job_status[i]);
         }
     }
     sf_cmd_ok();
@@ -262,24 +962,26 @@ void handle_pause(char *line) {
         return;
     }
 
-    int job_id = atoi(job_id_str);
+    struct job *job = find_job(atoi(job_id_str));
     //printf("[DEBUG] Parsed job_id = %d\n", job_id);
 
-    if (job_id < 0 || job_id >= num_jobs) {
+    if (job == NULL) {
         //printf("[DEBUG] Invalid job ID: %d\n", job_id);
         sf_cmd_error("Invalid job ID.");
         return;
     }
+    // Deletions shift the job table, so the id is not an index.
+    int j = job_index(job);
 
-    printf("[DEBUG] Current job status = %d\n", jobs[job_id].status);
+    printf("[DEBUG] Current job status = %d\n", job_status[j]);
 
-    if (jobs[job_id].status == JOB_PAUSED) {
+    if (job_status[j] == JOB_PAUSED) {
         //printf("[DEBUG] Job already paused, returning OK\n");
         sf_cmd_ok();
         return;
     }
 
-    if (jobs[job_id].status != JOB_RUNNING) {
+    if (job_status[j] != JOB_RUNNING) {
         //printf("[DEBUG] Job not running, cannot pause\n");
         sf_cmd_error("pause");
         return;
@@ -292,27 +994,27 @@ void handle_pause(char *line) {
     sigprocmask(SIG_BLOCK, &mask, &oldmask);
 
     got_sigchld = 0;
-    //printf("[DEBUG] Sending SIGSTOP to pgid: %d\n", jobs[job_id].pgid);
-    //int result = kill(jobs[job_id].pgid, SIGSTOP);
+    //printf("[DEBUG] Sending SIGSTOP to pgid: %d\n", job_pgid[j]);
+    //int result = kill(job_pgid[j], SIGSTOP);
     //printf("[DEBUG] kill() returned %d\n", result);
 
     // Instead of blocking indefinitely with sigsuspend, use a loop with a 1ms sleep.
     // Also, call reap_finished_jobs() in each iteration to process any pending SIGCHLD.
     int wait_loops = 0;
-    while (jobs[job_id].status == JOB_RUNNING && wait_loops < 1000) {
+    while (job_status[j] == JOB_RUNNING && wait_loops < 1000) {
         usleep(1000);  // wait for 1ms
         reap_finished_jobs();  // process any pending SIGCHLD
         wait_loops++;
     }
 
     sigprocmask(SIG_SETMASK, &oldmask, NULL);
-    //printf("[DEBUG] Exited wait loop. job status = %d\n", jobs[job_id].status);
+    //printf("[DEBUG] Exited wait loop. job status = %d\n", job_status[j]);
 
-    if (jobs[job_id].status == JOB_PAUSED) {
+    if (job_status[j] == JOB_PAUSED) {
         printf("[DEBUG] Pause succeeded, returning OK\n");
         sf_cmd_ok();
     } else {
-        printf("[DEBUG] Pause failed: job status still = %d\n", jobs[job_id].status);
+        printf("[DEBUG] Pause failed: job status still = %d\n", job_status[j]);
         sf_cmd_error("pause: job didn't pause");
     }
 }
@@ -330,23 +1032,34 @@ void handle_resume(char *line) {
         return;
     }
 
-    int job_id = atoi(job_id_str);
-    if (job_id < 0 || job_id >= num_jobs) {
+    struct job *job = find_job(atoi(job_id_str));
+    if (job == NULL) {
         sf_cmd_error("Invalid job ID.");
         return;
     }
+    int j = job_index(job);   // deletions shift the table, so not the id
 
-    printf("[DEBUG] resume requested for job_id=%d, current status=%d\n", job_id, jobs[job_id].status);
+    printf("[DEBUG] resume requested for job_id=%d, current status=%d\n", job->id, job_status[j]);
 
     // If not paused, silently succeed
-    if (jobs[job_id].status != JOB_PAUSED) {
+    if (job_status[j] != JOB_PAUSED) {
         sf_cmd_ok();
         return;
     }
 
-    printf("[DEBUG] Sending SIGCONT to pgid: %d (job_id=%d)\n", jobs[job_id].pgid, job_id);
+    // A preempted job must not reconnect while the urgent job holds its
+    // printer; the dispatcher continues it once the printer is free.
+    if (job->preempted_on >= 0) {
+        printf("JOB[%d]: preempted, resumes once printer=%s is free\n", job->id,
+               printers[job->preempted_on].name);
+        dispatch_jobs();
+        sf_cmd_ok();
+        return;
+    }
+
+    printf("[DEBUG] Sending SIGCONT to pgid: %d (job_id=%d)\n", job_pgid[j], job->id);
     got_sigchld = 0;
-    kill(jobs[job_id].pgid, SIGCONT);
+    kill(job_pgid[j], SIGCONT);
 
     sigset_t mask, oldmask;
     sigemptyset(&mask);
@@ -359,7 +1072,7 @@ void handle_resume(char *line) {
 
     sigprocmask(SIG_SETMASK, &oldmask, NULL);
 
-    if (jobs[job_id].status == JOB_RUNNING) {
+    if (job_status[j] == JOB_RUNNING) {
         sf_cmd_ok();
     } else {
         sf_cmd_error("resume: job didn't resume");
@@ -379,20 +1092,32 @@ void handle_cancel(char *line) {
         return;
     }
 
-    int job_id = atoi(job_id_str);
-    if (job_id >= 0 && job_id < num_jobs) {
-        if (jobs[job_id].status != JOB_ABORTED &&
-            jobs[job_id].status != JOB_FINISHED &&
-            jobs[job_id].status != JOB_DELETED) {
-
-            if (jobs[job_id].pgid > 0) {
-                kill(-jobs[job_id].pgid, SIGTERM);
+    // Deletions shift the job table, so the id is looked up, not used as an index.
+    struct job *job = find_job(atoi(job_id_str));
+    if (job != NULL) {
+        int j = job_index(job);
+        if (job_status[j] != JOB_ABORTED &&
+            job_status[j] != JOB_FINISHED &&
+            job_status[j] != JOB_DELETED) {
+
+            if (job_pgid[j] > 0) {
+                kill(-job_pgid[j], SIGTERM);
+                kill(-job_pgid[j], SIGCONT);   // a preempted job is stopped
+            }
+            timer_cancel(job_sched[j].retry_timer);
+            job_sched[j].retry_timer = NULL;
+            if (job_sched[j].chunks_left > 0) {
+                split_cancel(job);
+            } else if (job->parent >= 0 && job_pgid[j] <= 0) {
+                set_job_status(j, JOB_ABORTED);
+                split_chunk_done(job);
             }
 
-            jobs[job_id].status = JOB_ABORTED;
-            jobs[job_id].status_changed_at = time(NULL);
-            sf_job_status(jobs[job_id].id, JOB_ABORTED);
-            sf_job_aborted(jobs[job_id].id, 0);
+            set_job_status(j, JOB_ABORTED);
+            job->status_changed_at = time(NULL);
+            sf_job_status(job->id, JOB_ABORTED);
+            sf_job_aborted(job->id, 0);
+            schedule_job_deletion(job);
             sf_cmd_ok();
         } else {
             sf_cmd_error("Job is already completed or aborted.");
@@ -407,9 +1132,28 @@ void handle_user_command(char *line, FILE *out) {
     else if (strncmp(line, "type ", 5) == 0) handle_type(line);
     else if (strncmp(line, "printer ", 8) == 0) handle_printer(line);
     else if (strncmp(line, "conversion ", 11) == 0) handle_conversion(line);
+    else if (strncmp(line, "splitter ", 9) == 0) handle_splitter(line);
+    else if (strncmp(line, "retry ", 6) == 0) handle_retry(line);
+    else if (strncmp(line, "preempt ", 8) == 0) handle_preempt(line);
+    else if (strncmp(line, "caps ", 5) == 0) handle_caps(line);
+    else if (strncmp(line, "progress ", 9) == 0) handle_progress(line);
+    else if (strncmp(line, "retention ", 10) == 0) handle_retention(line);
     else if (strncmp(line, "enable ", 7) == 0) handle_enable(line);
+    else if (strncmp(line, "disable ", 8) == 0) handle_disable(line);
+    else if (strncmp(line, "remove ", 7) == 0) handle_remove(line);
+    else if (strncmp(line, "warm ", 5) == 0) handle_warm(line);
+    else if (strncmp(line, "faults ", 7) == 0) handle_faults(line);
+    else if (strncmp(line, "policy ", 7) == 0) handle_policy(line);
+    else if (strncmp(line, "feeder ", 7) == 0) handle_feeder(line);
+    else if (strncmp(line, "save ", 5) == 0) handle_save(line);
+    else if (strncmp(line, "load ", 5) == 0) handle_load(line);
+    else if (strncmp(line, "limits", 6) == 0 && (line[6] == '\0' || isspace(line[6]))) handle_limits(line, out);
     else if (strncmp(line, "print ", 6) == 0) handle_print(line);
+    else if (strncmp(line, "bulk ", 5) == 0) handle_bulk(line);
     else if (strcmp(line, "jobs") == 0) handle_jobs(out);
+    else if (strncmp(line, "metrics", 7) == 0 && (line[7] == '\0' || isspace(line[7]))) handle_metrics(line, out);
+    else if (strncmp(line, "trace", 5) == 0 && (line[5] == '\0' || isspace(line[5]))) handle_trace(line);
+    else if (strncmp(line, "top", 3) == 0 && (line[3] == '\0' || isspace(line[3]))) handle_top(line, out);
     else if (strncmp(line, "pause ", 6) == 0) handle_pause(line);
     else if (strcmp(line, "printers") == 0) handle_printers(out);
     else if (strncmp(line, "resume", 6) == 0 && isspace(line[6])) handle_resume(line);
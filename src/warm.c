@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include "warm.h"
+#include "pipeline.h"
+#include "policy.h"
+#include "globals.h"
+#include "presi.h"
+#include "conversions.h"
+#include "graph.h"
+#include "cgroup.h"
+
+#define WARM_HISTORY 8   // input types remembered per printer
+
+struct warm {
+    pid_t pid;                       // master waiting for an order, 0 if none
+    int order_fd;                    // write end of its order pipe
+    FILE_TYPE *type;                 // input type its stages convert from
+    struct job_progress *progress;   // handed to the job that takes it over
+    int keep;                        // re-warm whenever the printer is idle
+    struct {
+        FILE_TYPE *type;
+        int count;
+    } history[WARM_HISTORY];
+};
+
+static struct warm warm[MAX_PRINTERS];
+
+void warm_discard(int p) {
+    struct warm *w = &warm[p];
+    if (w->pid <= 0)
+        return;
+    // Without an order the master tears its pipeline down and exits.
+    close(w->order_fd);
+    job_progress_free(w->progress);
+    w->pid = 0;
+    w->progress = NULL;
+}
+
+void warm_forget_printer(int p) {
+    warm_discard(p);
+    memset(&warm[p], 0, sizeof(warm[p]));
+}
+
+static FILE_TYPE *most_printed(int p) {
+    FILE_TYPE *best = printers[p].type;
+    int best_count = 0;
+    for (int i = 0; i < WARM_HISTORY; i++) {
+        if (warm[p].history[i].count > best_count) {
+            best = warm[p].history[i].type;
+            best_count = warm[p].history[i].count;
+        }
+    }
+    return best;
+}
+
+void warm_close_inherited(void) {
+    for (int p = 0; p < num_printers; p++) {
+        if (warm[p].pid > 0)
+            close(warm[p].order_fd);
+    }
+}
+
+int warm_printer(int p, FILE_TYPE *type) {
+    warm_discard(p);
+    if (type == NULL)
+        type = most_printed(p);
+
+    CONVERSION **path = find_route(type, printers[p].type);
+    if (path == NULL)
+        return -1;
+
+    struct job_progress *progress = job_progress_alloc();
+    int order[2];
+    if (progress == NULL || pipe(order) < 0) {
+        job_progress_free(progress);
+        free(path);
+        return -1;
+    }
+    fcntl(order[1], F_SETFD, FD_CLOEXEC);
+
+    cgroup_available();
+    fflush(stdout);  // the master must not inherit buffered output
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(order[0]);
+        close(order[1]);
+        job_progress_free(progress);
+        free(path);
+        return -1;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+        close(order[1]);
+        warm_close_inherited();
+        cgroup_warm_enter();
+        run_warm_pipeline(type->name, path, printers[p].name, printers[p].type->name,
+                          printers[p].connect_flags, order[0], progress, printer_policy(p));
+    }
+
+    close(order[0]);
+    setpgid(pid, pid);
+    warm[p].pid = pid;
+    warm[p].order_fd = order[1];
+    warm[p].type = type;
+    warm[p].progress = progress;
+    free(path);
+
+    printf("PRINTER: id=%d, name=%s, warm for type=%s, pid=%d\n",
+           p, printers[p].name, type->name, pid);
+    return 0;
+}
+
+void warm_keep(int p, int on) {
+    warm[p].keep = on;
+    if (!on)
+        warm_discard(p);
+}
+
+int warm_kept(int p) {
+    return warm[p].keep;
+}
+
+pid_t warm_take(int p, struct job *job) {
+    struct warm *w = &warm[p];
+    if (w->pid <= 0)
+        return 0;
+    // Output before the checkpoint counts as delivered, even if the
+    // connection fails again before the master gets past it.
+    if (w->progress != NULL)
+        w->progress->delivered = job->checkpoint;
+    // A pipeline warmed for another type still saves the connection set-up.
+    if (send_pipeline_order(w->order_fd, job) < 0) {
+        warm_discard(p);
+        return 0;
+    }
+
+    pid_t pid = w->pid;
+    close(w->order_fd);
+    job_progress_free(job->progress);
+    job->progress = w->progress;
+    w->pid = 0;
+    w->progress = NULL;
+    return pid;
+}
+
+void warm_note(int p, FILE_TYPE *type) {
+    int slot = 0;
+    for (int i = 0; i < WARM_HISTORY; i++) {
+        if (warm[p].history[i].type == type) {
+            warm[p].history[i].count++;
+            return;
+        }
+        if (warm[p].history[i].count < warm[p].history[slot].count)
+            slot = i;
+    }
+    // Replace the least printed type.
+    warm[p].history[slot].type = type;
+    warm[p].history[slot].count = 1;
+}
+
+void warm_idle_printers(void) {
+    for (int p = 0; p < num_printers; p++) {
+        if (warm[p].keep && warm[p].pid <= 0 && printers[p].status == PRINTER_IDLE)
+            warm_printer(p, NULL);
+    }
+}
+
+int warm_reaped(pid_t pid) {
+    for (int p = 0; p < num_printers; p++) {
+        if (warm[p].pid == pid) {
+            // Died before it was used, e.g. the printer could not be reached.
+            close(warm[p].order_fd);
+            job_progress_free(warm[p].progress);
+            warm[p].pid = 0;
+            warm[p].progress = NULL;
+            warm[p].keep = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,206 @@
+#!/bin/bash
+#
+# Runs presi under a long randomized workload (prints, cancels, pauses,
+# resumes, printer disables and enables) with faults injected by the printer
+# daemons, then drains the queue and reports throughput, jobs that never
+# completed, job commands that hit the wrong job, and processes or
+# descriptors left behind.
+#
+# Usage: util/stress.sh [-t secs] [-r ops] [-p printers] [-f faults] [-s seed] [-w drain_secs]
+#
+#   -t  length of the workload, in seconds (default 60)
+#   -r  commands per second in the workload, 60% of them prints (default 2)
+#   -p  number of printers (default 4)
+#   -f  faults injected on every printer: "normal", "delays", "flaky" or
+#       "delays flaky" (default "delays flaky")
+#   -s  seed of the workload (default: random)
+#   -w  longest wait for the queue to drain, in seconds (default 300)
+#
+# The printer daemons take several seconds per job, so a busy workload soon
+# fills the job table; prints it rejects are reported, not counted as stuck.
+# Run from the top of the tree after make.  Exits with status 1 if any job was
+# stuck, a job command hit the wrong job, or anything leaked.
+
+DURATION=60
+RATE=2
+NUM_PRINTERS=4
+FAULTS="delays flaky"
+SEED=$$
+DRAIN=300
+
+while getopts "t:r:p:f:s:w:" opt; do
+  case $opt in
+    t) DURATION=$OPTARG ;;
+    r) RATE=$OPTARG ;;
+    p) NUM_PRINTERS=$OPTARG ;;
+    f) FAULTS=$OPTARG ;;
+    s) SEED=$OPTARG ;;
+    w) DRAIN=$OPTARG ;;
+    *) sed -n '8,20p' "$0" >&2; exit 2 ;;
+  esac
+done
+RANDOM=$SEED
+
+PRESI=bin/presi
+if [ ! -x $PRESI ]; then
+  echo "$PRESI not found; run make first" >&2
+  exit 2
+fi
+
+WORK=$(mktemp -d /tmp/presi_stress.XXXXXX)
+trap 'exec 3>&-; kill $PRESI_PID 2>/dev/null; rm -rf $WORK' EXIT
+
+# Input files of assorted sizes, half of them needing a conversion.
+for i in $(seq 0 15); do
+  head -c $(( (RANDOM % 64 + 1) * 1024 )) /dev/urandom | base64 > $WORK/f$i.ps
+  head -c $(( (RANDOM % 64 + 1) * 1024 )) /dev/urandom | base64 > $WORK/f$i.txt
+done
+
+mkfifo $WORK/cmd
+$PRESI -q < $WORK/cmd > $WORK/out 2>&1 &
+PRESI_PID=$!
+exec 3> $WORK/cmd
+
+send() {
+  echo "$*" >&3
+}
+
+# Latest value of a metric in the output.
+metric() {
+  grep "^$1 " $WORK/out | tail -1 | awk '{ print $2 }'
+}
+
+# Processes descended from presi, other than printer daemons.
+descendants() {
+  local daemons=" $(cat spool/*.pid 2>/dev/null | tr '\n' ' ') "
+  local pids=$(pgrep -P $1)
+  for pid in $pids; do
+    case "$daemons" in *" $pid "*) continue ;; esac
+    echo $pid
+    descendants $pid
+  done
+}
+
+send "type ps"
+send "type txt"
+send "conversion txt ps tr a-z A-Z"
+send "retention 1"
+for p in $(seq 1 $NUM_PRINTERS); do
+  send "printer p$p ps"
+  send "faults p$p $FAULTS"
+done
+sleep 1
+FDS_BEFORE=$(ls /proc/$PRESI_PID/fd | wc -l)
+for p in $(seq 1 $NUM_PRINTERS); do
+  send "enable p$p"
+done
+
+submitted=0 cancels=0 pauses=0 resumes=0 disables=0
+START=$(date +%s)
+END=$((START + DURATION))
+while [ $(date +%s) -lt $END ]; do
+  r=$((RANDOM % 100))
+  job=$((submitted > 0 ? RANDOM % submitted : 0))
+  printer=p$((RANDOM % NUM_PRINTERS + 1))
+  if [ $r -lt 60 ]; then
+    ext=$([ $((RANDOM % 2)) -eq 0 ] && echo ps || echo txt)
+    send "print $WORK/f$((RANDOM % 16)).$ext"
+    submitted=$((submitted + 1))
+  elif [ $r -lt 70 ]; then
+    send "cancel $job"; cancels=$((cancels + 1))
+  elif [ $r -lt 80 ]; then
+    send "pause $job"; pauses=$((pauses + 1))
+  elif [ $r -lt 90 ]; then
+    send "resume $job"; resumes=$((resumes + 1))
+  elif [ $r -lt 95 ]; then
+    send "disable $printer"; disables=$((disables + 1))
+  else
+    send "enable $printer"
+  fi
+  # Random pauses averaging 1/RATE seconds.
+  sleep $(awk "BEGIN { print 2 * $((RANDOM % 1000)) / 1000 / $RATE }")
+done
+
+# Drain: every printer enabled, every paused job resumed, nothing kept warm.
+for p in $(seq 1 $NUM_PRINTERS); do
+  send "enable p$p"
+  send "warm p$p off"
+done
+for j in $(seq 0 $((submitted - 1))); do
+  send "resume $j"
+done
+stuck=-1
+DEADLINE=$(( $(date +%s) + DRAIN ))
+while [ $(date +%s) -lt $DEADLINE ]; do
+  send "metrics"
+  sleep 1
+  stuck=$(grep -E '^presi_jobs\{status="(queued|running|paused)"\}' $WORK/out | tail -3 |
+          awk '{ n += $2 } END { print n + 0 }')
+  [ "$stuck" -eq 0 ] && break
+done
+ELAPSED=$(( $(date +%s) - START ))
+
+# Job commands take job ids, which stop matching slots in the job table once
+# a job has been deleted: cancel a job after an earlier one has expired, and
+# a split job while its splitter is still running.
+job_id() {
+  grep -o "JOB\[[0-9]*\]: .*file=$1\$" $WORK/out | head -1 | sed 's/^JOB\[\([0-9]*\)\].*/\1/'
+}
+job_status() {
+  grep "JOB\[$1\]: .*file=$2" $WORK/out | tail -1 | sed 's/.*=\([a-z]*\), eligible=.*/\1/'
+}
+printf '#!/bin/sh\nsleep 3\ncat > "$2.0"\n' > $WORK/split.sh
+chmod +x $WORK/split.sh
+cp $WORK/f0.ps $WORK/check_a.ps
+cp $WORK/f1.ps $WORK/check_b.ps
+cp $WORK/f0.txt $WORK/check_split.txt
+SPLIT_DIRS_BEFORE=$(ls -d /tmp/presi_split_* 2>/dev/null | wc -l)
+send "splitter txt $WORK/split.sh"
+for p in $(seq 1 $NUM_PRINTERS); do
+  send "disable p$p"
+done
+send "print $WORK/check_a.ps"
+send "print $WORK/check_b.ps"
+sleep 1
+a=$(job_id $WORK/check_a.ps) b=$(job_id $WORK/check_b.ps)
+send "cancel $a"
+sleep 2   # a expires, and b moves down the table
+send "retention 60"
+send "print -c 2 $WORK/check_split.txt"
+sleep 1
+s=$(job_id $WORK/check_split.txt)
+send "cancel $s"
+send "cancel $b"
+sleep 4   # the splitter would be done by now
+send "jobs"
+sleep 1
+id_errors=0
+[ "$(job_status $b $WORK/check_b.ps)" = aborted ] || id_errors=$((id_errors + 1))
+[ "$(job_status $s $WORK/check_split.txt)" = aborted ] || id_errors=$((id_errors + 1))
+grep -q "chunk of=$s\$" $WORK/out && id_errors=$((id_errors + 1))
+SPLIT_DIRS_AFTER=$(ls -d /tmp/presi_split_* 2>/dev/null | wc -l)
+[ $SPLIT_DIRS_AFTER -le $SPLIT_DIRS_BEFORE ] || id_errors=$((id_errors + 1))
+
+sleep 1
+FDS_AFTER=$(ls /proc/$PRESI_PID/fd | wc -l)
+LEAKED_PROCS=$(descendants $PRESI_PID | wc -l)
+
+send "quit"
+exec 3>&-
+wait $PRESI_PID
+bash util/stop_printers.sh > /dev/null
+
+created=$(metric presi_jobs_created_total)
+finished=$(metric presi_jobs_finished_total)
+aborted=$(metric presi_jobs_aborted_total)
+rejected=$((submitted - created))   # the job table was full
+
+echo "stress: ${DURATION}s, $NUM_PRINTERS printers, faults: $FAULTS, seed $SEED"
+echo "submitted=$submitted created=$created rejected=$rejected cancels=$cancels pauses=$pauses resumes=$resumes disables=$disables"
+echo "finished=$finished aborted=$aborted in ${ELAPSED}s, throughput=$(awk "BEGIN { printf \"%.2f\", $finished / $ELAPSED }") jobs/s"
+echo "stuck jobs: $stuck"
+echo "job command errors: $id_errors"
+echo "leaked processes: $LEAKED_PROCS"
+echo "leaked fds: $((FDS_AFTER - FDS_BEFORE))"
+
+[ "$stuck" -eq 0 ] && [ "$id_errors" -eq 0 ] && [ "$LEAKED_PROCS" -eq 0 ] && [ $FDS_AFTER -le $FDS_BEFORE ]